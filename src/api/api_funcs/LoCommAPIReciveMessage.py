@@ -71,9 +71,9 @@ def locomm_api_receive_message(timeout = -1) -> tuple[str, str, int] | tuple[Non
             LoCommGlobals.context.SEND_name = name_b.decode('ascii')
 
         if(LoCommGlobals.context.SEND_message == None):
-            LoCommGlobals.context.SEND_message = message_b.decode('ascii')
+            LoCommGlobals.context.SEND_message = message_b.decode('utf-8')
         else:
-            LoCommGlobals.context.SEND_message += message_b.decode('ascii')
+            LoCommGlobals.context.SEND_message += message_b.decode('utf-8')
 
         if(curr_packet == total_packet):
             LoCommGlobals.context.SEND_return = True   
@@ -2,16 +2,31 @@ import serial
 import random #for gen random tag
 import struct #creation of the packet
 import binascii #crc-16 (crc_hqx)
-import math
 from api_funcs.LoCommContext import LoCommContext
 from api_funcs.LoCommDebugPacket import print_packet_debug
 
-def craft_SEND_packet(tag: int, name: str, id: int, text: str, total_packets: int, curr_packet) -> bytes:
+#the device takes SEND packets of up to 4095 bytes, which leaves this many bytes of text next to a 255 char name
+MAX_CHUNK_SIZE: int = 3800
+
+def split_text(text: bytes, max_size: int) -> list[bytes]:
+    #splits UTF-8 text into chunks of at most max_size bytes without cutting a character in two, so each decodes on its own
+    chunks: list[bytes] = []
+    start: int = 0
+    while start < len(text):
+        end: int = min(start + max_size, len(text))
+        #continuation bytes are 0b10xxxxxx, back up to the first byte of the character they belong to
+        while end < len(text) and (text[end] & 0xC0) == 0x80:
+            end -= 1
+        chunks.append(text[start:end])
+        start = end
+    return chunks
+
+def craft_SEND_packet(tag: int, name: str, id: int, text: bytes, total_packets: int, curr_packet) -> bytes:
     start_bytes: int = 0x1234
     packet_size: int = len(name) + len(text) + 24
     message_type: bytes = b"SEND"
     #total_packets - 2, curr_packet - 2, name len - 1, text len -2, name, text
-    message: bytes = struct.pack(f">BHHBH{len(name)}s{len(text)}s", id, total_packets, curr_packet + 1, len(name), len(text), name.encode('ascii'), text.encode('ascii'))
+    message: bytes = struct.pack(f">BHHBH{len(name)}s{len(text)}s", id, total_packets, curr_packet + 1, len(name), len(text), name.encode('ascii'), text)
 
     #computer the payload for the checksum
     payload: bytes = struct.pack(">H", packet_size) + message_type + struct.pack(">I", tag) + message 
@@ -67,12 +82,12 @@ def check_SACK_packet(packet: bytes, tag: int, total_packets: int, packet_num: i
     return "no error", True 
 
 def locomm_api_send_message(sender_name: str, reciver_id: int, message: str, ser: serial.Serial, context: LoCommContext) -> bool:
-    #split the message into 1000 char chucnks and send each chunk (same tag)
+    #split the message into chucnks that fit in one SEND packet with the name, and send each chunk (same tag)
     tag: int = random.randint(0, 0xFFFFFFFF)
-    total_packets = math.ceil(len(message) / 1000)
-    for i in range (total_packets):
-        #for each chucnk also checks if its the last chunk
-        chunk: str = message[i * 1000 : (i+1) * 1000] if i != total_packets else message[i * 1000 : len(message)]
+    #the size limit is in bytes, so split the encoded text rather than the characters
+    chunks: list[bytes] = split_text(message.encode('utf-8'), MAX_CHUNK_SIZE)
+    total_packets = len(chunks)
+    for i, chunk in enumerate(chunks):
         #build packet
         packet: bytes = craft_SEND_packet(tag, sender_name, reciver_id, chunk, total_packets, i)
 
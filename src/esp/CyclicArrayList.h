@@ -53,12 +53,12 @@ class CyclicArrayList {
       return SIZE - this->spaceLeft();
     }
 
-    bool pushBack(const T* src, int size) { //TODO need to put a lock around this
+    bool pushBack(const T* src, uint32_t size) { //TODO need to put a lock around this
       if (size > this->spaceLeft()) return false;
       
       if (SIZE - bufferEnd < size) { //If adding to the buffer would wrap it around...
         memcpy(&(buffer[bufferEnd]), src, sizeof(T) * (SIZE - bufferEnd));
-        memcpy(buffer, src, sizeof(T) * (size - (SIZE - bufferEnd)));
+        memcpy(buffer, &(src[SIZE - bufferEnd]), sizeof(T) * (size - (SIZE - bufferEnd)));
         bufferEnd = (size - (SIZE - bufferEnd));
       } else { 
         memcpy(&(buffer[bufferEnd]), src, sizeof(T) * (size));
@@ -74,7 +74,7 @@ class CyclicArrayList {
       return true;
     }
 
-    bool peakFront(T* dst, int s) {
+    bool peakFront(T* dst, uint32_t s) {
       if (s > this->size()) {
         return false;
       }
@@ -89,7 +89,7 @@ class CyclicArrayList {
       return true;
     }
 
-    bool dropFront(int size) {
+    bool dropFront(uint32_t size) {
       if (size == 0) return true;
       if (size >= this->size()) {
         bufferStart = 0;
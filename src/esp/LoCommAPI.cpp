@@ -20,7 +20,7 @@ size_t device_in_size = 0;
 
 extern uint8_t deviceID;
 extern SimpleArraySet<SERIAL_READY_TO_SEND_BUFFER_SIZE, 5> serialReadyToSendArray;
-extern DefraggingBuffer<2048, 8> rxMessageBuffer;
+extern DefraggingBuffer<RX_MESSAGE_BUFFER_SIZE, 8> rxMessageBuffer;
 extern bool addMessageToTxArray(uint8_t* src, uint16_t size, uint8_t destinationID);
 extern portMUX_TYPE loraRxSpinLock;
 extern bool loraRxLock;
@@ -392,7 +392,12 @@ void handle_message_to_device(){
     //lcd.print("handle message to device");
     //delay(1000);
     //while(message_to_device_flag){
-    if (addMessageToTxArray(&(device_out_packet[0]), device_out_size, device_out_packet[13])) {
+    bool added;
+    {
+      ScopeLock(loraTxSpinLock, loraTxLock);
+      added = addMessageToTxArray(&(device_out_packet[0]), device_out_size, device_out_packet[13]);
+    }
+    if (added) {
       build_SACK_packet();
       message_to_device_flag = false; // Completed transfer to Ethans code
       device_out_size = 0;
@@ -437,8 +442,8 @@ void handle_message_from_device(){
     //wait for an ack
     //if no ack in 0.5 secs resend
     //try 10 or so times
-    bool ack_recv = false;
-    int times_tried = 0;
+    //bool ack_recv = false;
+    //int times_tried = 0;
     //TODO fix ack recv
     //while(!ack_recv || times_tried < 10){
 
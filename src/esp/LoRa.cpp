@@ -18,6 +18,7 @@
 #define REG_FIFO_RX_CURRENT_ADDR 0x10
 #define REG_IRQ_FLAGS            0x12
 #define REG_RX_NB_BYTES          0x13
+#define REG_MODEM_STAT           0x18
 #define REG_PKT_SNR_VALUE        0x19
 #define REG_PKT_RSSI_VALUE       0x1a
 #define REG_RSSI_VALUE           0x1b
@@ -80,10 +81,21 @@ LoRaClass::LoRaClass() :
   _implicitHeaderMode(0),
   _onReceive(NULL),
   _onCadDone(NULL),
-  _onTxDone(NULL)
+  _onTxDone(NULL),
+#if defined(ESP32)
+  _irqTask(NULL),
+  _irqNotifyBits(0),
+#endif
+  _spiTransactions(0),
+  _packetTransactionStart(0),
+  _lastTxPacketTransactions(0),
+  _rxPacketTransactionStart(0),
+  _lastRxPacketTransactions(0)
 {
   // overide Stream timeout value
   setTimeout(0);
+
+  invalidateRegisterShadow();
 }
 
 int LoRaClass::begin(long frequency)
@@ -123,6 +135,9 @@ int LoRaClass::begin(long frequency)
   // start SPI
   _spi->begin();
 
+  // the chip was just reset (or may have been reconfigured behind our back), so nothing in the shadow can be trusted
+  invalidateRegisterShadow();
+
   // check version
   uint8_t version = readRegister(REG_VERSION);
   if (version != 0x12) {
@@ -182,6 +197,8 @@ int LoRaClass::beginPacket(int implicitHeader)
   writeRegister(REG_FIFO_ADDR_PTR, 0);
   writeRegister(REG_PAYLOAD_LENGTH, 0);
 
+  _packetTransactionStart = _spiTransactions;
+
   return 1;
 }
 
@@ -194,6 +211,8 @@ int LoRaClass::endPacket(bool async)
   // put in TX mode
   writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX);
 
+  _lastTxPacketTransactions = _spiTransactions - _packetTransactionStart;
+
   if (!async) {
     // wait for TX done
     while ((readRegister(REG_IRQ_FLAGS) & IRQ_TX_DONE_MASK) == 0) {
@@ -201,6 +220,9 @@ int LoRaClass::endPacket(bool async)
     }
     // clear IRQ's
     writeRegister(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
+
+    // the modem is back in standby once TX is done
+    _regShadow[REG_OP_MODE] = MODE_LONG_RANGE_MODE | MODE_STDBY;
   }
 
   return 1;
@@ -208,7 +230,13 @@ int LoRaClass::endPacket(bool async)
 
 bool LoRaClass::isTransmitting()
 {
-  if ((readRegister(REG_OP_MODE) & MODE_TX) == MODE_TX) {
+  // if the shadow says we never started a TX there is nothing to ask the chip
+  if ((readRegister(REG_OP_MODE) & MODE_TX) != MODE_TX) {
+    return false;
+  }
+
+  // the modem leaves TX by itself, so confirm with the chip and resync the shadow
+  if ((readRegisterUncached(REG_OP_MODE) & MODE_TX) == MODE_TX) {
     return true;
   }
 
@@ -252,7 +280,7 @@ int LoRaClass::parsePacket(int size)
 
     // put in standby mode
     idle();
-  } else if (readRegister(REG_OP_MODE) != (MODE_LONG_RANGE_MODE | MODE_RX_SINGLE)) {
+  } else if (readRegisterUncached(REG_OP_MODE) != (MODE_LONG_RANGE_MODE | MODE_RX_SINGLE)) {
     // not currently in RX mode
 
     // reset FIFO address
@@ -299,6 +327,11 @@ int LoRaClass::rssi()
   return (readRegister(REG_RSSI_VALUE) - (_frequency < RF_MID_BAND_THRESHOLD ? RSSI_OFFSET_LF_PORT : RSSI_OFFSET_HF_PORT));
 }
 
+uint8_t LoRaClass::modemStatus()
+{
+  return readRegister(REG_MODEM_STAT);
+}
+
 size_t LoRaClass::write(uint8_t byte)
 {
   return write(&byte, sizeof(byte));
@@ -314,9 +347,7 @@ size_t LoRaClass::write(const uint8_t *buffer, size_t size)
   }
 
   // write data
-  for (size_t i = 0; i < size; i++) {
-    writeRegister(REG_FIFO, buffer[i]);
-  }
+  writeFifo(buffer, size);
 
   // update length
   writeRegister(REG_PAYLOAD_LENGTH, currentLength + size);
@@ -362,6 +393,43 @@ void LoRaClass::flush()
 {
 }
 
+size_t LoRaClass::readBytes(uint8_t *buffer, size_t length)
+{
+  int remaining = available();
+  if (remaining <= 0) {
+    return 0;
+  }
+
+  if (length > (size_t)remaining) {
+    length = remaining;
+  }
+
+  readFifo(buffer, length);
+  _packetIndex += length;
+
+  _lastRxPacketTransactions = _spiTransactions - _rxPacketTransactionStart;
+
+  return length;
+}
+
+void LoRaClass::writeFifo(const uint8_t *buffer, size_t size)
+{
+  if (size == 0) {
+    return;
+  }
+
+  burstTransfer(REG_FIFO | 0x80, NULL, buffer, size);
+}
+
+void LoRaClass::readFifo(uint8_t *buffer, size_t size)
+{
+  if (size == 0) {
+    return;
+  }
+
+  burstTransfer(REG_FIFO & 0x7f, buffer, NULL, size);
+}
+
 #ifndef ARDUINO_SAMD_MKRWAN1300
 void LoRaClass::onReceive(void(*callback)(int))
 {
@@ -438,6 +506,14 @@ void LoRaClass::channelActivityDetection(void)
   writeRegister(REG_DIO_MAPPING_1, 0x80);// DIO0 => CADDONE
   writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_CAD);
 }
+
+#if defined(ESP32)
+void LoRaClass::setInterruptTask(TaskHandle_t task, uint32_t notifyBits)
+{
+  _irqNotifyBits = notifyBits;
+  _irqTask = task;
+}
+#endif
 #endif
 
 void LoRaClass::idle()
@@ -452,7 +528,7 @@ void LoRaClass::sleep()
 
 uint8_t LoRaClass::readMode() 
 {
-  return readRegister(REG_OP_MODE);
+  return readRegisterUncached(REG_OP_MODE);
 }
 
 uint8_t LoRaClass::readIrqFlag() {
@@ -725,7 +801,7 @@ void LoRaClass::dumpRegisters(Stream& out)
     out.print("0x");
     out.print(i, HEX);
     out.print(": 0x");
-    out.println(readRegister(i), HEX);
+    out.println(readRegisterUncached(i), HEX);
   }
 }
 
@@ -745,11 +821,18 @@ void LoRaClass::implicitHeaderMode()
 
 void LoRaClass::handleDio0Rise()
 {
+  _rxPacketTransactionStart = _spiTransactions;
+
   int irqFlags = readRegister(REG_IRQ_FLAGS);
 
   // clear IRQ's
   writeRegister(REG_IRQ_FLAGS, irqFlags);
 
+  // CAD and TX both drop the modem back to standby on completion
+  if ((irqFlags & (IRQ_CAD_DONE_MASK | IRQ_TX_DONE_MASK)) != 0) {
+    _regShadow[REG_OP_MODE] = MODE_LONG_RANGE_MODE | MODE_STDBY;
+  }
+
   if ((irqFlags & IRQ_CAD_DONE_MASK) != 0) {
     if (_onCadDone) {
       _onCadDone((irqFlags & IRQ_CAD_DETECTED_MASK) != 0);
@@ -779,18 +862,94 @@ void LoRaClass::handleDio0Rise()
 
 uint8_t LoRaClass::readRegister(uint8_t address)
 {
-  return singleTransfer(address & 0x7f, 0x00);
+  address &= 0x7f;
+
+  if (isShadowedRegister(address)) {
+    if (!(_regShadowValid[address >> 5] & (1UL << (address & 31)))) {
+      _regShadow[address] = singleTransfer(address, 0x00);
+      _regShadowValid[address >> 5] |= (1UL << (address & 31));
+    }
+    return _regShadow[address];
+  }
+
+  return singleTransfer(address, 0x00);
+}
+
+uint8_t LoRaClass::readRegisterUncached(uint8_t address)
+{
+  address &= 0x7f;
+
+  uint8_t value = singleTransfer(address, 0x00);
+
+  if (isShadowedRegister(address)) {
+    _regShadow[address] = value;
+    _regShadowValid[address >> 5] |= (1UL << (address & 31));
+  }
+
+  return value;
 }
 
 void LoRaClass::writeRegister(uint8_t address, uint8_t value)
 {
+  address &= 0x7f;
+
+  if (isShadowedRegister(address)) {
+    const bool valid = _regShadowValid[address >> 5] & (1UL << (address & 31));
+
+    // skip writes that would not change anything. REG_OP_MODE is always written since the modem changes it on its own
+    if (valid && _regShadow[address] == value && address != REG_OP_MODE) {
+      return;
+    }
+
+    _regShadow[address] = value;
+    _regShadowValid[address >> 5] |= (1UL << (address & 31));
+  }
+
   singleTransfer(address | 0x80, value);
 }
 
+bool LoRaClass::isShadowedRegister(uint8_t address)
+{
+  switch (address) {
+    case REG_OP_MODE:
+    case REG_FRF_MSB:
+    case REG_FRF_MID:
+    case REG_FRF_LSB:
+    case REG_PA_CONFIG:
+    case REG_OCP:
+    case REG_LNA:
+    case REG_FIFO_TX_BASE_ADDR:
+    case REG_FIFO_RX_BASE_ADDR:
+    case REG_MODEM_CONFIG_1:
+    case REG_MODEM_CONFIG_2:
+    case REG_PREAMBLE_MSB:
+    case REG_PREAMBLE_LSB:
+    case REG_PAYLOAD_LENGTH:
+    case REG_MODEM_CONFIG_3:
+    case REG_DETECTION_OPTIMIZE:
+    case REG_INVERTIQ:
+    case REG_DETECTION_THRESHOLD:
+    case REG_SYNC_WORD:
+    case REG_INVERTIQ2:
+    case REG_DIO_MAPPING_1:
+    case REG_PA_DAC:
+      return true;
+  }
+
+  return false;
+}
+
+void LoRaClass::invalidateRegisterShadow()
+{
+  memset(_regShadowValid, 0, sizeof(_regShadowValid));
+}
+
 uint8_t LoRaClass::singleTransfer(uint8_t address, uint8_t value)
 {
   uint8_t response;
 
+  _spiTransactions++;
+
   _spi->beginTransaction(_spiSettings);
   digitalWrite(_ss, LOW);
   _spi->transfer(address);
@@ -801,8 +960,43 @@ uint8_t LoRaClass::singleTransfer(uint8_t address, uint8_t value)
   return response;
 }
 
+// the FIFO address pointer auto-increments, so a whole payload can be streamed behind one address byte
+void LoRaClass::burstTransfer(uint8_t address, uint8_t *buffer, const uint8_t *src, size_t size)
+{
+  _spiTransactions++;
+
+  _spi->beginTransaction(_spiSettings);
+  digitalWrite(_ss, LOW);
+  _spi->transfer(address);
+  if (src) {
+#if defined(ESP32)
+    _spi->writeBytes(src, size);
+#else
+    for (size_t i = 0; i < size; i++) {
+      _spi->transfer(src[i]);
+    }
+#endif
+  } else {
+    memset(buffer, 0x00, size);
+    _spi->transfer(buffer, size);
+  }
+  digitalWrite(_ss, HIGH);
+  _spi->endTransaction();
+}
+
 ISR_PREFIX void LoRaClass::onDio0Rise()
 {
+#if defined(ESP32)
+  // defer the SPI work to the interrupt task if one is registered
+  if (LoRa._irqTask) {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    xTaskNotifyFromISR(LoRa._irqTask, LoRa._irqNotifyBits, eSetBits, &higherPriorityTaskWoken);
+    if (higherPriorityTaskWoken) {
+      portYIELD_FROM_ISR();
+    }
+    return;
+  }
+#endif
   LoRa.handleDio0Rise();
 }
 
@@ -46,6 +46,8 @@ public:
   long packetFrequencyError();
 
   int rssi();
+  // RegModemStat: bit 0 signal detected, 1 signal synchronized, 2 RX ongoing, 3 header info valid, 4 modem clear
+  uint8_t modemStatus();
 
   // from Print
   virtual size_t write(uint8_t byte);
@@ -57,6 +59,12 @@ public:
   virtual int peek();
   virtual void flush();
 
+  // burst FIFO access, one SPI transaction per call
+  size_t readBytes(uint8_t *buffer, size_t length);
+  size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+  void writeFifo(const uint8_t *buffer, size_t size);
+  void readFifo(uint8_t *buffer, size_t size);
+
 #ifndef ARDUINO_SAMD_MKRWAN1300
   void onReceive(void(*callback)(int));
   void onCadDone(void(*callback)(boolean));
@@ -64,7 +72,13 @@ public:
 
   void receive(int size = 0);
   void channelActivityDetection(void);
+
+#if defined(ESP32)
+  // when set, the DIO0 ISR only notifies this task and the task is expected to call handleDio0Rise() itself
+  void setInterruptTask(TaskHandle_t task, uint32_t notifyBits);
+#endif
 #endif
+  void handleDio0Rise();
   void idle();
   void sleep();
   uint8_t readMode();
@@ -100,11 +114,15 @@ public:
 
   void dumpRegisters(Stream& out);
 
+  // SPI transaction accounting, used to measure the cost of the radio path
+  uint32_t spiTransactionCount() { return _spiTransactions; }
+  uint32_t lastTxPacketSpiTransactions() { return _lastTxPacketTransactions; }
+  uint32_t lastRxPacketSpiTransactions() { return _lastRxPacketTransactions; }
+
 private:
   void explicitHeaderMode();
   void implicitHeaderMode();
 
-  void handleDio0Rise();
   bool isTransmitting();
 
   int getSpreadingFactor();
@@ -114,8 +132,12 @@ private:
   void setLdoFlagForced(const boolean);
 
   uint8_t readRegister(uint8_t address);
+  uint8_t readRegisterUncached(uint8_t address);
   void writeRegister(uint8_t address, uint8_t value);
+  bool isShadowedRegister(uint8_t address);
+  void invalidateRegisterShadow();
   uint8_t singleTransfer(uint8_t address, uint8_t value);
+  void burstTransfer(uint8_t address, uint8_t *buffer, const uint8_t *src, size_t size);
 
   static void onDio0Rise();
 
@@ -131,6 +153,21 @@ private:
   void (*_onReceive)(int);
   void (*_onCadDone)(boolean);
   void (*_onTxDone)();
+#if defined(ESP32)
+  TaskHandle_t _irqTask;
+  uint32_t _irqNotifyBits;
+#endif
+
+  // write-through shadow of the configuration registers. Only registers the modem never changes on its own are shadowed,
+  // REG_OP_MODE being the exception since TX, CAD and single RX fall back to standby by themselves (see isTransmitting)
+  uint8_t _regShadow[128];
+  uint32_t _regShadowValid[4];
+
+  volatile uint32_t _spiTransactions;
+  uint32_t _packetTransactionStart;
+  uint32_t _lastTxPacketTransactions;
+  uint32_t _rxPacketTransactionStart;
+  uint32_t _lastRxPacketTransactions;
 };
 
 extern LoRaClass LoRa;
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string.h>
+#include "functions.h"
+
+//Messages being put back together from their fragments, keyed by (sender, message number) so two senders that happen
+//to pick the same message number don't end up in each other's buffers.
+//Open addressing with linear probing. SIZE must be a power of two and should be a few times the number of messages
+//that can be in flight (rxMessageBuffer allocations), which keeps probe runs to a slot or two. Removal shifts the rest
+//of the run back instead of leaving tombstones, so lookups never get slower as messages come and go
+
+struct RxReassembly {
+  bool used;
+  uint8_t sender;
+  uint16_t messageNumber;
+  uint16_t bufferLocation; //allocation in rxMessageBuffer
+  uint16_t size; //bytes in the allocation that hold the message
+  uint8_t sequenceCount;
+  uint8_t sequenceSize; //size of every fragment but the last
+  uint8_t receivedCount;
+  uint8_t receivedBitmap[(SEQUENCE_MAX_COUNT + 7) / 8]; //one bit per fragment, only the first sequenceCount are used
+  uint16_t timer; //expiry timer in rxTimers, pushed back with every fragment
+
+  bool hasFragment(uint8_t sequenceNumber) {
+    return receivedBitmap[sequenceNumber >> 3] & (1 << (sequenceNumber & 7));
+  }
+
+  void markFragment(uint8_t sequenceNumber) {
+    receivedBitmap[sequenceNumber >> 3] |= 1 << (sequenceNumber & 7);
+    receivedCount++;
+  }
+
+  bool complete() {
+    return receivedCount == sequenceCount;
+  }
+
+  //the bitmap as sent in ACKs, bit n is fragment n
+  uint32_t receivedMask() {
+    uint32_t mask = 0;
+    for (unsigned int i = 0; i < sizeof(receivedBitmap); i++) mask |= (uint32_t) receivedBitmap[i] << (8 * i);
+    return mask;
+  }
+};
+
+template <int SIZE>
+class ReassemblyTable {
+  public:
+    uint32_t size() {
+      return length;
+    }
+
+    uint32_t capacity() {
+      return SIZE;
+    }
+
+    //slot i of the table, or NULL if it is empty. Removing the entry in slot i can move another one into it, so check
+    //the same slot again after a remove()
+    RxReassembly* slot(int i) {
+      return entries[i].used ? &(entries[i]) : NULL;
+    }
+
+    RxReassembly* find(uint8_t sender, uint16_t messageNumber) {
+      for (uint32_t i = home(sender, messageNumber); entries[i].used; i = (i + 1) & (SIZE - 1)) {
+        if (entries[i].sender == sender && entries[i].messageNumber == messageNumber) return &(entries[i]);
+      }
+      return NULL;
+    }
+
+    //returns a cleared entry for the key, or NULL if the table is full. The key must not be in the table already
+    RxReassembly* add(uint8_t sender, uint16_t messageNumber) {
+      if (length >= SIZE - 1) return NULL; //always leave an empty slot, so probe runs end
+      uint32_t i = home(sender, messageNumber);
+      while (entries[i].used) i = (i + 1) & (SIZE - 1);
+      memset(&(entries[i]), 0, sizeof(RxReassembly));
+      entries[i].used = true;
+      entries[i].sender = sender;
+      entries[i].messageNumber = messageNumber;
+      length++;
+      return &(entries[i]);
+    }
+
+    void remove(RxReassembly* entry) {
+      uint32_t hole = entry - &(entries[0]);
+      if (hole >= SIZE || !entries[hole].used) return;
+      entries[hole].used = false;
+      length--;
+      //pull later entries of the run back into the hole if they are allowed to sit there
+      for (uint32_t i = (hole + 1) & (SIZE - 1); entries[i].used; i = (i + 1) & (SIZE - 1)) {
+        const uint32_t want = home(entries[i].sender, entries[i].messageNumber);
+        if (((i - want) & (SIZE - 1)) >= ((i - hole) & (SIZE - 1))) {
+          entries[hole] = entries[i];
+          entries[i].used = false;
+          hole = i;
+        }
+      }
+    }
+
+    void clearAll() {
+      for (int i = 0; i < SIZE; i++) entries[i].used = false;
+      length = 0;
+    }
+
+  private:
+    static uint32_t home(uint8_t sender, uint16_t messageNumber) {
+      uint32_t key = ((uint32_t) sender << 16) | messageNumber;
+      key *= 0x9E3779B1; //Fibonacci hashing, the top bits are the well mixed ones
+      return (key >> 16) & (SIZE - 1);
+    }
+
+    RxReassembly entries[SIZE];
+    uint32_t length = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "functions.h"
+#include "radioTask.h"
+
+//Received packets waiting to be parsed, kept whole along with the link quality and arrival time they came with.
+//LoRa already tells us where a packet ends, so frames are only looked for at packet boundaries: the first frame starts
+//at the start of the packet and its length byte says where the next one would start. Every frame is checked once, in
+//place. Whatever is left of a packet once something in it doesn't check out is dropped with it
+//Frame layout: START_BYTE, type, payload length, routing header (data and ACKs only), ciphertext, crc hi, crc lo, END_BYTE
+//(see buildFrame())
+
+struct RxPacket {
+  uint16_t size;
+  int16_t rssi;
+  float snr;
+  uint8_t dataRate; //rate the packet was received on
+  uint8_t channel; //channel the packet was received on
+  uint32_t timestamp; //millis() when the radio task handled the interrupt
+  uint8_t data[256];
+};
+
+template <int SIZE>
+class RxPacketRing {
+  public:
+    bool pushBack(const RadioEvent* event) {
+      if (count == SIZE) return false;
+      RxPacket* packet = &(packets[(first + count) % SIZE]);
+      packet->size = event->size;
+      packet->rssi = event->rssi;
+      packet->snr = event->snr;
+      packet->dataRate = event->dataRate;
+      packet->channel = event->channel;
+      packet->timestamp = event->timestamp;
+      memcpy(&(packet->data[0]), &(event->data[0]), event->size);
+      count++;
+      return true;
+    }
+
+    //points frame at the next frame with a valid CRC and packet at the packet it came in, and returns its size. Both
+    //stay valid until the next call. Returns 0 if there are no frames left
+    uint16_t nextFrame(const uint8_t** frame, const RxPacket** packet) {
+      while (count > 0) {
+        const RxPacket* front = &(packets[first]);
+        const uint8_t* candidate = &(front->data[offset]);
+        const uint16_t remaining = front->size - offset;
+        uint16_t frameSize = 0;
+        if (remaining >= FRAME_OVERHEAD && candidate[0] == START_BYTE && candidate[2] > AES_GCM_OVERHEAD) {
+          frameSize = candidate[2] + FRAME_OVERHEAD;
+          if (frameSize > remaining || candidate[frameSize - 1] != END_BYTE) {
+            frameSize = 0;
+          } else if (frameCrc(candidate, candidate[2]) != (candidate[frameSize - 3] << 8) + candidate[frameSize - 2]) {
+            crcFailures++;
+            frameSize = 0;
+          }
+        }
+
+        if (frameSize == 0) {
+          if (remaining > 0) droppedBytes += remaining;
+          first = (first + 1) % SIZE;
+          count--;
+          offset = 0;
+          continue;
+        }
+        offset += frameSize;
+        *frame = candidate;
+        *packet = front;
+        return frameSize;
+      }
+      return 0;
+    }
+
+    uint32_t size() {
+      return count;
+    }
+
+    void clearBuffer() {
+      first = 0;
+      count = 0;
+      offset = 0;
+    }
+
+    uint32_t droppedBytes = 0; //bytes of received packets that weren't part of a valid frame
+    uint32_t crcFailures = 0;
+
+  private:
+    RxPacket packets[SIZE];
+    uint16_t first = 0; //index of the packet being parsed
+    uint16_t count = 0;
+    uint16_t offset = 0; //where the next frame in the first packet starts
+};
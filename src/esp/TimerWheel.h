@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string.h>
+
+#define TIMER_NONE 0xFFFF
+
+//Hashed timer wheel for the protocol timers (reassembly expiry, resends).
+//Every timer hangs off the slot its deadline's tick lands in, in a doubly linked list threaded through a fixed pool, so
+//scheduling and cancelling are O(1) and a tick only looks at the timers in one slot. A timer more than one turn of the
+//wheel out just stays put until the wheel comes back around after its deadline. Deadlines are full millis() values and
+//only ever compared by their difference, so millis() wrapping around doesn't matter.
+//Ticks are 2^TICK_SHIFT ms and SLOTS must be a power of two. A timer is identified by a handle into the pool, and carries
+//a key the owner uses to find what it belongs to, since entries in the tables move around
+
+template <int SLOTS, int CAPACITY, int TICK_SHIFT>
+class TimerWheel {
+  public:
+    void init(uint32_t now) {
+      for (int i = 0; i < SLOTS; i++) heads[i] = TIMER_NONE;
+      for (int i = 0; i < CAPACITY; i++) {
+        timers[i].active = false;
+        timers[i].next = i + 1 < CAPACITY ? i + 1 : TIMER_NONE;
+      }
+      freeList = 0;
+      current = (now >> TICK_SHIFT) & TICK_MASK;
+      length = 0;
+    }
+
+    uint32_t size() {
+      return length;
+    }
+
+    //returns the timer's handle, or TIMER_NONE if the pool is used up
+    uint16_t schedule(uint32_t deadline, uint32_t key) {
+      if (freeList == TIMER_NONE) return TIMER_NONE;
+      const uint16_t handle = freeList;
+      Timer* timer = &(timers[handle]);
+      freeList = timer->next;
+
+      //a deadline that has already passed goes in the slot being looked at, so it fires on the next expired() call
+      uint32_t tick = (deadline >> TICK_SHIFT) & TICK_MASK;
+      if (((tick - current) & TICK_MASK) > TICK_MASK / 2) tick = current;
+
+      timer->active = true;
+      timer->deadline = deadline;
+      timer->key = key;
+      timer->slot = tick & (SLOTS - 1);
+      timer->prev = TIMER_NONE;
+      timer->next = heads[timer->slot];
+      if (timer->next != TIMER_NONE) timers[timer->next].prev = handle;
+      heads[timer->slot] = handle;
+      length++;
+      return handle;
+    }
+
+    void cancel(uint16_t handle) {
+      if (handle >= CAPACITY || !timers[handle].active) return;
+      Timer* timer = &(timers[handle]);
+      if (timer->prev != TIMER_NONE) timers[timer->prev].next = timer->next;
+      else heads[timer->slot] = timer->next;
+      if (timer->next != TIMER_NONE) timers[timer->next].prev = timer->prev;
+      timer->active = false;
+      timer->next = freeList;
+      freeList = handle;
+      length--;
+    }
+
+    //moves a timer to a new deadline, returns its new handle
+    uint16_t reschedule(uint16_t handle, uint32_t deadline) {
+      if (handle >= CAPACITY || !timers[handle].active) return TIMER_NONE;
+      const uint32_t key = timers[handle].key;
+      cancel(handle);
+      return schedule(deadline, key);
+    }
+
+    //takes one timer that is due by now off the wheel and gives back its key. Returns false once none are left
+    bool expired(uint32_t now, uint32_t* key) {
+      const uint32_t nowTick = (now >> TICK_SHIFT) & TICK_MASK;
+      //after a long stall, one turn of the wheel covers every slot
+      if (((nowTick - current) & TICK_MASK) > SLOTS) current = (nowTick - SLOTS) & TICK_MASK;
+      while (true) {
+        for (uint16_t handle = heads[current & (SLOTS - 1)]; handle != TIMER_NONE; handle = timers[handle].next) {
+          if ((int32_t) (timers[handle].deadline - now) <= 0) {
+            *key = timers[handle].key;
+            cancel(handle);
+            return true;
+          }
+        }
+        if (current == nowTick) return false;
+        current = (current + 1) & TICK_MASK;
+      }
+    }
+
+    void clearAll(uint32_t now) {
+      init(now);
+    }
+
+  private:
+    static const uint32_t TICK_MASK = 0xFFFFFFFFUL >> TICK_SHIFT;
+
+    struct Timer {
+      bool active;
+      uint16_t slot;
+      uint16_t prev;
+      uint16_t next; //next in the slot, or in the free list
+      uint32_t deadline;
+      uint32_t key;
+    };
+
+    Timer timers[CAPACITY];
+    uint16_t heads[SLOTS];
+    uint16_t freeList;
+    uint32_t current; //tick being looked at
+    uint32_t length = 0;
+};
@@ -1,16 +1,26 @@
 #include "apiCode.h"
 
+TaskHandle_t apiTaskHandle = NULL;
+
 void apiCode( void* params ) {
+  (void) params; //FreeRTOS task signature, nothing is passed in
+  uint32_t lastSerialPoll = millis();
   while (1) {
-    delay(1000);
+    //sleep until the next look at the serial port, or until loop() has a completed message for the host
+    const uint32_t sincePoll = millis() - lastSerialPoll;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sincePoll < API_SERIAL_POLL_MS ? API_SERIAL_POLL_MS - sincePoll : 0));
     //display.clearDisplay();
     //display.setCursor(0,0);
     //display.printf("SerialReady2SendArr: %lu", serialReadyToSendArray.size());
     //display.display();
-    if(serialReadyToSendArray.size() > 0){
+    while(serialReadyToSendArray.size() > 0){
       handle_message_from_device();
     }
 
+    //the host is still only polled every API_SERIAL_POLL_MS, so a packet it is halfway through sending isn't picked up early
+    if (millis() - lastSerialPoll < API_SERIAL_POLL_MS) continue;
+    lastSerialPoll = millis();
+
     //there is a message from the device and the subsaquent funcs check and handle that
     recive_packet_from_computer();
     if(message_from_computer_flag){
@@ -25,4 +35,8 @@ void apiCode( void* params ) {
     }
   }
   
-}
\ No newline at end of file
+}
+
+void apiNotifyMessageReady() {
+  if (apiTaskHandle != NULL) xTaskNotifyGive(apiTaskHandle);
+}
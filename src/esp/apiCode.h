@@ -4,6 +4,10 @@
 #include "LoCommAPI.h"
 #include "globals.h"
 
+extern TaskHandle_t apiTaskHandle;
+
 void apiCode( void* params );
+//wakes the API task to pass a completed message in serialReadyToSendArray on to the host
+void apiNotifyMessageReady();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include "channelPlan.h"
+#include "globals.h"
+#include "mbedtls/sha256.h"
+
+volatile uint8_t channelHome = CHANNEL_RENDEZVOUS;
+
+static bool hopKeyValid = false;
+static uint8_t hopKey[32];
+static uint32_t hopInterval = 0; //hop interval the permutation below was computed for
+static uint8_t hopPermutation[CHANNEL_PLAN_COUNT];
+
+void channelPlanInit() {
+  hopKeyValid = CHANNEL_HOPPING_ENABLED && sec_deriveD2DSubkey(CHANNEL_HOP_LABEL, &(hopKey[0]));
+  if (!hopKeyValid) LWarn("Could not derive the hop sequence, staying on the rendezvous channel");
+  hopInterval = 0;
+  channelHome = CHANNEL_RENDEZVOUS;
+}
+
+void channelPlanReset() {
+  memset(hopKey, 0, sizeof(hopKey));
+  hopKeyValid = false;
+  channelHome = CHANNEL_RENDEZVOUS;
+}
+
+//shuffles the channel plan with SHA-256(hop key, interval) as the source of randomness
+static void channelPlanShuffle(uint32_t interval) {
+  uint8_t input[32 + 4];
+  uint8_t digest[32];
+  memcpy(&(input[0]), hopKey, 32);
+  input[32] = interval >> 24;
+  input[33] = (interval >> 16) & 0xFF;
+  input[34] = (interval >> 8) & 0xFF;
+  input[35] = interval & 0xFF;
+  mbedtls_sha256(input, sizeof(input), digest, 0);
+
+  for (uint8_t i = 0; i < CHANNEL_PLAN_COUNT; i++) hopPermutation[i] = i;
+  for (uint8_t i = CHANNEL_PLAN_COUNT - 1; i > 0; i--) {
+    const uint8_t j = digest[i] % (i + 1);
+    const uint8_t swap = hopPermutation[i];
+    hopPermutation[i] = hopPermutation[j];
+    hopPermutation[j] = swap;
+  }
+  hopInterval = interval;
+}
+
+bool channelPlanRefresh(uint8_t ownID) {
+  if (hopKeyValid && epochAtBoot != 0) {
+    const uint32_t interval = ((millis() / 1000) + epochAtBoot) / CHANNEL_HOP_INTERVAL_S;
+    if (interval != hopInterval) channelPlanShuffle(interval);
+  }
+  const uint8_t home = channelFor(ownID);
+  const bool changed = home != channelHome;
+  channelHome = home;
+  return changed;
+}
+
+bool channelPlanActive() {
+  return hopKeyValid && hopInterval != 0;
+}
+
+uint8_t channelFor(uint8_t peer) {
+  if (!channelPlanActive() || peer == 0 || peer == 255) return CHANNEL_RENDEZVOUS;
+  return hopPermutation[peer % CHANNEL_PLAN_COUNT];
+}
+
+uint32_t channelFrequency(uint8_t channel) {
+  if (channel == CHANNEL_RENDEZVOUS) return CHANNEL_RENDEZVOUS_HZ;
+  return CHANNEL_PLAN_FIRST_HZ + channel * CHANNEL_PLAN_SPACING_HZ;
+}
@@ -0,0 +1,43 @@
+#ifndef CHANNELPLAN_H
+#define CHANNELPLAN_H
+
+#include "functions.h"
+
+//Key-derived frequency hopping.
+//Every node has a home channel that frames addressed to it are sent on. Home channels come from a permutation of the
+//channel plan that is derived from the D2D key and changes every CHANNEL_HOP_INTERVAL_S of epoch time, so only paired
+//devices can tell where a node will be listening next, and nodes with different IDs end up spread across the plan.
+//Broadcasts and device ID traffic stay on the rendezvous channel. Nodes don't listen there, they look in on it at
+//DATA_RATE_DEFAULT with one CAD every CHANNEL_RENDEZVOUS_VISIT_MS (see radioTask.cpp), and frames sent there carry a
+//preamble that lasts that long so every node finds them on its next visit. An ACK in the reply window comes back on the
+//channel the frame it answers went out on, anything later goes to the sender's home channel like any other frame.
+//Until a node is paired and has a device ID, it only uses the rendezvous channel.
+
+#define CHANNEL_HOPPING_ENABLED true
+#define CHANNEL_PLAN_COUNT 8
+#define CHANNEL_PLAN_FIRST_HZ 902.5E6
+#define CHANNEL_PLAN_SPACING_HZ 1.5E6 //wide enough for the 250kHz data rate
+#define CHANNEL_RENDEZVOUS 255 //channel index of the rendezvous channel
+#define CHANNEL_RENDEZVOUS_HZ BAND //where LoRa.begin() leaves the modem
+#define CHANNEL_HOP_INTERVAL_S 60 //epoch clocks only agree to about a second, so frames sent right at a hop can go astray
+//longer means fewer frames on the home channel missed while away and more preamble on every rendezvous frame. At
+//DATA_RATE_DEFAULT this is about 100 symbols, a quarter of the airtime of a full size frame
+#define CHANNEL_RENDEZVOUS_VISIT_MS 100
+#define CHANNEL_HOP_LABEL "LoComm hop sequence"
+
+//index of the channel the modem listens on for frames addressed to us. Written by loop(), read by the radio task
+extern volatile uint8_t channelHome;
+
+//derives the hop sequence from the D2D key. Call once logged in and paired
+void channelPlanInit();
+//forgets the hop sequence, everything goes back to the rendezvous channel
+void channelPlanReset();
+//moves to the current hop interval and recomputes our home channel. Returns true if it changed
+bool channelPlanRefresh(uint8_t ownID);
+//true if frames are being spread across the channel plan
+bool channelPlanActive();
+
+uint8_t channelFor(uint8_t peer);
+uint32_t channelFrequency(uint8_t channel);
+
+#endif
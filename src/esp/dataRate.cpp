@@ -0,0 +1,164 @@
+#include "dataRate.h"
+#include "channelPlan.h"
+
+//slowest first. Moving up the table trades link budget for airtime
+const DataRate dataRates[DATA_RATE_COUNT] = {
+  {10, 125000, -15.0},
+  {9, 125000, -12.5},
+  {8, 125000, -10.0},
+  {7, 125000, -7.5},
+  {7, 250000, -7.5},
+};
+
+volatile uint8_t dataRateListenMask = (1 << DATA_RATE_DEFAULT);
+
+static PeerLink peers[256];
+
+void dataRateInit() {
+  memset(peers, 0, sizeof(peers));
+  for (int i = 0; i < 256; i++) {
+    peers[i].rxRate = DATA_RATE_DEFAULT;
+    peers[i].txRate = DATA_RATE_DEFAULT;
+  }
+  dataRateListenMask = (1 << DATA_RATE_DEFAULT);
+}
+
+uint32_t dataRateSymbolTimeUs(uint8_t rate) {
+  return (uint32_t) ((1000000LL << dataRates[rate].spreadingFactor) / dataRates[rate].bandwidth);
+}
+
+uint32_t dataRateScanCycleUs(uint8_t mask) {
+  //CAD takes a little under two symbols
+  uint32_t cycle = 0;
+  for (uint8_t rate = 0; rate < DATA_RATE_COUNT; rate++) {
+    if (mask & (1 << rate)) cycle += 2 * dataRateSymbolTimeUs(rate) + DATA_RATE_SCAN_SWITCH_US;
+  }
+  return cycle;
+}
+
+//SNR is measured against the noise in the receive bandwidth, so a wider channel costs the same link that many dB
+static float bandwidthPenaltyDb(uint8_t rate) {
+  return 10.0 * log10(dataRates[rate].bandwidth / 125E3);
+}
+
+static uint8_t fastestRateFor(float snr) {
+  for (int rate = DATA_RATE_COUNT - 1; rate > DATA_RATE_SLOWEST; rate--) {
+    if (snr - bandwidthPenaltyDb(rate) >= dataRates[rate].requiredSnr + DATA_RATE_MARGIN_DB) return rate;
+  }
+  return DATA_RATE_SLOWEST;
+}
+
+void dataRateRecordFrame(uint8_t peer, float snr, int16_t rssi, uint8_t rate) {
+  if (peer == 0 || peer == 255 || rate >= DATA_RATE_COUNT) return;
+  PeerLink* link = &(peers[peer]);
+  const float scaled = snr + bandwidthPenaltyDb(rate);
+  link->snr = link->samples == 0 ? scaled : link->snr + DATA_RATE_SNR_WEIGHT * (scaled - link->snr);
+  link->rssi = rssi;
+  link->lastHeard = millis();
+  if (link->samples < 255) link->samples++;
+
+  //step down as soon as the link gets worse, step up only once it has been good for a few frames
+  const uint8_t best = fastestRateFor(link->snr);
+  if (best < link->rxRate || (best > link->rxRate && link->samples >= DATA_RATE_SAMPLES_TO_STEP_UP)) {
+    Debug(Serial1.printf("Data rate for peer %d: SNR %.1f, asking for rate %d instead of %d\n", peer, link->snr, best, link->rxRate));
+    link->rxRate = best;
+  }
+}
+
+void dataRateRecordListenMask(uint8_t peer, uint8_t scanMask) {
+  if (peer == 0 || peer == 255) return;
+  PeerLink* link = &(peers[peer]);
+  link->txScanMask = scanMask | (1 << DATA_RATE_DEFAULT);
+  link->txScanMaskTime = millis();
+}
+
+void dataRateRecordRequest(uint8_t peer, uint8_t rate, uint8_t scanMask) {
+  if (peer == 0 || peer == 255 || rate >= DATA_RATE_COUNT) return;
+  PeerLink* link = &(peers[peer]);
+  link->txRate = rate;
+  link->txRateTime = millis();
+  link->failures = 0;
+  dataRateRecordListenMask(peer, scanMask | (1 << rate));
+}
+
+void dataRateRecordFailure(uint8_t peer) {
+  if (peer == 0 || peer == 255) return;
+  if (peers[peer].failures < 255) peers[peer].failures++;
+}
+
+bool dataRatePeerHeard(uint8_t peer) {
+  if (peer == 0 || peer == 255) return false;
+  return peers[peer].samples > 0 && millis() - peers[peer].lastHeard <= DATA_RATE_PEER_TIMEOUT_MS;
+}
+
+bool dataRateRefresh() {
+  uint8_t mask = (1 << DATA_RATE_DEFAULT);
+  const uint32_t now = millis();
+  for (int i = 1; i < 255; i++) {
+    PeerLink* link = &(peers[i]);
+    if (link->txRateTime != 0 && now - link->txRateTime > DATA_RATE_PEER_TIMEOUT_MS) {
+      link->txRateTime = 0;
+      link->txRate = DATA_RATE_DEFAULT;
+    }
+    if (link->txScanMaskTime != 0 && now - link->txScanMaskTime > DATA_RATE_PEER_TIMEOUT_MS) {
+      link->txScanMaskTime = 0;
+      link->txScanMask = 0;
+    }
+    if (link->samples == 0) continue;
+    if (now - link->lastHeard > DATA_RATE_PEER_TIMEOUT_MS) {
+      link->samples = 0;
+      link->rxRate = DATA_RATE_DEFAULT;
+      continue;
+    }
+    mask |= 1 << link->rxRate;
+  }
+  const bool changed = mask != dataRateListenMask;
+  dataRateListenMask = mask;
+  return changed;
+}
+
+uint8_t dataRateRequestFor(uint8_t peer) {
+  return peers[peer].rxRate;
+}
+
+uint8_t dataRateFor(uint8_t peer) {
+  if (peer == 0 || peer == 255) return DATA_RATE_DEFAULT;
+  const PeerLink* link = &(peers[peer]);
+
+  //the peer told us what it wants. Failing that, links are close enough to symmetric that the rate we picked for it
+  //will do, as long as we know the peer is listening on it
+  uint8_t rate = DATA_RATE_DEFAULT;
+  if (link->txRateTime != 0) {
+    rate = link->txRate;
+  } else if (link->samples > 0 && link->txScanMaskTime != 0 && (link->txScanMask & (1 << link->rxRate))) {
+    rate = link->rxRate;
+  }
+
+  //the peer is only guaranteed to listen on the default rate, so that is where to go when a faster one stops working.
+  //A slower rate was asked for because the link needs it, and the peer keeps listening on it for us
+  if (link->failures >= DATA_RATE_FAILURES_TO_STEP_DOWN && rate > DATA_RATE_DEFAULT) {
+    rate = DATA_RATE_DEFAULT;
+  }
+  return rate;
+}
+
+uint16_t dataRatePreambleFor(uint8_t peer, uint8_t rate) {
+  const uint32_t symbol = dataRateSymbolTimeUs(rate);
+  //receivers only look in on the rendezvous channel now and then, so frames there have to last until their next look
+  if (channelPlanActive() && channelFor(peer) == CHANNEL_RENDEZVOUS) {
+    const uint32_t visit = CHANNEL_RENDEZVOUS_VISIT_MS * 1000 + dataRateScanCycleUs(1 << DATA_RATE_DEFAULT);
+    return (visit + symbol - 1) / symbol + DATA_RATE_PREAMBLE_MARGIN;
+  }
+
+  //if we don't know what the peer listens on, cover a hop across every rate
+  uint8_t mask = (1 << DATA_RATE_COUNT) - 1;
+  if (peer != 0 && peer != 255 && peers[peer].txScanMaskTime != 0) {
+    mask = peers[peer].txScanMask;
+  }
+  //a receiver that only listens on one rate sits in RX, but still leaves it for its visits to the rendezvous channel
+  const bool visits = channelPlanActive();
+  if ((mask & (mask - 1)) == 0 && !visits) return DATA_RATE_PREAMBLE_MARGIN;
+  uint32_t cycle = (mask & (mask - 1)) == 0 ? 0 : dataRateScanCycleUs(mask);
+  if (visits) cycle += dataRateScanCycleUs(1 << DATA_RATE_DEFAULT);
+  return (cycle + symbol - 1) / symbol + DATA_RATE_PREAMBLE_MARGIN;
+}
@@ -0,0 +1,71 @@
+#ifndef DATARATE_H
+#define DATARATE_H
+
+#include "functions.h"
+
+//Adaptive data rate, negotiated per peer.
+//The SX127x can only demodulate one SF/BW at a time, so a node that expects traffic on more than one rate listens by
+//hopping CAD across them (see radioTask.cpp) and senders stretch their preamble to cover one full hop cycle.
+//Every node always listens on DATA_RATE_DEFAULT, which is what LoRa.begin() configures and what broadcasts use.
+//Rates are chosen by the receiver: it tracks the SNR of every frame it hears from a peer, picks the fastest rate with
+//DATA_RATE_MARGIN_DB to spare, starts listening on it and asks the peer for it in every ACK it sends back.
+
+#define DATA_RATE_COUNT 5
+#define DATA_RATE_SLOWEST 0
+#define DATA_RATE_DEFAULT 3
+#define DATA_RATE_BROADCAST 255 //peer ID used for frames that everyone has to be able to hear
+
+#define DATA_RATE_MARGIN_DB 6.0
+#define DATA_RATE_SNR_WEIGHT 0.25 //weight of a new sample in the SNR average
+#define DATA_RATE_SAMPLES_TO_STEP_UP 3 //frames a peer has to be heard on before we ask it for a faster rate
+#define DATA_RATE_PEER_TIMEOUT_MS 180000 //forget what a peer asked for, and stop listening for it, after this long
+#define DATA_RATE_FAILURES_TO_STEP_DOWN 2 //resends to a peer before falling back from a faster rate to the default one
+#define DATA_RATE_SCAN_SWITCH_US 500 //reconfiguring the modem and fielding the CAD interrupt between two hops
+#define DATA_RATE_PREAMBLE_MARGIN 8 //preamble symbols left for the receiver to lock on once its hop has found us
+
+struct DataRate {
+  uint8_t spreadingFactor;
+  long bandwidth;
+  float requiredSnr; //demodulation floor, SX1276 datasheet table 13
+};
+
+struct PeerLink {
+  float snr; //average SNR of frames heard from the peer, scaled to a 125kHz bandwidth
+  int16_t rssi; //RSSI of the last frame heard from the peer
+  uint8_t samples;
+  uint32_t lastHeard;
+  uint8_t rxRate; //rate we asked the peer to send to us at
+  uint8_t txRate; //rate the peer asked us to send at
+  uint32_t txRateTime;
+  uint8_t txScanMask; //rates the peer listens on, sizes our preamble
+  uint32_t txScanMaskTime;
+  uint8_t failures; //resends since the peer last ACKed anything
+};
+
+extern const DataRate dataRates[DATA_RATE_COUNT];
+//bit n set means we are listening on dataRates[n]. Written by loop(), read by the radio task
+extern volatile uint8_t dataRateListenMask;
+
+void dataRateInit();
+//called for every frame that decrypts, rate is the one it was received on
+void dataRateRecordFrame(uint8_t peer, float snr, int16_t rssi, uint8_t rate);
+//peer told us which rates it listens on. Only ACKs meant for us carry it this far, overheard ones are dropped before
+//they are decrypted
+void dataRateRecordListenMask(uint8_t peer, uint8_t scanMask);
+//peer ACKed something of ours and told us which rate it wants and which rates it listens on
+void dataRateRecordRequest(uint8_t peer, uint8_t rate, uint8_t scanMask);
+//a frame to peer had to be sent again
+void dataRateRecordFailure(uint8_t peer);
+//true if a frame from peer has been heard in the last DATA_RATE_PEER_TIMEOUT_MS
+bool dataRatePeerHeard(uint8_t peer);
+//drops peers that have gone quiet and recomputes the listen mask. Returns true if the mask changed
+bool dataRateRefresh();
+
+uint8_t dataRateRequestFor(uint8_t peer);
+uint8_t dataRateFor(uint8_t peer);
+uint16_t dataRatePreambleFor(uint8_t peer, uint8_t rate);
+uint32_t dataRateSymbolTimeUs(uint8_t rate);
+//time to hop CAD once across every rate in mask
+uint32_t dataRateScanCycleUs(uint8_t mask);
+
+#endif
@@ -20,6 +20,18 @@
 
 void enterChannelActivityDetectionMode();
 void enterReceiveMode();
+uint32_t ackArrivalTime(uint32_t entry);
+bool replyWindowOpen(uint32_t requestTime);
+bool ackDueAlone();
+bool ackRidesOnData();
+bool containerAdd(uint8_t* container, uint16_t* size, const uint8_t* frame);
+uint8_t aggregateMessages(uint8_t* container, uint16_t* size, uint8_t destination);
+uint8_t aggregateAcks(uint8_t* container, uint16_t* size, uint8_t destination);
+uint8_t nextTxClass();
+uint8_t nextFrameRate();
+uint8_t nextFrameChannel();
+void transmitFrame(const uint8_t* data, uint16_t size, uint8_t destination, uint8_t replyLength = 0);
+void transmitReply(const uint8_t* data, uint16_t size, uint8_t destination, uint8_t rate, uint8_t channel);
 void onCadDone(bool detectedSignal);
 void onTxDone();
 void onReceive(int size);
@@ -6,6 +6,12 @@
 //api functions
 #include "apiCode.h"
 #include "security_protocol.h"
+#include "radioTask.h"
+#include "RxPacketRing.h"
+#include "ReassemblyTable.h"
+#include "replayWindow.h"
+#include "TimerWheel.h"
+#include "retransmit.h"
 
 extern Preferences storage;
 
@@ -15,6 +21,11 @@ bool deviceIDDataChanged = false;
 
 uint8_t lastDeviceMode = IDLE_MODE;
 uint32_t nextCADTime = 0;
+uint8_t cadBackoffExponent = 0; //busy CADs in a row, sizes the backoff window
+bool replyExpected = false; //the frame being transmitted asked for an ACK in the reply window
+uint8_t replyRate = DATA_RATE_DEFAULT;
+bool awaitingReply = false; //the radio task is listening for that ACK, so don't pull it into CAD
+uint32_t awaitingReplyUntil = 0;
 //Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RST);
 
 //uint32_t epochAtBoot = 0; //TODO this should be set and required to be set at boot
@@ -22,37 +33,73 @@ uint32_t nextCADTime = 0;
 //Variables for Device ID resolution and maintenance
 bool sendDeviceIDResponse = false;
 uint32_t lastDeviceIDResponseTime = 0;
-uint8_t deviceIDResponseBuffer[10+AES_GCM_OVERHEAD];
+uint8_t deviceIDResponseBuffer[DEVICE_ID_FRAME_SIZE];
 bool sendDeviceIDTableResponse = false;
 uint32_t lastDeviceIDTableResponseTime = 0;
-uint8_t deviceIDTableResponseBuffer[41+AES_GCM_OVERHEAD];
+uint8_t deviceIDTableResponseBuffer[DEVICE_ID_TABLE_FRAME_SIZE];
 bool sendDeviceIDRequest = false;
 uint32_t lastDeviceIDRequest = 0;
-uint8_t deviceIDRequestBuffer[10+AES_GCM_OVERHEAD];
+uint8_t deviceIDRequestBuffer[DEVICE_ID_FRAME_SIZE];
 bool sendDeviceIDTableRequest = false;
 uint32_t lastDeviceIDTableRequestTime = 0;
-uint8_t deviceIDTableRequestBuffer[10+AES_GCM_OVERHEAD];
+uint8_t deviceIDTableRequestBuffer[DEVICE_ID_FRAME_SIZE];
 
 
 //State tracking variables
-bool receiveReady = false;
-bool messageDispatched = false;
-bool ackDispatched = false;
+uint8_t messagesDispatched = 0; //frames taken from the front of readyToSendBuffer by the last transmit
+uint8_t acksDispatched = 0; //same for ackToSendBuffer
 bool enableLora = false;
-CyclicArrayList<uint16_t, 128> previouslySeenIds;
-CyclicArrayList<uint16_t, 128> previouslyProcessedIds;
 
 //LoRa RX Related Variables
-CyclicArrayList<uint8_t, LORA_RX_BUFFER_SIZE> rxBuffer; //buffer used to store raw data received from LoRa. This is then processed later
-uint16_t rxBufferLastSize = 0;
-SimpleArraySet<256, 11> rxMessageArray; //used to store information about successfully processed received messages
-DefraggingBuffer<2048, 8> rxMessageBuffer; //used to combine received segmented messages into the final full message
+RxPacketRing<LORA_RX_QUEUE_LENGTH> rxPackets; //packets received from LoRa, waiting to be parsed
+uint8_t rxContainer[CONTAINER_MESSAGE_MAX]; //message of the container frame being unpacked, one frame per pass
+uint16_t rxContainerSize = 0;
+uint16_t rxContainerOffset = 0; //next frame in rxContainer
+const RxPacket* rxContainerPacket; //packet the container came in. rxPackets is left alone until it is unpacked, so it stays valid
+ReassemblyTable<RX_REASSEMBLY_TABLE_SIZE> rxMessageArray; //messages being reassembled from their fragments
+TimerWheel<TIMER_WHEEL_SLOTS, RX_REASSEMBLY_TABLE_SIZE, TIMER_WHEEL_TICK_SHIFT> rxTimers; //reassembly expiry, keyed by (sender << 16) | message number. Only touched by loop()
+DefraggingBuffer<RX_MESSAGE_BUFFER_SIZE, 8> rxMessageBuffer; //used to combine received segmented messages into the final full message
 
 //LoRa TX Related Variables
-SimpleArraySet<256, 9> txMessageArray; //buffer used to store information about individual packets that should be dispatched
-DefraggingBuffer<2048, 8> txMessageBuffer; //used to store the raw data that should be dispatched
-CyclicArrayList<uint8_t, LORA_READY_TO_SEND_BUFFER_SIZE> readyToSendBuffer; //Queue for LoRa device. This just contains a length and an address into the txMessageBuffer
-CyclicArrayList<uint8_t, LORA_ACK_BUFFER_SIZE> ackToSendBuffer; //Queue for Acks for the LoRa device. This contains raw ACK messages since they are relatively small
+struct TxFragment {
+  bool used;
+  uint16_t messageNumber;
+  uint8_t sequenceNumber;
+  uint8_t destination;
+  uint16_t location; //allocation in txMessageBuffer holding the frame
+  uint8_t size; //frame size
+  uint8_t sendCount;
+  uint32_t queuedAt; //millis() of the last time it was handed to the radio, for RTT samples
+  uint32_t heardAt; //millis() of the first send or the last ACK for its message, it is given up on RETRANSMIT_GIVE_UP_MS later
+  uint16_t timer; //resend timer in txTimers, TIMER_NONE until the fragment's turn to be sent comes
+  uint8_t pendingPeers[32]; //broadcasts only: peers that still have to ACK it, bit n % 8 of byte n / 8 for device n
+  bool queued; //in readyToSendBuffer and not sent yet. The slot and its allocation are kept until it has been, used or not
+};
+TxFragment txFragments[TX_FRAGMENT_SLOTS]; //fragments waiting to be sent or ACKed. Slots don't move, so timers can point at them
+TimerWheel<TIMER_WHEEL_SLOTS, TX_FRAGMENT_SLOTS, TIMER_WHEEL_TICK_SHIFT> txTimers; //resend timers, keyed by slot in txFragments
+struct GroupAck {
+  bool used;
+  uint8_t sender;
+  uint16_t messageNumber;
+  uint8_t sequenceNumber; //last fragment heard, the ACK answers it
+  uint8_t rate; //link details of that fragment, passed on to sendAck
+  uint8_t channel;
+  uint32_t rxTime;
+  float snr;
+  int16_t rssi;
+  uint16_t timer;
+};
+GroupAck groupAcks[GROUP_ACK_QUEUE_LENGTH]; //broadcast messages we owe their sender an ACK for
+TimerWheel<TIMER_WHEEL_SLOTS, GROUP_ACK_QUEUE_LENGTH, TIMER_WHEEL_TICK_SHIFT> groupAckTimers; //keyed by slot in groupAcks. Only touched by loop()
+DefraggingBuffer<TX_MESSAGE_BUFFER_SIZE, TX_MESSAGE_BUFFER_ALLOCATIONS> txMessageBuffer; //used to store the raw data that should be dispatched
+CyclicArrayList<uint8_t, LORA_READY_TO_SEND_BUFFER_SIZE> readyToSendBuffer; //Queue for LoRa device. This just contains an address into the txMessageBuffer, a length, the destination ID and when it was queued
+uint32_t txDispatched[4]; //frames sent by each TX_CLASS
+uint32_t txLateAcks; //ACKs that went out after the peer's resend timer had likely already fired
+uint32_t txAggregated; //frames that went out in a container frame along with others instead of on their own
+uint32_t lastReplyTime; //arrival time (millis()) of the packet the last reply was sent for
+bool replySent = false;
+uint32_t lastControlDispatchTime = 0;
+CyclicArrayList<uint8_t, LORA_ACK_BUFFER_SIZE> ackToSendBuffer; //Queue for Acks for the LoRa device. This contains a small header (see ACK_QUEUE_HEADER_SIZE) followed by the raw ACK message since they are relatively small
 
 //Serial TX Related Variables
 //TODO for sake of performance, this should probably be a CyclicArrayList
@@ -76,45 +123,33 @@ void setup() {
   blinky1();
 
   //initialize variables
-  rxBuffer = CyclicArrayList<uint8_t, LORA_RX_BUFFER_SIZE>();
-  rxMessageArray = SimpleArraySet<256, 11>();
-  rxMessageBuffer = DefraggingBuffer<2048, 8>();
+  rxPackets.clearBuffer();
+  rxMessageBuffer = DefraggingBuffer<RX_MESSAGE_BUFFER_SIZE, 8>();
   rxMessageBuffer.init();
-  txMessageArray = SimpleArraySet<256, 9>();
-  txMessageBuffer = DefraggingBuffer<2048, 8>();
+  memset(txFragments, 0, sizeof(txFragments));
+  txTimers.init(millis());
+  rxTimers.init(millis());
+  memset(groupAcks, 0, sizeof(groupAcks));
+  groupAckTimers.init(millis());
+  txMessageBuffer = DefraggingBuffer<TX_MESSAGE_BUFFER_SIZE, TX_MESSAGE_BUFFER_ALLOCATIONS>();
   txMessageBuffer.init();
   readyToSendBuffer = CyclicArrayList<uint8_t, LORA_READY_TO_SEND_BUFFER_SIZE>();
   ackToSendBuffer = CyclicArrayList<uint8_t, LORA_ACK_BUFFER_SIZE>();
   serialReadyToSendArray = SimpleArraySet<SERIAL_READY_TO_SEND_BUFFER_SIZE, 5>();
-  previouslySeenIds = CyclicArrayList<uint16_t, 128>();
-  previouslyProcessedIds = CyclicArrayList<uint16_t, 128>();
+  replayWindowInit();
 
   if (!storage.begin("LoComm", 0)) {
     LError("Failed to start storage instance!");
     HALT();
   }
-
-  //preload address resolution buffers with data that doesnt change
-  deviceIDRequestBuffer[0] = START_BYTE;
-  deviceIDRequestBuffer[1] = 2;
-  deviceIDRequestBuffer[9 + AES_GCM_OVERHEAD] = END_BYTE;
-  
-  deviceIDResponseBuffer[0] = START_BYTE;
-  deviceIDResponseBuffer[1] = 3;
-  deviceIDResponseBuffer[9 + AES_GCM_OVERHEAD] = END_BYTE;
-
-  deviceIDTableRequestBuffer[0] = START_BYTE;
-  deviceIDTableRequestBuffer[1] = 4;
-  deviceIDTableRequestBuffer[9 + AES_GCM_OVERHEAD] = END_BYTE;
-
-  deviceIDTableResponseBuffer[0] = START_BYTE;
-  deviceIDTableResponseBuffer[1] = 5;
-  deviceIDTableResponseBuffer[40 + AES_GCM_OVERHEAD] = END_BYTE;
+  messageNumberInit();
 
 
   //Initialize Serial Connection to Computer
+  Serial.setRxBufferSize(MAX_COMPUTER_PACKET_SIZE); //SEND packets are read in one go once they are all there
   Serial.begin(115200);
   Serial1.setPins(26, 25);
+  Serial1.setTxBufferSize(LOG_TX_BUFFER_SIZE); //log bursts are buffered instead of holding loop() up
   Serial1.begin(115200); //TODO set pins for serial1
 
   while (!Serial);
@@ -142,10 +177,15 @@ void setup() {
     while (1);
   }
 
-  //Register Callbacks
-  LoRa.onTxDone(onTxDone);
-  LoRa.onCadDone(onCadDone);
-  LoRa.onReceive(onReceive);
+  //every peer starts out at the default rate until we hear from it
+  dataRateInit();
+  //and at full power until it reports back how well it hears us
+  txPowerInit();
+  //and with the default resend timeout until it has ACKed something
+  retransmitInit();
+
+  //Start the radio task. It registers the LoRa callbacks and owns the SPI bus from here on
+  radioTaskInit();
 
   //Set idle mode
   Debug(Serial1.println("Setup Finished"));
@@ -163,7 +203,7 @@ void setup() {
   Serial.println("Booting");
   Serial.flush();
   
-  xTaskCreateStaticPinnedToCore(
+  apiTaskHandle = xTaskCreateStaticPinnedToCore(
     apiCode,
     "APICODE",
     API_CODE_STACK_SIZE,
@@ -180,7 +220,7 @@ void setup() {
 
 void loop() {
   static uint8_t tempDeviceMode = 255; //debug variable used to print changes in device mode
-  static bool shouldScanRxBuffer = false; //flag that gets set when the rxBuffer should be scanned through (ie. when data is added)
+  static bool shouldScanRxBuffer = false; //flag that gets set when rxPackets could have a frame left to parse (ie. when a packet is added)
 
   //Debug: If a device mode change was detected log it to serial if we are in debug mode
   if (lastDeviceMode != tempDeviceMode) {
@@ -189,8 +229,7 @@ void loop() {
   }
 
   //----------------------------------------------------- MISC State Behavior -------------------------------------------------
-  if (lastDeviceMode == CAD_FAILED) { //if CAD detected a signal, then just go back to RX mode until CAD is ready to try again
-    LoRa.receive();
+  if (lastDeviceMode == CAD_FAILED) { //if CAD detected a signal, the radio task has already put the LoRa back in RX mode until CAD is ready to try again
     lastDeviceMode = RX_MODE;
     LError("CAD detected a signal! trying again later");
   }
@@ -206,6 +245,15 @@ void loop() {
     Debug(Serial1.printf("initializedDeviceRouting: %d\n", initializedDeviceRouting));
     Debug(Serial1.printf("startedDeviceIDAcquire: %d\n", startedDeviceIDAcquire));
     Debug(Serial1.printf("receivedDeviceIDTable: %d\n", receivedDeviceIDTable));
+    Debug(Serial1.printf("SPI transactions: %lu total, %lu last TX packet, %lu last RX packet\n", LoRa.spiTransactionCount(), LoRa.lastTxPacketSpiTransactions(), LoRa.lastRxPacketSpiTransactions()));
+    Debug(Serial1.printf("Dropped radio events: %lu\n", radioDroppedEvents));
+    Debug(Serial1.printf("Received bytes outside valid frames: %lu, CRC failures: %lu\n", rxPackets.droppedBytes, rxPackets.crcFailures));
+    Debug(Serial1.printf("Listening on data rates: 0x%02x\n", dataRateListenMask));
+    Debug(Serial1.printf("Home channel: %d\n", channelHome));
+    Debug(Serial1.printf("TX queues: %lu ACKs, %lu data frames, %d control frames. Sent %lu ACKs (%lu late), %lu data, %lu control, %lu more aggregated\n",
+                         ackToSendBuffer.size() / (ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE), readyToSendBuffer.size() / READY_TO_SEND_ENTRY_SIZE,
+                         sendDeviceIDRequest + sendDeviceIDResponse + sendDeviceIDTableRequest + sendDeviceIDTableResponse,
+                         txDispatched[TX_CLASS_ACK], txLateAcks, txDispatched[TX_CLASS_DATA], txDispatched[TX_CLASS_CONTROL], txAggregated));
     printTimeCount++;
     if (printTimeCount > 6) {
       printTimeCount = 0;
@@ -225,31 +273,35 @@ void loop() {
     switch (lastLoraEnableStatus) {
       case true: //actually false since we are checking the previous state
         LDebug("Lora has been disabled, putting into sleep mode");
-        LoRa.sleep();
+        radioPostCommand(RADIO_COMMAND_SLEEP);
         lastDeviceMode = SLEEP_MODE;
-        receiveReady = false;
         shouldScanRxBuffer = false;
         {
           ScopeLock(loraRxSpinLock, loraRxLock);
           rxMessageArray.clearAll();
           rxMessageBuffer.clear();
+          rxTimers.clearAll(millis());
         }
+        memset(groupAcks, 0, sizeof(groupAcks));
+        groupAckTimers.clearAll(millis());
         {
           ScopeLock(loraTxSpinLock, loraTxLock);
-          txMessageArray.clearAll();
+          memset(txFragments, 0, sizeof(txFragments));
+          txTimers.clearAll(millis());
           txMessageBuffer.clear();
         }
-        rxBuffer.clearBuffer();
+        rxPackets.clearBuffer();
+        rxContainerSize = 0;
         readyToSendBuffer.clearBuffer();
         ackToSendBuffer.clearBuffer();
-        previouslySeenIds.clearBuffer();
-        previouslyProcessedIds.clearBuffer();
+        replayWindowInit();
         serialReadyToSendArray.clearAll();
       break;
       case false: //actually true since we are checking the opposite case
         LDebug("Lora has been enabled");
-        rxBuffer.clearBuffer();
-        LoRa.receive();
+        rxPackets.clearBuffer();
+        rxContainerSize = 0;
+        radioPostCommand(RADIO_COMMAND_RECEIVE);
         lastDeviceMode = RX_MODE;
     }
     lastLoraEnableStatus = enableLora;
@@ -276,6 +328,8 @@ void loop() {
       LDebug("Logged in and paired! initializing device routing variables");
       initializedDeviceRouting = true;
       initializeDeviceRouting();
+      //the hop sequence comes from the D2D key, so it can only be worked out now
+      channelPlanInit();
     }
 
     //If the deviceIDchanged flag is set, then the table has changed, or the device ID has changed. Either way, trigger a full rewrite to EEPROM
@@ -319,6 +373,7 @@ void loop() {
     if (initializedDeviceRouting) {
       LDebug("User is logged in but is not paired, clearing local routing data");
       resetDeviceRouting();
+      channelPlanReset();
       initializedDeviceRouting = false;
     }
   } else {
@@ -326,6 +381,7 @@ void loop() {
     //we are not logged in anymore, so just clear the local variabes, dont need to worry about deleting the eeprom
     deviceID = 255;
     initializedDeviceRouting = false;
+    channelPlanReset();
   }
    
 
@@ -333,647 +389,657 @@ void loop() {
   
   
 
-  //------------------------------------------------------RX Interrupt flag handling ------------------------------------------------
-  if (receiveReady) { //receiveReady indicates the LoRa has read data, and data is now available. This flag gets set by the RX interrupt
-    LDebug("Handling receive flag");
-    int size = LoRa.available();
-    receiveReady = false;
-    
-    //Dump the data into a temporary buffer
-    uint8_t tempBuf[256];
-    LoRa.readBytes(tempBuf, min(256, size));
-
-    //If there is still data in the buffer, then something isn't right
-    //because the max LoRa message size is 256 bytes
-    if (LoRa.available()) {
-      LError("Received more than 256 bytes in LoRa buffer, which was unexpected!");
-      HALT();
+  //------------------------------------------------------ Radio event handling ------------------------------------------------
+  //The radio task has already pulled received packets out of the LoRa FIFO, so all that is left is to hand them to the protocol code
+  static RadioEvent radioEvent;
+  while (radioGetEvent(&radioEvent)) {
+    switch (radioEvent.type) {
+      case RADIO_EVENT_RX:
+        LDebug("Handling received packet");
+        if (lastDeviceMode == SLEEP_MODE) break;
+        awaitingReply = false; //the radio task closes the reply window on any packet
+
+        //try to add the packet to rxPackets for later processing. Its link quality goes with it, for whoever sent it
+        if (rxPackets.pushBack(&radioEvent)) {
+          LDebug("Added packet to LoRa rx queue");
+          Debug(Serial1.printf("First Byte of Data: %d\n", radioEvent.data[0]));
+          Debug(Serial1.printf("Second Byte of Data: %d\n", radioEvent.data[1]));
+          //Data was successfully added, so set the shouldScanRxBuffer condition
+          shouldScanRxBuffer = true;
+        } else {
+          LWarn("Rx queue is currently full, dropping packet");
+        }
+        //NOTE - the LoRa stays in continuous RX mode after a receive, so no mode change is necessary
+        break;
+      case RADIO_EVENT_TX_DONE:
+        //the radio task has already put the LoRa back into receive mode, or into the reply window if we asked for one
+        if (lastDeviceMode == TX_MODE) lastDeviceMode = RX_MODE;
+        if (replyExpected) {
+          replyExpected = false;
+          awaitingReply = true;
+          awaitingReplyUntil = radioEvent.timestamp + radioReplyWindowMs(replyRate);
+        }
+        break;
+      case RADIO_EVENT_CAD_DONE:
+        if (lastDeviceMode != CAD_MODE) break; //stale result, we've already moved on
+        if (radioEvent.cadDetected) {
+          //randomised exponential backoff, so nodes that found the channel busy together don't all retry together
+          if (cadBackoffExponent < CAD_BACKOFF_MAX_EXPONENT) cadBackoffExponent++;
+          nextCADTime = millis() + CAD_BACKOFF_SLOT_MS * (1 + esp_random() % (1 << cadBackoffExponent));
+          lastDeviceMode = CAD_FAILED;
+        } else {
+          cadBackoffExponent = 0;
+          lastDeviceMode = CAD_FINISHED;
+        }
+        break;
     }
+  }
 
-    //try to add data the received data to our rxBuffer for later processing
-    if (rxBuffer.pushBack(tempBuf, size)) {
-      LDebug("Added data to LoRa rx buffer");
-      Debug(Serial1.printf("First Byte of Data: %d\n", tempBuf[0]));
-      Debug(Serial1.printf("Second Byte of Data: %d\n", tempBuf[1]));
-      //Data was successfully added, so set the shouldScanRxBuffer condition
-      shouldScanRxBuffer = true;
-    } else {
-      LWarn("Rx Buffer is currently full, not adding data");
+  //listen on whatever rates our peers have been asked to use, and stop listening for peers that have gone quiet.
+  //Our home channel moves with the hop sequence, so it gets the same treatment
+  static uint32_t lastDataRateRefresh = millis();
+  if (millis() - lastDataRateRefresh > 1000) {
+    lastDataRateRefresh = millis();
+    const bool ratesChanged = dataRateRefresh();
+    const bool channelChanged = channelPlanRefresh(deviceID);
+    if ((ratesChanged || channelChanged) && lastDeviceMode == RX_MODE) {
+      radioPostCommand(RADIO_COMMAND_RECEIVE);
     }
-
-    //NOTE - After the rx is completed, what mode is the lora in? We assume it remains in RX mode for now, so no mode change is necessary
   }
 
   // -------------------------------------------------- Receive Loop Behavior ---------------------------------------------
-  if (shouldScanRxBuffer) { //this gets set to true when data gets added to rxBuffer, or if theres still potentially a message in rxBuffer after a scan
-    //First, we will scan for start bytes. If we find any, we will then scan from the start byte to j in range(rxBufferLastSize, actual buffer size)
-    //If we find a valid message, we will clear any data from the buffer before the valid message.
-    /*PseudoCode
-      for each start byte:
-        if there is a valid message with the end byte in (rxBufferLastSize, actual buffer size)
-          process messages
-          clear all data in the buffer up to the end of the message
-          update rxBufferLastSize to the end of the messages
-        if no valid message is found and we've scanned 256 bytes, then clear everything up to and including the start byte
-      if no message was ever found, then update rxBufferLastSizeto the end of the data
-    
-
-    */
+  if (shouldScanRxBuffer) { //this gets set to true when a packet gets added to rxPackets, or if theres still potentially a frame in it after a parse
     shouldScanRxBuffer = false;
-    bool messageFound = false;
-    for (int startByteLocation = 0; startByteLocation < rxBuffer.size(); startByteLocation++) {
+    const uint8_t* frame;
+    const RxPacket* packet;
+    //the frames of a container are taken out of it before going on to the next frame in rxPackets. They come as messages,
+    //already authenticated and decrypted with the container
+    const uint8_t* containerMessage = NULL;
+    uint8_t containerMessageLen = 0;
+    uint16_t frameSize = 0;
+    if (rxContainerOffset + CONTAINER_ENTRY_HEADER_SIZE <= rxContainerSize) {
+      packet = rxContainerPacket;
+      containerMessage = &(rxContainer[rxContainerOffset + CONTAINER_ENTRY_HEADER_SIZE]);
+      containerMessageLen = rxContainer[rxContainerOffset + 1];
+      rxContainerOffset += CONTAINER_ENTRY_HEADER_SIZE + containerMessageLen;
+    } else {
+      rxContainerSize = 0;
+      frameSize = rxPackets.nextFrame(&frame, &packet);
+    }
+    //breaking or continuing out of this block drops the frame
+    if (frameSize > 0 || containerMessage != NULL) do {
+      shouldScanRxBuffer = true; //there could be another frame behind this one, go look again
+      LDebug("Found frame in rx queue");
+
+      //check if that packet type is invalid. Containers don't go inside containers
+      const uint8_t packetType = containerMessage != NULL ? containerMessage[-CONTAINER_ENTRY_HEADER_SIZE] : frame[1];
+      if (packetType > 5 && (packetType != FRAME_TYPE_CONTAINER || containerMessage != NULL)) {
+        LDebug("Received RX message does not have proper type byte, skipping");
+        continue;
+      }
+      if (containerMessage != NULL && rxContainerOffset > rxContainerSize) {
+        LDebug("Frame runs past the end of its container, skipping");
+        continue;
+      }
+
+      //data and ACK frames carry their routing header in clear, so frames for other nodes and fragments we already have
+      //can be dropped before any crypto runs. Nothing in it is trusted beyond that until the frame authenticates
+      bool broadcast = false; //used to indicate if a data message is intended for broadcast, so no ack should be sent out
+      if (frameRoutingSize(packetType) > 0) {
+        if (containerMessage != NULL ? containerMessageLen < ROUTING_HEADER_SIZE : frame[2] < ROUTING_HEADER_SIZE + AES_GCM_OVERHEAD) {
+          LDebug("Received RX message is too short for its routing header, skipping");
+          continue;
+        }
+        const uint8_t* routing = containerMessage != NULL ? containerMessage : &(frame[FRAME_HEADER_SIZE]);
+        const uint16_t messageNumber = (routing[2] << 8) + routing[3];
+        broadcast = (packetType == 0 || packetType == FRAME_TYPE_CONTAINER) && routing[1] == 255;
+        if (routing[1] != deviceID && !broadcast) {
+          LDebug("Received RX message is not intended for sender, skipping");
+          continue;
+        }
+
+        if (packetType == 0 && routing[4] < SEQUENCE_MAX_COUNT) {
+          uint32_t received;
+          {
+            ScopeLock(loraRxSpinLock, loraRxLock);
+            received = rxReceivedFragments(routing[0], messageNumber);
+          }
+          //a copy of a fragment of a message still being put back together goes on to be authenticated, since that is
+          //what keeps the message from expiring while the sender is still working on it
+          if (received == ACK_ALL_FRAGMENTS) {
+            //the sender didn't hear our ACK, so send it again. It only ever says we have fragments we do have
+            LDebug("Message sequence was already received, acking again without decrypting");
+            if (broadcast) scheduleGroupAck(routing[0], messageNumber, routing[4], packet);
+            else sendAck(routing[0], messageNumber, routing[4], received, packet->dataRate, packet->channel, packet->timestamp, packet->snr, packet->rssi);
+            continue;
+          }
+        }
+      }
+
+      //Since CRC passed, its time to decrypt the message, so lets decrypt it into a temp buffer
+      uint8_t tempBuf[256];
+      size_t plaintextLen;
+      if (containerMessage != NULL) {
+        memcpy(&(tempBuf[0]), containerMessage, containerMessageLen);
+        plaintextLen = containerMessageLen;
+      } else if (!openFrame(frame, &(tempBuf[0]), 256, &plaintextLen)) {
+        LDebug("Decryption Failed, assuming message has been tampered with since CRC still passed");
+        //TODO tamper detection OR different key detection
+        continue;
+      }
+
+      //a container's frames are handled one per pass from here on, its own routing header has done its job
+      if (packetType == FRAME_TYPE_CONTAINER) {
+        if (plaintextLen > CONTAINER_MESSAGE_MAX) {
+          LDebug("Container frame is too big, skipping");
+          continue;
+        }
+        LDebug("Unpacking container frame");
+        memcpy(&(rxContainer[0]), &(tempBuf[0]), plaintextLen);
+        rxContainerSize = plaintextLen;
+        rxContainerOffset = ROUTING_HEADER_SIZE;
+        rxContainerPacket = packet;
+        continue;
+      }
+
+      //Now, the message should be fully contained in tempBuf with length plainTextLen, routing header included. That
+      //excludes the framing, the message type and the encryption overhead
+      //everything but the table messages starts with the sender ID
+      if (packetType <= 3) {
+        dataRateRecordFrame(tempBuf[0], packet->snr, packet->rssi, packet->dataRate);
+      }
+
+      //Check if we should filter out the message based on message type and potential receiver field. Data and ACK
+      //messages were already filtered on their routing header
+      bool breakout = false;
+      switch (packetType) {
+        case 0:
+        case 1:
+          break;
+        case 2: //device ID scan is a broadcast message, so no receiver field is present
+          break;
+        case 3: //device ID scan response is also a broadcast message, so no receiver field is present
+          break;
+        case 4: //device ID full table request DOES have a receiver field, so filter on it
+          if (tempBuf[0] != deviceID) {
+            LDebug("Received Device ID Table request is not intended for sender, skipping");
+            breakout = true;
+          }
+        case 5: //device ID full table response is also a broadcast message, so no receiver field is present
+          break;
+      }
+      if (breakout) break;
+
+      //check if the message was intended to be sent in the last 20 seconds based on the timestamp
+      //Since timestamp is dependant on message type, use a switch statement to acquire it
+      uint32_t timestamp = 0; //every type that gets this far sets it
+      switch (packetType) {
+        case 0:
+          //data packet
+          timestamp = (tempBuf[6] << 24) + (tempBuf[7] << 16) + (tempBuf[8] << 8) + tempBuf[9];
+        break;
+        case 1:
+          //ack packet
+          timestamp = (tempBuf[5] << 24) + (tempBuf[6] << 16) + (tempBuf[7] << 8) + tempBuf[8];
+        break;
+        case 2: //device id request packet
+        case 3: //device id response packet
+        case 4: //device id table request packet
+          timestamp = (tempBuf[1] << 24) + (tempBuf[2] << 16) + (tempBuf[3] << 8) + tempBuf[4];
+        break;
+        case 5: //device id table response packet
+          timestamp = (tempBuf[0] << 24) + (tempBuf[1] << 16) + (tempBuf[2] << 8) + tempBuf[3];
+        break;
+      }
+      const uint32_t currentTime = (millis() / 1000) + epochAtBoot;
+      if (currentTime + 5 < timestamp) { //5 is added for a bit of leeway
+        LWarn("Received RX Message is from the future! someone likely has invalid time configuration");
+        break; 
+      }
+      if (currentTime > timestamp && currentTime - timestamp > 60) {
+        LWarn("received RX Message is very old, possible replay attack attempt");
+        Debug(Serial1.printf("current time: %ld\ntime indicated by message: %ld\n", (millis() / 1000) + epochAtBoot, timestamp));
+        //TODO logic to log replay attack attempt
+        break; 
+      }
       
-      if (rxBuffer[startByteLocation] == START_BYTE) {
-        //start byte found, scan from rxBufferLastSize to rxBuffer.size() for the end byte
-        if (rxBufferLastSize > rxBuffer.size()) {
-          LDebug("RXBufferLastSize was not properly updated, and it is now larger than rxBuffer!");
-          HALT();
+      //Now that checks have passed, we can attempt to process the message. First, lets see what type of message it is
+
+
+      if (packetType == 0) {
+        ScopeLock(loraRxSpinLock, loraRxLock);
+        LDebug("Beginning Normal Message Processing");
+        //Normal message
+        const uint8_t sequenceCount = tempBuf[5];
+        const uint8_t sequenceSize = plaintextLen - 10; //subtracting header size
+        const uint16_t messageNumber = (tempBuf[2] << 8) + tempBuf[3]; 
+        const uint8_t sequenceNumber = tempBuf[4]; 
+        if (sequenceCount > SEQUENCE_MAX_COUNT || sequenceNumber >= sequenceCount) {
+          LError("Invalid sequence number! dropping");
+          break;
+        }
+        //every fragment but the last carries SEQUENCE_MAX_SIZE bytes, the last one at most that. Checked before the
+        //message is taken, so a bad first fragment can't set the size the rest of the message is held to
+        if (sequenceSize > SEQUENCE_MAX_SIZE || (sequenceNumber != sequenceCount - 1 && sequenceSize != SEQUENCE_MAX_SIZE)) {
+          LWarn("Fragment size doesn't match its place in the message! dropping");
+          continue;
         }
-        for (int endByteLocation = max(startByteLocation+1, (int) (rxBufferLastSize - 1)); endByteLocation < min((int) (startByteLocation + 256), (int) rxBuffer.size()); endByteLocation++) {
-          if (rxBuffer[endByteLocation] == END_BYTE) {
-            const uint8_t messageSize = endByteLocation - startByteLocation + 1;
-            if (messageSize < 8 + AES_GCM_OVERHEAD) continue;
-            LDebug("Found End Byte in rxBuffer");
-            LDebug("Message Identified...");
-            //Debug(dumpArrayToSerial(&(rxBuffer[0]), i+1));
-
-            //First, Calculate the CRC and check if its correct 
-            uint32_t crc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(rxBuffer[startByteLocation+1])), messageSize - 4))^0xffffffff;
-            uint16_t msgCrc = (rxBuffer[endByteLocation-2] << 8) + rxBuffer[endByteLocation-1]; 
-            if ((crc & 0xFFFF) != msgCrc) {
-              LDebug("Received RX message does not have matching CRC, skipping");
-              continue;
-            } 
 
-            //check if that packet type is invalid
-            const uint8_t packetType = rxBuffer[startByteLocation+1];
-            if (packetType > 5) {
-              LDebug("Received RX message does not have proper type byte, skipping");
+        //Add the sender ID to our list of known device IDs
+        addDeviceIDToTable(tempBuf[0]);
+        
+
+        //check if the message is already being reassembled
+        RxReassembly* entry = rxMessageArray.find(tempBuf[0], messageNumber);
+        if (entry != NULL) { //if the message is already in the rx message array
+          LDebug("Message is already in RX Message Array");
+          //check if this sequence is needed still
+          if (entry->hasFragment(sequenceNumber)) { //if this sequence's bit has already been set...
+            //message already received, so no need to reprocess. The sender is still at it though, so keep the message
+            LDebug("Message sequence was already received, ignoring");
+            entry->timer = rxTimers.reschedule(entry->timer, millis() + RX_REASSEMBLY_TIMEOUT_MS);
+          } else {
+            LDebug("Storing sequence in buffer");
+            //message not received yet, so mark it in the bitmask and then add the data to the buffer allocation
+            if (sequenceCount != entry->sequenceCount) {
+              LWarn("Sequence count doesn't match the rest of the message! dropping");
               continue;
             }
-
-            //Since CRC passed, its time to decrypt the message, so lets decrypt it into a temp buffer
-            uint8_t tempBuf[256];
-            size_t plaintextLen;
-            if (!decryptD2DMessage(&(rxBuffer[startByteLocation+2]), messageSize-5, &(tempBuf[0]), 256, &plaintextLen)) {
-              LDebug("Decryption Failed, assuming message has been tampered with since CRC still passed");
-              //TODO tamper detection OR different key detection
+            if (sequenceSize > entry->sequenceSize) {
+              LWarn("Received packet with data size bigger than the rest of the message! dropping");
               continue;
             }
+            entry->markFragment(sequenceNumber);
+            memcpy(&(rxMessageBuffer[entry->bufferLocation + entry->sequenceSize * sequenceNumber]), &(tempBuf[10]), sequenceSize);
 
-            //Verify the plaintextLen is what is expected
-            if (plaintextLen != messageSize - 5 - AES_GCM_OVERHEAD) {
-              LError("Received plaintext message from rx is unexpected size!");
-              HALT();
-            }
+            //push the rx timeout back
+            entry->timer = rxTimers.reschedule(entry->timer, millis() + RX_REASSEMBLY_TIMEOUT_MS);
 
-            //Now, the message should be fully contained in tempBuf with length plainTextLen, which excludes the start/stop bytes, the message type, the encryption overhead, and the CRC
-            //since we got this far, we can reasonably assume the message is valid, so we can remove it from the buffer
-            messageFound = true;
-            rxBuffer.dropFront(endByteLocation+1);
-            rxBufferLastSize = 0;
-            shouldScanRxBuffer = true; //there could be another message to find, go look again
-
-            //Check if we should filter out the message based on message type and potential receiver field
-            bool broadcast = false; //used to indicate if a data message is intended for broadcast, so no ack should be sent out
-            bool breakout = false;
-            switch (packetType) {
-              case 0:
-                if (tempBuf[1] == 255) {
-                  broadcast = true;
-                } else if (tempBuf[1] != deviceID) {
-                  LDebug("Received RX Data message is not intended for sender, skipping");
-                  //log the message ID
-                  const uint16_t messageNumber = (tempBuf[2] << 8) + tempBuf[3]; 
-                  previouslySeenIds.pushBack(&messageNumber, 1);
-                  if (previouslySeenIds.size() >= 128) {
-                    previouslySeenIds.dropFront(1);
-                  }
-
-                  //log the deviceID of the sender
-                  addDeviceIDToTable(tempBuf[0]);
-                  breakout = true; //the message was intended for this device, so indicate we should break out
-                }
-                break;
-              case 1:
-                if (tempBuf[1] != deviceID) {
-                  LDebug("Received RX Ack message is not intended for sender, skipping");
-                  breakout = true;
-                }
-                break;
-              case 2: //device ID scan is a broadcast message, so no receiver field is present
-                break;
-              case 3: //device ID scan response is also a broadcast message, so no receiver field is present
-                break;
-              case 4: //device ID full table request DOES have a receiver field, so filter on it
-                if (tempBuf[0] != deviceID) {
-                  LDebug("Received Device ID Table request is not intended for sender, skipping");
-                  breakout = true;
-                }
-              case 5: //device ID full table response is also a broadcast message, so no receiver field is present
-                break;
-            }
-            if (breakout) break;
-
-            //check if the message was intended to be sent in the last 20 seconds based on the timestamp
-            //Since timestamp is dependant on message type, use a switch statement to acquire it
-            uint32_t timestamp;
-            switch (packetType) {
-              case 0:
-                //data packet
-                timestamp = (tempBuf[6] << 24) + (tempBuf[7] << 16) + (tempBuf[8] << 8) + tempBuf[9];
-              break;
-              case 1:
-                //ack packet
-                timestamp = (tempBuf[5] << 24) + (tempBuf[6] << 16) + (tempBuf[7] << 8) + tempBuf[8];
-              break;
-              case 2: //device id request packet
-              case 3: //device id response packet
-              case 4: //device id table request packet
-                timestamp = (tempBuf[1] << 24) + (tempBuf[2] << 16) + (tempBuf[3] << 8) + tempBuf[4];
-              break;
-              case 5: //device id table response packet
-                timestamp = (tempBuf[0] << 24) + (tempBuf[1] << 16) + (tempBuf[2] << 8) + tempBuf[3];
-              break;
-            }
-            const uint32_t currentTime = (millis() / 1000) + epochAtBoot;
-            if (currentTime + 5 < timestamp) { //5 is added for a bit of leeway
-              LWarn("Received RX Message is from the future! someone likely has invalid time configuration");
-              break; 
-            }
-            if (currentTime > timestamp && currentTime - timestamp > 60) {
-              LWarn("received RX Message is very old, possible replay attack attempt");
-              Debug(Serial1.printf("current time: %ld\ntime indicated by message: %ld\n", (millis() / 1000) + epochAtBoot, timestamp));
-              //TODO logic to log replay attack attempt
-              break; 
+            //If we are filling the final sequence packet, then change the message size to be accurate 
+            if (sequenceNumber == entry->sequenceCount-1) {
+              LDebug("Last sequence message received, updating total rx message buffer size");
+              entry->size = entry->sequenceSize * entry->sequenceCount - (entry->sequenceSize - sequenceSize);
             }
+
+            if (entry->complete()) dispatchCompletedMessage(entry);
             
-            //Now that checks have passed, we can attempt to process the message. First, lets see what type of message it is
-
-
-            if (packetType == 0) {
-              ScopeLock(loraRxSpinLock, loraRxLock);
-              LDebug("Beginning Normal Message Processing");
-              //Normal message
-              const uint8_t sequenceCount = tempBuf[5];
-              const uint8_t sequenceSize = plaintextLen - 10; //subtracting header size
-              const uint16_t messageNumber = (tempBuf[2] << 8) + tempBuf[3]; 
-              const uint8_t sequenceNumber = tempBuf[4]; 
-              if (sequenceNumber > 7) {
-                LError("Invalid sequence number! dropping");
-                break;
-              }
-
-              //Add the sender ID to our list of known device IDs
-              addDeviceIDToTable(tempBuf[1]);
-              
-
-              //check if the message number is already being tracked in rxMessageArray
-              uint16_t loc = rxMessageArray.find(messageNumber >> 8, messageNumber & 0xFF);
-              if (loc != 65535) { //if the message number is already in the rx message array
-                LDebug("Message is already in RX Message Array");
-                //message number was found in rxMessageArray already, check if this sequence is needed stil
-                const uint8_t sequenceBitmask = rxMessageArray.get(loc)[7];
-                if (sequenceBitmask & (1 << sequenceNumber)) { //if this sequence's bit has already been set...
-                  //message already received, so no need to reprocess
-                  LDebug("Message sequence was already received, ignoring");
-                } else {
-                  LDebug("Storing sequence in buffer");
-                  //message not received yet, so mark it in the bitmask and then add the data to the buffer allocation
-                  rxMessageArray.get(loc)[7] = sequenceBitmask | (1 << sequenceNumber);
-                  const uint16_t bufferStart = rxMessageArray.get(loc)[2] * 256 + rxMessageArray.get(loc)[3];
-                  const uint8_t sequenceBaseSize = rxMessageArray.get(loc)[8];
-                  const uint8_t sequenceCount = rxMessageArray.get(loc)[6];
-                  if (sequenceSize > sequenceBaseSize) {
-                    LError("Received packet with data size bigger than maximum sequence size!");
-                    HALT();
-                  }
-                  memcpy(&(rxMessageBuffer[bufferStart + sequenceBaseSize * sequenceNumber]), &(tempBuf[10]), sequenceSize);
-
-                  //update the rx timeout
-                  rxMessageArray.get(loc)[9] = (millis() / 1000) % 255;
-
-                  //If we are filling the final sequence packet, then change the message size to be accurate 
-                  if (sequenceNumber == sequenceCount-1) {
-                    LDebug("Last sequence message received, updating total rx message buffer size");
-                    uint16_t newBufferSize = sequenceBaseSize * sequenceCount - (sequenceBaseSize - sequenceSize);
-                    rxMessageArray.get(loc)[4] = newBufferSize >> 8;
-                    rxMessageArray.get(loc)[5] = newBufferSize & 0xFF;
-                  }
-                  
-                }
-              } else { //if the received message is not in the rx message array...
-                LDebug("Message is not in RX Message Array, adding...");
-                //message was not found, so we need to add it
-
-                
-                //Unfortunately, if the last packet is received first, its not possible to tell the total size of the data. 
-                //For now, we will just drop the packet and wait for an earlier sequence number packet to arrive first
-                //UNLESS its just a one packet message. Then we're good.
-                if (sequenceNumber != 0 && sequenceNumber == sequenceCount - 1) {
-                  LWarn("Last message of the sequence was received first! dropping");
-                  continue; //skip processing and hope an earlier packet number will be seen
-                }
-
-                //Check if the message ID is in the previouslyProcessedIds list. If it is, its possible we have already processed this message
-                if (previouslyProcessedIds.contains(messageNumber)) {
-                  LWarn("Received Message has a previously seen ID, ignoring");
-                  //since the ID was previously processed, its likely that the message was already received, but the ack failed
-                  //Thus, we will still send an ack just in case, but we will otherwise silently drop the message
-                  if (!broadcast) sendAck(tempBuf[0], messageNumber, sequenceNumber);
-                  continue;
-                }
-
-                //if it wasnt, then add it for future use
-                previouslyProcessedIds.pushBack(&messageNumber, 1);
-                if (previouslyProcessedIds.size() >= 128) {
-                  previouslyProcessedIds.dropFront(1);
-                }
-
-                const uint32_t totalSequenceSize = sequenceSize * sequenceCount;
-
-                //try to allocate space in the rx message buffer
-                const uint16_t bufferLocation = rxMessageBuffer.malloc(totalSequenceSize);
-                if (bufferLocation == 0xFFFF) {
-                  LError("No space for new message found in rx message buffer, dropping!");
-                  continue;
-                }
-
-                LDebug("Allocated space in buffer for new message");
-
-                //Now that we successfully got an allocation in the rxMessageBuffer, construct a message in the rxMessageArray
-                uint8_t headerBuf[11];
-                headerBuf[0] = messageNumber >> 8;
-                headerBuf[1] = messageNumber & 0xFF;
-                headerBuf[2] = bufferLocation >> 8;
-                headerBuf[3] = bufferLocation & 0xFF;
-                headerBuf[4] = totalSequenceSize >> 8;
-                headerBuf[5] = totalSequenceSize & 0xFF;
-                headerBuf[6] = sequenceCount;
-                headerBuf[7] = 1 << sequenceNumber;
-                headerBuf[8] = sequenceSize;
-                headerBuf[9] = (millis() / 1000) % 255;
-                headerBuf[10] = tempBuf[1];
-
-                //try to add the message to the rxMessageArray
-                if (rxMessageArray.add(headerBuf)) {
-                  //Adding message to rx message array succeeded, so copy the data into the rxMessageBuffer
-                  LDebug("Added new rx message to buffer");
-                  memcpy(&(rxMessageBuffer[bufferLocation + sequenceSize * sequenceNumber]), &(tempBuf[10]), sequenceSize);
-                } else {
-                  //Adding message to rx message array failed, so release rx message buffer allocation and drop the message
-                  LError("Failed to add new rx message to array, rxMessageArray is full! Removing allocation in buffer");
-                  if (!rxMessageBuffer.free(bufferLocation)) {
-                    LError("Buffer Free Failed!");
-                    HALT();
-                  }
-                  continue;
-                }
-
-              }
-
-              if (!broadcast) sendAck(tempBuf[0], messageNumber, sequenceNumber);
-              
-            } else if (packetType == 1) {
-              ScopeLock(loraTxSpinLock, loraTxLock);
-              LDebug("Beginning ACK Message Processing");
-              //Ack Message - we need to process the ack
-              
-
-              const uint16_t messageNumber = (tempBuf[2] << 8) + tempBuf[3]; 
-              const uint8_t sequenceNumber = tempBuf[4]; 
-              if (sequenceNumber > 7) {
-                LError("Invalid sequence number! dropping");
-                break;
-              }
-
-              //Add the sender ID to our list of known device IDs
-              addDeviceIDToTable(tempBuf[1]);
-
-              //First, search for the relevant message in the txMessageArray by its message number and sequence number
-              for (int i = 0; i < txMessageArray.size(); i++) {
-                if ((txMessageArray.get(i)[0] << 8) + txMessageArray.get(i)[1] == messageNumber && txMessageArray.get(i)[2] == sequenceNumber) {
-                  LDebug("Found Message - Indicated ACK has been received");
-                  //we found the right message, so indicate the ack has been received
-                  txMessageArray.get(i)[8] |= 0b10000000;
-                }
-              }
-            } else if (packetType == 2) {
-              LDebug("Processing Device ID request");
-              if (plaintextLen != 5) {
-                LWarn("Received Device ID Scan message with incorrect size!");
-                break;
-              }
-              //we received a valid device ID request, so indicate to the send functionality that we should dispatch the device ID only if we havent received one in 10 seconds
-              if ((millis() / 1000) > lastDeviceIDResponseTime + 10) {
-                lastDeviceIDResponseTime = millis() / 1000;
-                LDebug("Constructing device id response packet");
-                sendDeviceIDResponseFunc();      
-              } else {
-                LDebug("Not setting sendDeviceIDResponse since one has been dispatched in the past 10 seconds");
-              }
-            } else if (packetType == 3) {
-              LDebug("Processing Device ID Response");
-              if (plaintextLen != 5) {
-                LWarn("Received Device ID Scan Response message with incorrect size!");
-                break;
-              }
-              //we received a valid device ID response, so log the ID has being taken in our device ID list
-              const uint8_t receivedDeviceID = tempBuf[0];
-              addDeviceIDToTable(receivedDeviceID);
-              if (receivedDeviceID == 255) {
-                LWarn("Received a device ID response from the broadcast ID, which was unexpected! ignoring");
-                break;
-              }
-            } else if (packetType == 4) {
-              LDebug("Processing Device ID Table Request");
-              if (plaintextLen != 5) {
-                LWarn("Received Device ID Table request message with incorrect size!");
-                break;
-              }
-              //we received a device Table request, so indicate to the send functionality that we should dispatch the full device Table only if we havent received one in 10 seconds
-              if ((millis() / 1000) > lastDeviceIDTableResponseTime + 10) {
-                LDebug("Creating device id table requst packet");
-                lastDeviceIDTableResponseTime = millis() / 1000;
-                
-                //plaintext buffer
-                uint32_t realTime = (millis() / 1000) + epochAtBoot;;
-                uint8_t pBuf[36];
-                pBuf[0] = realTime >> 24;
-                pBuf[1] = (realTime >> 16) & 0xFF;
-                pBuf[2] = (realTime >> 8) & 0xFF;
-                pBuf[3] = (realTime) & 0xFF;
-
-                memcpy(&(pBuf[4]), &(deviceIDList[0]), 32);
-
-                //encrypt message contents
-                size_t ciphertextLen;
-                if (encryptD2DMessage(&(pBuf[0]), 36, &(deviceIDTableResponseBuffer[2]), 36 + AES_GCM_OVERHEAD, &ciphertextLen)) {
-                  LDebug("Successfully encrypted device id table response message content");
-                } else {
-                  LError("Failed to encrypt device id table response message content");
-                  HALT();
-                }
-                if (ciphertextLen != 36 + AES_GCM_OVERHEAD) {
-                  LError("Unexpected ciphertext length");
-                }
-
-                //Calculate CRC on everything after the start byte
-                uint32_t newCrc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(deviceIDTableResponseBuffer[1])), 37 + AES_GCM_OVERHEAD))^0xffffffff;
-                deviceIDTableResponseBuffer[38 + AES_GCM_OVERHEAD] = (newCrc & 0x0000FF00) >> 8;
-                deviceIDTableResponseBuffer[39 + AES_GCM_OVERHEAD] = newCrc & 0x000000FF;
-
-                sendDeviceIDTableResponse = true;
-                
-                LDebug("Setting sendDeviceIDTableResponse to true");
-              } else {
-                LDebug("Not setting sendDeviceIDTableResponse since one has been dispatched in the past 10 seconds");
-              }
-              
-            } else if (packetType == 5) {
-              LDebug("Processing Device ID Table response packet");
-              if (plaintextLen != 36) {
-                LWarn("Received Device ID Table response message with incorrect size!");
-              }
-
-              receivedDeviceIDTable = true;
-              //we received a full device table, so update our device table 
-              for (int byteNum = 0; byteNum < 32; byteNum++) {
-                if (~deviceIDList[byteNum] & tempBuf[4+byteNum]) {
-                  LDebug("received Device ID table has differing IDs from out current table");
-                  deviceIDDataChanged = true;
-                }
-                deviceIDList[byteNum] |= tempBuf[4+byteNum];
-              }
+          }
+        } else { //if the received message is not in the rx message array...
+          LDebug("Message is not in RX Message Array, adding...");
+          //message was not found, so we need to add it
+
+          
+          //Check the sender's replay window. If the message number is in it, we have already processed this message
+          const uint8_t replay = replayWindowCheck(tempBuf[0], messageNumber);
+          if (replay == REPLAY_TOO_OLD) {
+            //it may be a replay and it may be a message that took a long time coming. Either way we can't take it, but
+            //an ACK would tell the sender we dropped it, so leave the sender to keep trying or give up on its own
+            LWarn("Received Message is too old for the replay window, ignoring");
+            continue;
+          }
+          if (replay == REPLAY_SEEN) {
+            LWarn("Received Message has a previously seen ID, ignoring");
+            //if the message was delivered, the ack most likely failed, so ack it again but otherwise silently drop it.
+            //If it was dropped half way, the ack says we have none of it, so the sender gives up on it instead of waiting
+            if (broadcast) scheduleGroupAck(tempBuf[0], messageNumber, sequenceNumber, packet);
+            else sendAck(tempBuf[0], messageNumber, sequenceNumber, rxReceivedFragments(tempBuf[0], messageNumber), packet->dataRate, packet->channel, packet->timestamp, packet->snr, packet->rssi);
+            continue;
+          }
+
+          //if it wasnt, then add it for future use
+          replayWindowMark(tempBuf[0], messageNumber);
+
+          //every fragment but the last carries SEQUENCE_MAX_SIZE bytes. If the last one arrives first, it can't tell us
+          //that size, so allocate for full fragments and record the real size now, since it's already known
+          const bool lastFirst = sequenceCount > 1 && sequenceNumber == sequenceCount - 1;
+          const uint8_t baseSize = sequenceCount > 1 ? SEQUENCE_MAX_SIZE : sequenceSize;
+          const uint32_t totalSequenceSize = baseSize * sequenceCount;
+
+          //try to allocate space in the rx message buffer
+          const uint16_t bufferLocation = rxMessageBuffer.malloc(totalSequenceSize);
+          if (bufferLocation == 0xFFFF) {
+            LError("No space for new message found in rx message buffer, dropping!");
+            continue;
+          }
+
+          LDebug("Allocated space in buffer for new message");
+
+          //Now that we successfully got an allocation in the rxMessageBuffer, track the message in the rxMessageArray
+          entry = rxMessageArray.add(tempBuf[0], messageNumber);
+          if (entry == NULL) {
+            //Adding message to rx message array failed, so release rx message buffer allocation and drop the message
+            LError("Failed to add new rx message to array, rxMessageArray is full! Removing allocation in buffer");
+            if (!rxMessageBuffer.free(bufferLocation)) {
+              LError("Buffer Free Failed!");
+              HALT();
             }
-            //If we've gotten this far, then a message was successfully processed, so break out of the loop checking this specific start byte
+            continue;
+          }
+          entry->bufferLocation = bufferLocation;
+          entry->size = lastFirst ? totalSequenceSize - (baseSize - sequenceSize) : totalSequenceSize;
+          entry->sequenceCount = sequenceCount;
+          entry->markFragment(sequenceNumber);
+          entry->sequenceSize = baseSize;
+          entry->timer = rxTimers.schedule(millis() + RX_REASSEMBLY_TIMEOUT_MS, ((uint32_t) tempBuf[0] << 16) | messageNumber);
+
+          //copy the data into the rxMessageBuffer
+          LDebug("Added new rx message to buffer");
+          memcpy(&(rxMessageBuffer[bufferLocation + baseSize * sequenceNumber]), &(tempBuf[10]), sequenceSize);
+
+          //single fragment messages are done already
+          if (entry->complete()) dispatchCompletedMessage(entry);
+
+        }
+
+        //the ACK carries every fragment of the message we have, so one that gets through makes up for any that didn't
+        if (broadcast) scheduleGroupAck(tempBuf[0], messageNumber, sequenceNumber, packet);
+        else sendAck(tempBuf[0], messageNumber, sequenceNumber, rxReceivedFragments(tempBuf[0], messageNumber), packet->dataRate, packet->channel, packet->timestamp, packet->snr, packet->rssi);
+        
+      } else if (packetType == 1) {
+        ScopeLock(loraTxSpinLock, loraTxLock);
+        LDebug("Beginning ACK Message Processing");
+        //Ack Message - we need to process the ack
+        
+
+        const uint16_t messageNumber = (tempBuf[2] << 8) + tempBuf[3]; 
+        const uint8_t sequenceNumber = tempBuf[4]; 
+        if (sequenceNumber >= SEQUENCE_MAX_COUNT) {
+          LError("Invalid sequence number! dropping");
+          break;
+        }
+
+        //Add the sender ID to our list of known device IDs
+        addDeviceIDToTable(tempBuf[0]);
+
+        //the ACK also carries the rate the peer wants us to use, the rates it listens on, how well it heard us and every
+        //fragment of the message it has
+        uint32_t received = 1UL << sequenceNumber;
+        if (plaintextLen >= ACK_PLAINTEXT_SIZE) {
+          const uint32_t bitmap = ((uint32_t) tempBuf[13] << 24) | ((uint32_t) tempBuf[14] << 16) | (tempBuf[15] << 8) | tempBuf[16];
+          //the peer has none of it, it dropped the message half way and won't take any more of it
+          if (bitmap == 0) {
+            LWarn("Peer dropped a message before it was complete, giving up on it");
+            abandonTxMessage(messageNumber, tempBuf[0]);
             break;
           }
+          received |= bitmap;
         }
-        //end of end byte for loop. If we got this far with a message detection, we continue the breaks
-        if (messageFound) break;
-      }
-    }
 
-    //end of start and stop byte loops. if we got this far with no message detected, then we need to do some buffer cleaning.
-    //first, we should drop the front of the buffer until it is 256 bytes max
-    //then, we should update the rxBufferLastSize variable appropriately
-    if (!messageFound) {
-      if (rxBuffer.size() > 256) {
-        shouldScanRxBuffer = true; //there more data that didn't get scanned potentially, so rescan
-        rxBuffer.dropFront(rxBuffer.size() - 256);
-      }
-      rxBufferLastSize = rxBuffer.size();
-    }
-  }
+        //release every fragment of the message the peer has, only the missing ones are left to be sent again. A broadcast
+        //fragment is done with once every peer it was waiting for has it
+        bool groupAck = false;
+        for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+          TxFragment* fragment = &(txFragments[i]);
+          if (!fragment->used || fragment->messageNumber != messageNumber) continue;
+          //the peer still has the message, so the fragments it is missing are worth sending for a while longer
+          if (fragment->sendCount > 0 && (fragment->destination == tempBuf[0] || fragment->destination == DATA_RATE_BROADCAST)) fragment->heardAt = millis();
+          if (!((received >> fragment->sequenceNumber) & 1)) continue;
+          if (fragment->destination == DATA_RATE_BROADCAST) {
+            groupAck = true;
+            fragment->pendingPeers[tempBuf[0] / 8] &= ~(1 << (tempBuf[0] % 8));
+            if (txFragmentPending(i)) continue;
+            LDebug("Every peer has ACKed broadcast fragment, dropping from buffer");
+            releaseTxFragment(i);
+            continue;
+          }
+          if (fragment->destination != tempBuf[0]) continue;
+          LDebug("Found Message - ACK has been received, dropping from buffer");
+          //the fragment the ACK answers is the only one its timing says anything about
+          if (fragment->sequenceNumber == sequenceNumber && fragment->sendCount == 1) retransmitRecordSample(fragment->destination, millis() - fragment->queuedAt);
+          //it is done with. That also lets the next one of the message go out
+          releaseTxFragment(i);
+        }
 
-  //scan through the RX message array and look for any completed messages or any expiring messages
-  static uint32_t lastRxProcess = millis();
-  if (millis() > lastRxProcess + 500) {
-    //LDebug("Attemping to acquire rx scope lock");
-    ScopeLock(loraRxSpinLock, loraRxLock);
-    lastRxProcess = millis();
-    for (int i = 0; i < rxMessageArray.size(); i++) {
-      //check if a message has received all its parts
-      const uint8_t bitmask = rxMessageArray.get(i)[7];
-      const uint8_t sequenceCount = rxMessageArray.get(i)[6];
-      if (((bitmask + 1) >> sequenceCount) == 1) { //if all parts have been received... NOTE Im not sure if this work will when there are 8 segments. It should but only because of automatic type promotion
-        LDebug("Received message has completed"); 
-        //Now that we know the message has been fully received, we will drop it from the rxMessageArray, but keep its allocation in the buffer
-        //Then we will pass the index of that allocation off to the serial functionality
-        uint8_t tempBuf[5];
-        tempBuf[0] = rxMessageArray.get(i)[2]; //Buffer Location
-        tempBuf[1] = rxMessageArray.get(i)[3];
-        tempBuf[2] = rxMessageArray.get(i)[4]; //Size in buffer
-        tempBuf[3] = rxMessageArray.get(i)[5];
-        tempBuf[4] = rxMessageArray.get(i)[10]; // sender ID
-        
-        {
-          ScopeLock(serialLoraBridgeSpinLock, serialLoraBridgeLock);
-          if (serialReadyToSendArray.add(&(tempBuf[0]))) {
-            LDebug("Dispatched message to readytosendarray");
+        if (plaintextLen >= ACK_PLAINTEXT_SIZE) {
+          //a broadcast goes out at full power on the default rate, so how well it was heard says nothing about the power
+          //to use with the peer
+          if (!groupAck) txPowerRecordReport(tempBuf[0], dataRateFor(tempBuf[0]), ((int8_t) tempBuf[11]) / 4.0, -((int16_t) tempBuf[12]));
+          dataRateRecordRequest(tempBuf[0], tempBuf[9], tempBuf[10]);
+        }
+      } else if (packetType == 2) {
+        LDebug("Processing Device ID request");
+        if (plaintextLen != 5) {
+          LWarn("Received Device ID Scan message with incorrect size!");
+          break;
+        }
+        //we received a valid device ID request, so indicate to the send functionality that we should dispatch the device ID only if we havent received one in 10 seconds
+        if ((millis() / 1000) > lastDeviceIDResponseTime + 10) {
+          lastDeviceIDResponseTime = millis() / 1000;
+          LDebug("Constructing device id response packet");
+          sendDeviceIDResponseFunc();      
+        } else {
+          LDebug("Not setting sendDeviceIDResponse since one has been dispatched in the past 10 seconds");
+        }
+      } else if (packetType == 3) {
+        LDebug("Processing Device ID Response");
+        if (plaintextLen != 5) {
+          LWarn("Received Device ID Scan Response message with incorrect size!");
+          break;
+        }
+        //we received a valid device ID response, so log the ID has being taken in our device ID list
+        const uint8_t receivedDeviceID = tempBuf[0];
+        addDeviceIDToTable(receivedDeviceID);
+        if (receivedDeviceID == 255) {
+          LWarn("Received a device ID response from the broadcast ID, which was unexpected! ignoring");
+          break;
+        }
+      } else if (packetType == 4) {
+        LDebug("Processing Device ID Table Request");
+        if (plaintextLen != 5) {
+          LWarn("Received Device ID Table request message with incorrect size!");
+          break;
+        }
+        //we received a device Table request, so indicate to the send functionality that we should dispatch the full device Table only if we havent received one in 10 seconds
+        if ((millis() / 1000) > lastDeviceIDTableResponseTime + 10) {
+          LDebug("Creating device id table requst packet");
+          lastDeviceIDTableResponseTime = millis() / 1000;
+          
+          //plaintext buffer
+          uint32_t realTime = (millis() / 1000) + epochAtBoot;;
+          uint8_t pBuf[36];
+          pBuf[0] = realTime >> 24;
+          pBuf[1] = (realTime >> 16) & 0xFF;
+          pBuf[2] = (realTime >> 8) & 0xFF;
+          pBuf[3] = (realTime) & 0xFF;
+
+          memcpy(&(pBuf[4]), &(deviceIDList[0]), 32);
+
+          //encrypt message contents and frame them
+          if (buildFrame(&(deviceIDTableResponseBuffer[0]), 5, &(pBuf[0]), 36) == DEVICE_ID_TABLE_FRAME_SIZE) {
+            LDebug("Successfully built device id table response frame");
           } else {
-            LError("Failed to dispatch message ot readytosendarray");
+            LError("Failed to build device id table response frame");
+            HALT();
           }
+
+          sendDeviceIDTableResponse = true;
+          
+          LDebug("Setting sendDeviceIDTableResponse to true");
+        } else {
+          LDebug("Not setting sendDeviceIDTableResponse since one has been dispatched in the past 10 seconds");
         }
-        //now remove it from rxMessageArray
-        rxMessageArray.remove(i);
-        i--;
-      } else
-
-      //check if a message has expired
-      if ((diff((millis() / 1000) % 255, rxMessageArray.get(i)[9], 256)) > 10) { //NOTE this 10 second timeout should eventually become a definition
-        LLog("Clearing message in RX buffer that has been around for 10 seconds");
-        //since it expired, remove its allocation and clear it from the message array
-        const uint16_t address = (rxMessageArray.get(i)[2] << 8) + rxMessageArray.get(i)[3]; 
-        if (!rxMessageBuffer.free(address)) {
-          LError("Failed to free expiring message from rxBuffer");
-          HALT();
+        
+      } else if (packetType == 5) {
+        LDebug("Processing Device ID Table response packet");
+        if (plaintextLen != 36) {
+          LWarn("Received Device ID Table response message with incorrect size!");
+        }
+
+        receivedDeviceIDTable = true;
+        //we received a full device table, so update our device table 
+        for (int byteNum = 0; byteNum < 32; byteNum++) {
+          if (~deviceIDList[byteNum] & tempBuf[4+byteNum]) {
+            LDebug("received Device ID table has differing IDs from out current table");
+            deviceIDDataChanged = true;
+          }
+          deviceIDList[byteNum] |= tempBuf[4+byteNum];
         }
-        if (!rxMessageArray.remove(i)) {
-          LError("Failed to remove expiring message from rxMessageArray");
-          HALT();
-        } 
-        i--;
       }
+    } while (false);
+  }
+
+  //drop any messages that have gone RX_REASSEMBLY_TIMEOUT_MS without a new fragment. Completed ones are passed on as soon
+  //as their last fragment comes in
+  uint32_t timerKey;
+  while (rxTimers.expired(millis(), &timerKey)) {
+    ScopeLock(loraRxSpinLock, loraRxLock);
+    RxReassembly* entry = rxMessageArray.find(timerKey >> 16, timerKey & 0xFFFF);
+    if (entry == NULL) continue;
+    LLog("Clearing message in RX buffer that has gone 10 seconds without a new fragment");
+    //since it expired, remove its allocation and clear it from the message array
+    if (!rxMessageBuffer.free(entry->bufferLocation)) {
+      LError("Failed to free expiring message from rxBuffer");
+      HALT();
+    }
+    rxMessageArray.remove(entry);
+  }
+
+  //ACK the broadcasts whose slot has come
+  while (groupAckTimers.expired(millis(), &timerKey)) {
+    GroupAck* ack = &(groupAcks[timerKey]);
+    ack->used = false;
+    ack->timer = TIMER_NONE;
+    uint32_t received;
+    {
+      ScopeLock(loraRxSpinLock, loraRxLock);
+      received = rxReceivedFragments(ack->sender, ack->messageNumber);
     }
+    sendAck(ack->sender, ack->messageNumber, ack->sequenceNumber, received, ack->rate, ack->channel, ack->rxTime, ack->snr, ack->rssi);
   }
 
   // -------------------------------------------- Transmit Interrupt Handling ---------------------------------------
   if (lastDeviceMode == CAD_FINISHED) { //if CAD detection finished and didn't detect any other signals
     LDebug("CAD Finished, beginning to send message");
     //since all this function does is perform reads from the txMessageBuffer, it doesn't need a lock since the function that handles removing data from txMessageBuffer is located in this thread
-    //We just finished CAD, so send a message
-    //the dispatch order is this (from highest to lowest precedence): 
-    //            data packet  -  ack packet  -  device ID request  -  device ID response  -  device Table request  -  device Table response
-
-    if (readyToSendBuffer.size() > 0) { //if there is a data packet to send...
-      LoRa.beginPacket();
-      messageDispatched = true;
-      //get information about message to send from readyToSendBuffer
-      uint8_t array[3];
-      if (!readyToSendBuffer.peakFront(&(array[0]), 3)) {
-        LError("Ready to send buffer reported data, but peak front failed!");
-        HALT();
+    //We just finished CAD, so send whatever the scheduler picks (see nextTxClass()). Whatever else is queued for the same peer
+    //goes in the same container frame (see containerAdd()), so an ACK that missed the reply window rides along with the next
+    //data frame to its peer. Control frames go in this order:
+    //            device ID request  -  device ID response  -  device Table request  -  device Table response
+
+    //ACKs that piled up while the channel was busy are folded into the latest one for their message
+    {
+      ScopeLock(loraTxSpinLock, loraTxLock);
+      while (ackToSendBuffer.size() > ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE && ackSuperseded()) {
+        LDebug("Dropping ACK that a later one covers");
+        ackToSendBuffer.dropFront(ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE);
       }
-      const uint16_t src = (array[0] << 8) + array[1];
-      const uint16_t size = array[2];
-      LoRa.write(&(txMessageBuffer[src]), size);
-      lastDeviceMode = TX_MODE;
-      LoRa.endPacket(true);
-      LDebug("Finishing writing Normal message to LoRa, dumping message");
-      Debug(dumpArrayToSerial(&(txMessageBuffer[src]), size));
-    } else if (ackToSendBuffer.size() > 0) { //if there is a ACK packet to send...
-      LoRa.beginPacket();
-      ackDispatched = true;
-      uint8_t array[14 + AES_GCM_OVERHEAD];
-      if (!ackToSendBuffer.peakFront(&(array[0]), 14 + AES_GCM_OVERHEAD)) {
+    }
+    const uint8_t txClass = nextTxClass();
+    txDispatched[txClass]++;
+    if (txClass == TX_CLASS_ACK && replyWindowOpen(ackArrivalTime(0))) {
+      //the sender is still waiting for it without a header, so it goes alone
+      acksDispatched = 1;
+      uint8_t array[ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE];
+      if (!ackToSendBuffer.peakFront(&(array[0]), ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE)) {
         LError("Ack buffer reported data, but peak front failed!");
         HALT();
       }
-      LoRa.write(&(array[0]), 14 + AES_GCM_OVERHEAD);
-      lastDeviceMode = TX_MODE;
-      LoRa.endPacket(true);
+      transmitReply(&(array[ACK_QUEUE_HEADER_SIZE]), ACK_FRAME_SIZE, array[0], array[1], array[2]);
+      lastReplyTime = ackArrivalTime(0);
+      replySent = true;
       LDebug("Finished writing Ack message to LoRa");
-    } else if (sendDeviceIDRequest) { //if we should dispatch a device ID request...
+    } else if (txClass == TX_CLASS_ACK || txClass == TX_CLASS_DATA) {
+      //everything else queued for the same peer at the front of the buffers goes out with it (see containerAdd())
+      const uint8_t destination = txClass == TX_CLASS_ACK ? ackToSendBuffer[0] : readyToSendBuffer[3];
+      if (txClass == TX_CLASS_ACK && txSlack(destination, ackArrivalTime(0)) < 0) txLateAcks++;
+      uint8_t container[CONTAINER_MESSAGE_MAX];
+      uint16_t containerSize = ROUTING_HEADER_SIZE;
+      //whatever the scheduler picked goes in first, so it is sure to fit
+      if (txClass == TX_CLASS_ACK) {
+        acksDispatched = aggregateAcks(&(container[0]), &containerSize, destination);
+        messagesDispatched = aggregateMessages(&(container[0]), &containerSize, destination);
+      } else {
+        messagesDispatched = aggregateMessages(&(container[0]), &containerSize, destination);
+        acksDispatched = aggregateAcks(&(container[0]), &containerSize, destination);
+      }
+
+      uint8_t packet[255];
+      uint16_t size = 0;
+      if (messagesDispatched + acksDispatched > 1) {
+        //the container's routing header only says who it is from and for
+        container[0] = deviceID;
+        container[1] = destination;
+        memset(&(container[2]), 0, ROUTING_HEADER_SIZE - 2);
+        size = buildFrame(&(packet[0]), FRAME_TYPE_CONTAINER, &(container[0]), containerSize);
+        if (size == 0) LError("Failed to build container frame, sending the first frame on its own");
+      }
+      if (size == 0) {
+        //a frame on its own goes out just as it was built
+        if (txClass == TX_CLASS_ACK) {
+          acksDispatched = 1;
+          messagesDispatched = 0;
+          size = ACK_FRAME_SIZE;
+          for (int i = 0; i < ACK_FRAME_SIZE; i++) packet[i] = ackToSendBuffer[ACK_QUEUE_HEADER_SIZE + i];
+        } else {
+          messagesDispatched = 1;
+          acksDispatched = 0;
+          size = readyToSendBuffer[2];
+          memcpy(&(packet[0]), &(txMessageBuffer[(readyToSendBuffer[0] << 8) + readyToSendBuffer[1]]), size);
+        }
+      } else {
+        txAggregated += messagesDispatched + acksDispatched - 1;
+        Debug(Serial1.printf("Sending %d data and %d ACK frames in one container frame\n", messagesDispatched, acksDispatched));
+      }
+      //broadcasts aren't ACKed, everything else with a data frame in it is
+      transmitFrame(&(packet[0]), size, destination, messagesDispatched > 0 && destination != DATA_RATE_BROADCAST ? ACK_FRAME_SIZE : 0);
+      LDebug("Finishing writing packet to LoRa, dumping it");
+      Debug(dumpArrayToSerial(&(packet[0]), size));
+    } else if (txClass == TX_CLASS_CONTROL && sendDeviceIDRequest) { //if we should dispatch a device ID request...
+      lastControlDispatchTime = millis();
       sendDeviceIDRequest = false;
-      LoRa.beginPacket();
-      LoRa.write(&(deviceIDRequestBuffer[0]), 10 + AES_GCM_OVERHEAD);
-      lastDeviceMode = TX_MODE;
-      LoRa.endPacket(true);
+      transmitFrame(&(deviceIDRequestBuffer[0]), DEVICE_ID_FRAME_SIZE, DATA_RATE_BROADCAST);
       LDebug("Finished writing device id request message to LoRa");
-    } else if (sendDeviceIDResponse) { //if we should dispatch a device ID response...
+    } else if (txClass == TX_CLASS_CONTROL && sendDeviceIDResponse) { //if we should dispatch a device ID response...
+      lastControlDispatchTime = millis();
       sendDeviceIDResponse = false;
-      LoRa.beginPacket();
-      LoRa.write(&(deviceIDResponseBuffer[0]), 10 + AES_GCM_OVERHEAD);
-      lastDeviceMode = TX_MODE;
-      LoRa.endPacket(true);
+      transmitFrame(&(deviceIDResponseBuffer[0]), DEVICE_ID_FRAME_SIZE, DATA_RATE_BROADCAST);
       LDebug("Finished writing device id response message to LoRa");
 
-    } else if (sendDeviceIDTableRequest) { //if we should dispatch a device id table request...
+    } else if (txClass == TX_CLASS_CONTROL && sendDeviceIDTableRequest) { //if we should dispatch a device id table request...
+      lastControlDispatchTime = millis();
       sendDeviceIDTableRequest = false;
-      LoRa.beginPacket();
-      LoRa.write(&(deviceIDTableRequestBuffer[0]), 10 + AES_GCM_OVERHEAD);
-      lastDeviceMode = TX_MODE;
-      LoRa.endPacket(true);
+      transmitFrame(&(deviceIDTableRequestBuffer[0]), DEVICE_ID_FRAME_SIZE, DATA_RATE_BROADCAST);
       LDebug("Finished writing device id table request message to LoRa");
 
-    } else if (sendDeviceIDTableResponse) { //if we should dispatch a device id table response... 
+    } else if (txClass == TX_CLASS_CONTROL && sendDeviceIDTableResponse) { //if we should dispatch a device id table response... 
+      lastControlDispatchTime = millis();
       sendDeviceIDTableResponse = false;
-      LoRa.beginPacket();
-      LoRa.write(&(deviceIDTableResponseBuffer[0]), 41 + AES_GCM_OVERHEAD);
-      lastDeviceMode = TX_MODE;
-      LoRa.endPacket(true);
+      transmitFrame(&(deviceIDTableResponseBuffer[0]), DEVICE_ID_TABLE_FRAME_SIZE, DATA_RATE_BROADCAST);
       LDebug("Finished writing device id table response message to LoRa"); 
+    } else {
+      //everything queued was cleared while CAD was running, so just go back to listening
+      LDebug("Cad Finished with no data in either buffer, returning to receive mode");
+      radioPostCommand(RADIO_COMMAND_RECEIVE);
+      lastDeviceMode = RX_MODE;
     }
-
-
-    //LError("Cad Finished with no data in either buffer!");
     
   }
 
   // -------------------------------------------- Transmit Loop Behavior ---------------------------------------------
-  if (messageDispatched) { //if we sent a TX messsage clean it out of the buffer
+  if (messagesDispatched > 0) { //if we sent TX messsages clean them out of the buffer
     ScopeLock(loraTxSpinLock, loraTxLock);
-    LDebug("Clearing sent normal message out of TX buffer");
-    messageDispatched = false;
-    readyToSendBuffer.dropFront(3);
-  } else if (ackDispatched) {
+    LDebug("Clearing sent normal messages out of TX buffer");
+    txFragmentsDispatched(messagesDispatched);
+    readyToSendBuffer.dropFront(messagesDispatched * READY_TO_SEND_ENTRY_SIZE);
+    messagesDispatched = 0;
+  }
+  if (acksDispatched > 0) {
     ScopeLock(loraTxSpinLock, loraTxLock);
-    LDebug("Clearing sent ACK message out of TX buffer");
-    ackDispatched = false;
-    ackToSendBuffer.dropFront(14 + AES_GCM_OVERHEAD);
+    LDebug("Clearing sent ACK messages out of TX buffer");
+    ackToSendBuffer.dropFront(acksDispatched * (ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE));
+    acksDispatched = 0;
   }
 
-  static uint32_t lastTxProcess = millis(); //NOTE at some point, this should be made into a looping variable. It will overflow in about 1.5 months
-  if (millis() > lastTxProcess + 500) {
-    //LDebug("Attempting to acquire tx lock");
+  {
+    //send fragments whose turn has come, and send again the ones whose ACK hasn't come back in time
     ScopeLock(loraTxSpinLock, loraTxLock);
-    lastTxProcess = millis();
-    //LDebug("attempting to process messagess in tx message array");
-    //for each message in the tx Array...
-    for (int i = 0; i < txMessageArray.size(); i++) {
-      const uint8_t sendCount = txMessageArray.get(i)[8] & 0b01111111;
-      const bool ack = txMessageArray.get(i)[8] & 0b10000000;
-      const uint16_t location = (txMessageArray.get(i)[3] << 8) + txMessageArray.get(i)[4];
-
-      //If the ack bit is set, drop the message
-      if (ack) {
-        LDebug("Ack detected for current tx message, dropping from buffer");
-        if(!txMessageBuffer.free(location)) {
-          LError("Failed to free allocation in txMessageBuffer");
-          HALT();
-        }
-        if (!txMessageArray.remove(i--)) {
-          LError("Failed to remove message from txMessageArray");
-          HALT();
-        }
-        continue;
-      }
-
-      //If we've reached the max number of send attempts, drop the data all together
-      if (sendCount > LORA_SEND_COUNT_MAX) {
-        LDebug("Message has reached max send attempts, dropping from buffer");
-        if(!txMessageBuffer.free(location)) {
-          LError("Failed to free allocation in txMessageBuffer");
-          HALT();
-        }
-        if (!txMessageArray.remove(i--)) {
-          LError("Failed to remove message from txMessageArray");
-          HALT();
-        }
-        continue;
-      }
-
-      //If it has been over a second since the previous send, try again //NOTE this 4s resent delay should probably be made shorter and controllable via a constant
-      uint16_t lastSendTime = (txMessageArray.get(i)[6] << 8) + txMessageArray.get(i)[7];
-      if ((diff(millis() % 65536, lastSendTime, 65536)) > 4000) {
-        LDebug("Message being processed has reached send time again");
-        Debug(dumpArrayToSerial(&(txMessageArray.get(i)[0]), 9));
-        LDebug("adding a message to the readytosend buffer");
-        Debug(Serial1.printf("Diff = %d, 1 = %d, 2 = %d\n", diff(millis() % 65536, lastSendTime, 65536), millis() % 65536, lastSendTime));
-        lastSendTime = millis() % 65536; //TODO - the time for CAD to occur is not accounted for in the resend functionality, which is a problem
-        //To fix this easily, we can maintatin an average CAD send time (maybe average over 10 previous sends) and add that to our resend delay
-        txMessageArray.get(i)[6] = lastSendTime >> 8;
-        txMessageArray.get(i)[7] = lastSendTime & 0xFF;
-        txMessageArray.get(i)[8]++; //increment send count
-        //create buffer for dispatching message
-        uint8_t tBuf[3];
-        tBuf[0] = txMessageArray.get(i)[3]; //location high byte
-        tBuf[1] = txMessageArray.get(i)[4]; //location low byte
-        tBuf[2] = txMessageArray.get(i)[5]; //size
-        if (readyToSendBuffer.pushBack(tBuf, 3)) {
-          LDebug("Added message to ready to send buffer");
-          Debug(dumpArrayToSerial(&(tBuf[0]), 3));
-        } else {
-          LError("Failed to add message to ready to send buffer because it was full");
-        }
-      }
+    while (txTimers.expired(millis(), &timerKey)) {
+      sendTxFragment(timerKey);
     }
   }
   
 
-  if (readyToSendBuffer.size() > 0 || ackToSendBuffer.size() > 0 || sendDeviceIDTableResponse || sendDeviceIDResponse || sendDeviceIDRequest || sendDeviceIDTableRequest) {
+  if (nextTxClass() != TX_CLASS_NONE) {
     //LDebug("One of the TX buffers has data, attempting to enter CAD Mode");
     enterChannelActivityDetectionMode();
   }
@@ -1109,10 +1175,93 @@ void initializeDeviceRouting() {
   }
 }
 
-void sendAck(const uint8_t dstID, const uint16_t messageNumber, const uint8_t sequenceNumber) {
+//Hands a message that has received all its parts to the API task and drops it from the rxMessageArray. Its allocation in
+//the buffer stays until it has been written out to serial. Needs the loraRx lock
+void dispatchCompletedMessage(RxReassembly* entry) {
+  LDebug("Received message has completed");
+  uint8_t tempBuf[5];
+  tempBuf[0] = entry->bufferLocation >> 8; //Buffer Location
+  tempBuf[1] = entry->bufferLocation & 0xFF;
+  tempBuf[2] = entry->size >> 8; //Size in buffer
+  tempBuf[3] = entry->size & 0xFF;
+  tempBuf[4] = entry->sender; // sender ID
+
+  bool dispatched;
+  {
+    ScopeLock(serialLoraBridgeSpinLock, serialLoraBridgeLock);
+    dispatched = serialReadyToSendArray.add(&(tempBuf[0]));
+  }
+  if (dispatched) {
+    LDebug("Dispatched message to readytosendarray");
+    replayWindowMarkDelivered(entry->sender, entry->messageNumber);
+    apiNotifyMessageReady();
+  } else {
+    LError("Failed to dispatch message ot readytosendarray");
+    rxMessageBuffer.free(entry->bufferLocation);
+  }
+  rxTimers.cancel(entry->timer);
+  rxMessageArray.remove(entry);
+}
+
+//fragments of a message we have, bit n for fragment n. All of them once the message has been delivered, none if it was
+//dropped before that. Needs the loraRx lock
+uint32_t rxReceivedFragments(const uint8_t senderID, const uint16_t messageNumber) {
+  RxReassembly* entry = rxMessageArray.find(senderID, messageNumber);
+  if (entry != NULL) return entry->receivedMask();
+  return replayWindowDelivered(senderID, messageNumber) ? ACK_ALL_FRAGMENTS : 0;
+}
+
+//true if an ACK further back in the ack buffer is for the same message as the one at the front. The later one covers
+//every fragment the front one does, so the front one doesn't need to go out
+bool ackSuperseded() {
+  const uint32_t entrySize = ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE;
+  const uint32_t numberOffset = ACK_QUEUE_HEADER_SIZE + FRAME_HEADER_SIZE + 2;
+  for (uint32_t i = entrySize; i + entrySize <= ackToSendBuffer.size(); i += entrySize) {
+    if (ackToSendBuffer[i] == ackToSendBuffer[0] && ackToSendBuffer[i + numberOffset] == ackToSendBuffer[numberOffset] && ackToSendBuffer[i + numberOffset + 1] == ackToSendBuffer[numberOffset + 1]) return true;
+  }
+  return false;
+}
+
+//Broadcasts are ACKed by everyone that heard them, so the ACK waits until the sender has stopped sending fragments of
+//the message and then for our slot. Every fragment that comes in pushes it back, so one ACK covers the whole message
+void scheduleGroupAck(const uint8_t senderID, const uint16_t messageNumber, const uint8_t sequenceNumber, const RxPacket* packet) {
+  int slot = -1;
+  for (int i = 0; i < GROUP_ACK_QUEUE_LENGTH; i++) {
+    if (groupAcks[i].used && groupAcks[i].sender == senderID && groupAcks[i].messageNumber == messageNumber) {
+      slot = i;
+      break;
+    }
+    if (!groupAcks[i].used && slot == -1) slot = i;
+  }
+  if (slot == -1) {
+    LWarn("No room left to ACK broadcast, dropping ACK");
+    return;
+  }
+
+  GroupAck* ack = &(groupAcks[slot]);
+  if (!ack->used) {
+    ack->used = true;
+    ack->sender = senderID;
+    ack->messageNumber = messageNumber;
+    ack->timer = TIMER_NONE;
+  }
+  ack->sequenceNumber = sequenceNumber;
+  ack->rate = packet->dataRate;
+  ack->channel = packet->channel;
+  ack->rxTime = packet->timestamp;
+  ack->snr = packet->snr;
+  ack->rssi = packet->rssi;
+
+  //nodes that share a slot still shouldn't go at exactly the same time
+  const uint32_t due = millis() + GROUP_ACK_DELAY_MS + (deviceID % GROUP_ACK_SLOTS) * GROUP_ACK_SLOT_MS + esp_random() % GROUP_ACK_SLOT_MS;
+  if (ack->timer == TIMER_NONE) ack->timer = groupAckTimers.schedule(due, slot);
+  else ack->timer = groupAckTimers.reschedule(ack->timer, due);
+}
+
+void sendAck(const uint8_t dstID, const uint16_t messageNumber, const uint8_t sequenceNumber, const uint32_t received, const uint8_t rxRate, const uint8_t rxChannel, const uint32_t rxTime, const float rxSnr, const int16_t rxRssi) {
   //Send an ACK. Since the readyToSendBuffer only references data in other buffers, we will have a seperate ACK buffer
   LDebug("Requesting ACK Send: Adding send to ack buffer");
-  uint8_t uBuf[9]; //this is the data that will eventually be encrypted
+  uint8_t uBuf[ACK_PLAINTEXT_SIZE]; //this is the data that will eventually be encrypted
   uBuf[0] = deviceID;
   uBuf[1] = dstID;
   uBuf[2] = messageNumber >> 8;
@@ -1123,31 +1272,236 @@ void sendAck(const uint8_t dstID, const uint16_t messageNumber, const uint8_t se
   uBuf[6] = (timestamp >> 16) & 0xFF;
   uBuf[7] = (timestamp >> 8) & 0xFF;
   uBuf[8] = timestamp & 0xFF;
-
-  //construct actual message
-  uint8_t vBuf[14 + AES_GCM_OVERHEAD];
-  vBuf[0] = START_BYTE;
-  vBuf[1] = 1;
-  size_t ciphertextLen;
-  if (!encryptD2DMessage(&(uBuf[0]), 9, &(vBuf[2]), 14 + AES_GCM_OVERHEAD, &ciphertextLen)) {
-    LError("Failed to encrypt ACK message");
+  uBuf[9] = dataRateRequestFor(dstID); //rate we want the sender to use from now on
+  uBuf[10] = dataRateListenMask; //rates we listen on, so the sender can size its preamble
+  uBuf[11] = (uint8_t) (int8_t) min(max((int) lroundf(rxSnr * 4), -128), 127); //how well we heard the frame, so the sender can set its power
+  uBuf[12] = (uint8_t) min(max(-rxRssi, 0), 255);
+  uBuf[13] = received >> 24; //fragments of the message we have
+  uBuf[14] = (received >> 16) & 0xFF;
+  uBuf[15] = (received >> 8) & 0xFF;
+  uBuf[16] = received & 0xFF;
+
+  //construct actual message. The destination and the frame being ACKed go in front of it in the ack buffer, so it can be
+  //sent as a reply or at the destination's data rate
+  uint8_t aBuf[ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE];
+  aBuf[0] = dstID;
+  aBuf[1] = rxRate;
+  aBuf[2] = rxChannel;
+  aBuf[3] = rxTime >> 24;
+  aBuf[4] = (rxTime >> 16) & 0xFF;
+  aBuf[5] = (rxTime >> 8) & 0xFF;
+  aBuf[6] = rxTime & 0xFF;
+  if (buildFrame(&(aBuf[ACK_QUEUE_HEADER_SIZE]), 1, &(uBuf[0]), ACK_PLAINTEXT_SIZE) != ACK_FRAME_SIZE) {
+    LError("Failed to build ACK frame");
     HALT();
   }
 
-  //assert the encrypted string is the expected length
-  if (ciphertextLen != 9 + AES_GCM_OVERHEAD) {
-    LError("Encrypted ACK has unexpected length!");
+  //Push the ACK to the ack buffer
+  ackToSendBuffer.pushBack(&(aBuf[0]), ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE);
+}
+
+//Called when a fragment's timer fires: queues the fragment to be sent (again), or gives up on it once it has been sent
+//LORA_SEND_COUNT_MAX times without an ACK. Needs the loraTx lock
+void sendTxFragment(const int slot) {
+  TxFragment* fragment = &(txFragments[slot]);
+  fragment->timer = TIMER_NONE;
+  if (!fragment->used) return;
+
+  //a broadcast nobody is left to ACK is done with. If there was nobody to wait for in the first place, it goes out once
+  if (fragment->destination == DATA_RATE_BROADCAST && fragment->sendCount > 0) {
+    const int pending = txFragmentPending(slot);
+    if (pending == 0) {
+      releaseTxFragment(slot);
+      return;
+    }
+    if (pending <= GROUP_ACK_UNICAST_MAX) {
+      LDebug("Only a few peers are missing a broadcast fragment, sending them a copy each");
+      for (int peer = 1; peer < 255; peer++) {
+        if (!((fragment->pendingPeers[peer / 8] >> (peer % 8)) & 1)) continue;
+        if (!copyTxFragmentTo(slot, peer)) LWarn("Failed to copy broadcast fragment for a peer, giving up on it");
+      }
+      releaseTxFragment(slot);
+      return;
+    }
+  }
+
+  //If we've reached the max number of send attempts, drop the data all together
+  if (fragment->sendCount > LORA_SEND_COUNT_MAX || (fragment->sendCount > 0 && millis() - fragment->heardAt >= RETRANSMIT_GIVE_UP_MS)) {
+    LDebug("Message has reached max send attempts, dropping from buffer");
+    releaseTxFragment(slot);
+    return;
+  }
+
+  //the last copy is still waiting for its turn, so there is nothing to resend yet
+  if (fragment->queued) {
+    fragment->timer = txTimers.schedule(millis() + retransmitTimeoutFor(fragment->destination, fragment->sendCount), slot);
+    return;
+  }
+
+  LDebug("adding a message to the readytosend buffer");
+  //anything past the first send means the last one wasn't ACKed in time, which counts against the current data rate
+  if (fragment->sendCount > 0) {
+    dataRateRecordFailure(fragment->destination);
+    txPowerRecordFailure(fragment->destination);
+  }
+  fragment->sendCount++;
+  //the timeout is learnt from how long ACKs from this peer take, CAD and queueing included. The last one ends where the
+  //fragment is given up on
+  fragment->queuedAt = millis();
+  if (fragment->sendCount == 1) fragment->heardAt = fragment->queuedAt;
+  uint32_t timeout = retransmitTimeoutFor(fragment->destination, fragment->sendCount);
+  const uint32_t left = RETRANSMIT_GIVE_UP_MS - (fragment->queuedAt - fragment->heardAt);
+  if (timeout > left) timeout = left;
+  fragment->timer = txTimers.schedule(millis() + timeout, slot);
+
+  //create buffer for dispatching message
+  uint8_t tBuf[READY_TO_SEND_ENTRY_SIZE];
+  tBuf[0] = fragment->location >> 8; //location high byte
+  tBuf[1] = fragment->location & 0xFF; //location low byte
+  tBuf[2] = fragment->size; //size
+  tBuf[3] = fragment->destination; //destination
+  tBuf[4] = fragment->queuedAt >> 24; //queue time, for the scheduler
+  tBuf[5] = (fragment->queuedAt >> 16) & 0xFF;
+  tBuf[6] = (fragment->queuedAt >> 8) & 0xFF;
+  tBuf[7] = fragment->queuedAt & 0xFF;
+  if (readyToSendBuffer.pushBack(tBuf, READY_TO_SEND_ENTRY_SIZE)) {
+    fragment->queued = true;
+    LDebug("Added message to ready to send buffer");
+    Debug(dumpArrayToSerial(&(tBuf[0]), READY_TO_SEND_ENTRY_SIZE));
+  } else {
+    LError("Failed to add message to ready to send buffer because it was full");
+  }
+}
+
+//Only a few fragments of a message are in flight at a time. This starts the next ones once there is room. Queueing all
+//of a long message at once would have its later fragments time out and get queued again before their first copy had
+//even gone out. Needs the loraTx lock
+void startTxFragments(const uint16_t messageNumber) {
+  int inFlight = 0;
+  int window = TX_FRAGMENT_WINDOW;
+  for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+    if (!txFragments[i].used || txFragments[i].messageNumber != messageNumber) continue;
+    if (txFragments[i].sendCount > 0) inFlight++;
+    //a broadcast is ACKed once its fragments stop coming, so they all go out together
+    if (txFragments[i].destination == DATA_RATE_BROADCAST) window = SEQUENCE_MAX_COUNT;
+  }
+  while (inFlight < window) {
+    int next = -1;
+    for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+      const TxFragment* fragment = &(txFragments[i]);
+      if (!fragment->used || fragment->messageNumber != messageNumber || fragment->sendCount > 0 || fragment->timer != TIMER_NONE) continue;
+      if (next == -1 || fragment->sequenceNumber < txFragments[next].sequenceNumber) next = i;
+    }
+    if (next == -1) return;
+    txFragments[next].timer = txTimers.schedule(millis(), next);
+    inFlight++;
+  }
+}
+
+//peers a broadcast fragment is still waiting for an ACK from
+int txFragmentPending(const int slot) {
+  int count = 0;
+  for (int i = 0; i < 32; i++) count += __builtin_popcount(txFragments[slot].pendingPeers[i]);
+  return count;
+}
+
+//makes a unicast copy of a broadcast fragment for a peer that hasn't ACKed it. The peer ACKs it right away like any other
+//fragment, and the peers that already have it don't hear it, and ACK it, all over again. Needs the loraTx lock
+bool copyTxFragmentTo(const int slot, const uint8_t peer) {
+  int copy = 0;
+  while (copy < TX_FRAGMENT_SLOTS && (txFragments[copy].used || txFragments[copy].queued)) copy++;
+  if (copy == TX_FRAGMENT_SLOTS) return false;
+
+  //the receiver is covered by the tag, so the frame has to be built again
+  uint8_t uBuf[256];
+  size_t messageLen;
+  if (!openFrame(&(txMessageBuffer[txFragments[slot].location]), &(uBuf[0]), 256, &messageLen)) return false;
+  uBuf[1] = peer;
+  const uint16_t addr = txMessageBuffer.malloc(txFragments[slot].size);
+  if (addr == 0xFFFF) return false;
+  if (buildFrame(&(txMessageBuffer[addr]), 0, &(uBuf[0]), messageLen) != txFragments[slot].size) {
+    txMessageBuffer.free(addr);
+    return false;
+  }
+
+  TxFragment* fragment = &(txFragments[copy]);
+  memset(fragment, 0, sizeof(TxFragment));
+  fragment->used = true;
+  fragment->messageNumber = txFragments[slot].messageNumber;
+  fragment->sequenceNumber = txFragments[slot].sequenceNumber;
+  fragment->destination = peer;
+  fragment->location = addr;
+  fragment->size = txFragments[slot].size;
+  fragment->timer = txTimers.schedule(millis(), copy);
+  return true;
+}
+
+//frees a fragment's slot and allocation. If it is still in readyToSendBuffer, that entry points at the allocation, so
+//both are kept until the entry has been sent (see txFragmentsDispatched()). Needs the loraTx lock
+void freeTxFragment(const int slot) {
+  TxFragment* fragment = &(txFragments[slot]);
+  txTimers.cancel(fragment->timer);
+  fragment->timer = TIMER_NONE;
+  fragment->used = false;
+  if (fragment->queued) return;
+  if (!txMessageBuffer.free(fragment->location)) {
+    LError("Failed to free allocation in txMessageBuffer");
     HALT();
   }
+}
 
-  //Add CRC and construct rest of ACK
-  uint32_t newCrc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(vBuf[1])), 10 + AES_GCM_OVERHEAD))^0xffffffff; //note - this is one byte longer because it includes the start byte
-  vBuf[11 + AES_GCM_OVERHEAD] = (newCrc & 0x0000FF00) >> 8;
-  vBuf[12 + AES_GCM_OVERHEAD] = newCrc & 0x000000FF;
-  vBuf[13 + AES_GCM_OVERHEAD] = END_BYTE;
+//called before the first count entries of readyToSendBuffer are dropped once they have been sent. Frees the fragments
+//that were let go of while they waited. Needs the loraTx lock
+void txFragmentsDispatched(const uint8_t count) {
+  for (uint32_t entry = 0; entry < count * READY_TO_SEND_ENTRY_SIZE; entry += READY_TO_SEND_ENTRY_SIZE) {
+    const uint16_t location = (readyToSendBuffer[entry] << 8) + readyToSendBuffer[entry + 1];
+    for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+      if (!txFragments[i].queued || txFragments[i].location != location) continue;
+      txFragments[i].queued = false;
+      if (!txFragments[i].used) freeTxFragment(i);
+      else if (txFragments[i].destination == DATA_RATE_BROADCAST) restartBroadcastTimers(txFragments[i].messageNumber);
+      break;
+    }
+  }
+}
 
-  //Push the ACK to the ack buffer
-  ackToSendBuffer.pushBack(&(vBuf[0]), 14 + AES_GCM_OVERHEAD);
+//a broadcast's fragments are ACKed together, once they have stopped coming, so the wait for that ACK runs from the last
+//one sent. Otherwise the first ones of a long broadcast time out before the rest have even gone out. Needs the loraTx lock
+void restartBroadcastTimers(const uint16_t messageNumber) {
+  for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+    TxFragment* fragment = &(txFragments[i]);
+    if (!fragment->used || fragment->messageNumber != messageNumber || fragment->destination != DATA_RATE_BROADCAST) continue;
+    if (fragment->sendCount == 0 || fragment->timer == TIMER_NONE) continue;
+    fragment->timer = txTimers.reschedule(fragment->timer, millis() + retransmitTimeoutFor(DATA_RATE_BROADCAST, fragment->sendCount));
+  }
+}
+
+//frees a fragment that was ACKed or given up on, and lets the next one of its message go. Needs the loraTx lock
+void releaseTxFragment(const int slot) {
+  freeTxFragment(slot);
+  startTxFragments(txFragments[slot].messageNumber);
+}
+
+//removes every fragment of a message, so a message that only partly fit isn't sent in pieces
+void dropTxMessage(const uint16_t messageNumber) {
+  for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+    TxFragment* fragment = &(txFragments[i]);
+    if (!fragment->used || fragment->messageNumber != messageNumber) continue;
+    freeTxFragment(i);
+  }
+}
+
+//gives up on every fragment of a message still waiting on peer, for when the peer has dropped it. Needs the loraTx lock
+void abandonTxMessage(const uint16_t messageNumber, const uint8_t peer) {
+  for (int i = 0; i < TX_FRAGMENT_SLOTS; i++) {
+    TxFragment* fragment = &(txFragments[i]);
+    if (!fragment->used || fragment->messageNumber != messageNumber) continue;
+    if (fragment->destination == DATA_RATE_BROADCAST) {
+      fragment->pendingPeers[peer / 8] &= ~(1 << (peer % 8));
+      if (fragment->sendCount == 0 || txFragmentPending(i)) continue;
+    } else if (fragment->destination != peer) continue;
+    freeTxFragment(i);
+  }
 }
 
 //This function will take the data in src
@@ -1174,93 +1528,63 @@ bool addMessageToTxArray(uint8_t* src, uint16_t size, uint8_t destinationID) {
   //display.printf("addMessageToTxArray");
   //display.display();
 
-if (size > SEQUENCE_MAX_SIZE * 8) {
+if (size > MESSAGE_MAX_SIZE) {
     LWarn("Message will not be added to tx array because it is too long");
     return false;
   }
   //NOTE we should probably also check the available space in txMessageBuffer, but that would require writing a defragging function so not now
 
-  uint8_t txMessage[9];
-  txMessage[6] = 0;
-  txMessage[7] = 0;
-  txMessage[8] = 0;
+  //message numbers only go up, so receivers can tell a new message from a replayed one
+  const uint16_t messageNumber = messageNumberNext();
 
-  //Find an unused message number. First we will generate a random number
-  //Then we will look through all known message numbers. If there is a collision, we will try again
-  //If we somehow fail 10 times, then we will assume something has gone very wrong and HALT
-  bool foundNumber = false;
-  uint16_t messageNumber;
-  uint8_t attemptCount = 0;
-  while (!foundNumber) {
-    attemptCount++;
-    messageNumber = esp_random();
-    foundNumber = true;
-    
-    if (attemptCount >= 80) {
-      LError("Reached 10 attempts to find a new message number");
-      HALT();
-    }
-    
-    for (int i = 0; i < txMessageArray.size(); i++) {
-      if (messageNumber == (txMessageArray.get(i)[0] << 8) + txMessageArray.get(i)[1]) {
-        foundNumber = false;
-        break;
-      }
-    }
-    if (!foundNumber) continue;
-    for (int i = 0; i < previouslySeenIds.size(); i++) {
-      if (messageNumber == previouslySeenIds[i]) {
-        foundNumber = false;
-        break;
-      }
-    }
-    if (!foundNumber) continue;
-    for (int i = 0; i < previouslyProcessedIds.size(); i++) {
-      if (messageNumber == previouslyProcessedIds[i]) {
-        foundNumber = false;
-        break;
-      }
+  //a broadcast waits for an ACK from every peer we have heard from lately
+  uint8_t pendingPeers[32];
+  memset(&(pendingPeers[0]), 0, 32);
+  if (destinationID == DATA_RATE_BROADCAST) {
+    for (int peer = 1; peer < 255; peer++) {
+      if (peer != deviceID && dataRatePeerHeard(peer)) pendingPeers[peer / 8] |= 1 << (peer % 8);
     }
   }
 
-  txMessage[0] = messageNumber >> 8;
-  txMessage[1] = messageNumber & 0xFF;
-
   uint8_t messageLength;
   const uint8_t sequenceCount = (size % SEQUENCE_MAX_SIZE) ? 1 + (size / SEQUENCE_MAX_SIZE) : size / SEQUENCE_MAX_SIZE; 
   //now that we have the messageNumber, lets start placing in our messages.
   //iterate overall all sequences we will have to add...
   for (int i = 0; i < sequenceCount; i++) {
-    txMessage[2] = i;
     messageLength = min(size - (SEQUENCE_MAX_SIZE * i), SEQUENCE_MAX_SIZE);
     if (messageLength == 0) continue; //occures if size is a multiple of the SEQUENCE_MAX_SIZE
-    txMessage[5] = messageLength + 15 + AES_GCM_OVERHEAD;
 
-    //allocate space in txMessageBuffer
-    uint16_t addr = txMessageBuffer.malloc(messageLength + 15 + AES_GCM_OVERHEAD);
-    if (addr == 0xFFFF) {
-      LError("Failed to allocate space in txMessageBuffer");
+    //find a free slot for the fragment
+    int slot = 0;
+    while (slot < TX_FRAGMENT_SLOTS && (txFragments[slot].used || txFragments[slot].queued)) slot++;
+    if (slot == TX_FRAGMENT_SLOTS) {
+      LError("Failed to txMessage Array, no free fragment slots");
+      dropTxMessage(messageNumber);
       return false;
     }
 
-    txMessage[3] = addr >> 8;
-    txMessage[4] = addr & 0xFF;
-
-    if (!txMessageArray.add(&(txMessage[0]))) {
-      LError("Failed to txMessage Array, deleting allocation in buffer");
-      txMessageBuffer.free(addr);
+    //allocate space in txMessageBuffer
+    uint16_t addr = txMessageBuffer.malloc(messageLength + 10 + AES_GCM_OVERHEAD + FRAME_OVERHEAD);
+    if (addr == 0xFFFF) {
+      LError("Failed to allocate space in txMessageBuffer");
+      dropTxMessage(messageNumber);
       return false;
     }
 
-    LDebug("Dumped message in tx Array:");
-    Debug(dumpArrayToSerial(&(txMessage[0]), 8));
+    TxFragment* fragment = &(txFragments[slot]);
+    fragment->used = true;
+    fragment->messageNumber = messageNumber;
+    fragment->sequenceNumber = i;
+    fragment->destination = destinationID;
+    fragment->location = addr;
+    fragment->size = messageLength + 10 + AES_GCM_OVERHEAD + FRAME_OVERHEAD;
+    fragment->sendCount = 0;
+    fragment->timer = TIMER_NONE;
+    memcpy(&(fragment->pendingPeers[0]), &(pendingPeers[0]), 32);
 
     //now that we successfully added the message information to the array and the buffer, construct the message into the buffer
-    txMessageBuffer[addr] = START_BYTE;
-    txMessageBuffer[addr+1] = 0;
-    
     uint8_t uBuf[256]; 
-    //construct the encrypted part of the header into uBuf
+    //construct the header into uBuf
     uBuf[0] = deviceID;
     uBuf[1] = destinationID;
     uBuf[2] = messageNumber >> 8;
@@ -1275,48 +1599,208 @@ if (size > SEQUENCE_MAX_SIZE * 8) {
     //add the data to the buffer
     memcpy(&(uBuf[10]), &(src[SEQUENCE_MAX_SIZE * i]), messageLength);
 
-    //now that we have the data in the UBuf, encrypt it to the txMessageBuffer
-    size_t ciphertextLen;
-    if (!encryptD2DMessage(&(uBuf[0]), 10 + messageLength, &(txMessageBuffer[addr+2]), 256 - 10, &ciphertextLen)) {
+    //now that we have the data in the UBuf, encrypt it into a frame in the txMessageBuffer. The routing header at the
+    //front stays in clear
+    const uint16_t frameSize = buildFrame(&(txMessageBuffer[addr]), 0, &(uBuf[0]), 10 + messageLength);
+    if (frameSize == 0) {
       LError("Failed to encrypt message, dropping");
+      dropTxMessage(messageNumber);
       return false;
     }
 
-    //Verify that the encrypted message is the expected length. If not, then halt because something is very wrong
-    if (ciphertextLen != 10 + messageLength + AES_GCM_OVERHEAD) {
+    //Verify that the frame is the expected length. If not, then halt because something is very wrong
+    if (frameSize != messageLength + 10 + AES_GCM_OVERHEAD + FRAME_OVERHEAD) {
       LError("Encrypted TX message is not the size expected!");
       HALT();
     }
 
-    //Calculate CRC on everything above except the start byte
-    uint32_t newCrc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(txMessageBuffer[addr+1])), ciphertextLen+1))^0xffffffff; //note - this is one byte longer because it includes the start byte
-    
-    //Add calculated CRC and end bye to end of message
-    txMessageBuffer[addr+2+ciphertextLen] = newCrc >> 8;
-    txMessageBuffer[addr+3+ciphertextLen] = newCrc & 0xFF;
-    txMessageBuffer[addr+4+ciphertextLen] = END_BYTE;
-
     LDebug("Finished writing new data to tx message buffer:");
     Debug(dumpArrayToSerial(&(txMessageBuffer[0]), 10 + messageLength));
   }
   //display.printf("------ done ");
   //display.display();
+  startTxFragments(messageNumber);
   return true;
 }
 
 void enterChannelActivityDetectionMode() {
-  //NOTE - we don't seem to have a way to check if an message is actively being received. Thus, we may accidentally kick the device out of RX mode while is message is transmitting.
-  if (millis() > nextCADTime) {
+  //the radio task won't leave RX for a packet that is already coming in, it reports the channel as busy instead
+  if (awaitingReply && (int32_t) (millis() - awaitingReplyUntil) < 0) return; //CAD would take the radio out of the reply window
+  if ((int32_t) (millis() - nextCADTime) >= 0) {
     if (lastDeviceMode == RX_MODE || lastDeviceMode == IDLE_MODE) {
       lastDeviceMode = CAD_MODE;
       LLog("Entering Channel Activity Detection Mode");
-      LoRa.idle();
-      delay(5);
-      LoRa.channelActivityDetection(); 
+      //run CAD on the rate and channel the next frame is going out on, that is where it has to be clear
+      if (!radioPostCommand(RADIO_COMMAND_CAD, NULL, 0, nextFrameRate(), nextFrameChannel())) {
+        LWarn("Radio command queue is full, retrying CAD later");
+        lastDeviceMode = RX_MODE;
+      }
     }
   }
 }
 
+//millis() at which the frame ACKed by the ack buffer entry starting at entry came in
+uint32_t ackArrivalTime(uint32_t entry) {
+  return ((uint32_t) ackToSendBuffer[entry + 3] << 24) | ((uint32_t) ackToSendBuffer[entry + 4] << 16) | (ackToSendBuffer[entry + 5] << 8) | ackToSendBuffer[entry + 6];
+}
+
+//true if a reply to a frame that arrived at requestTime (millis()) can still make the sender's reply window.
+//The sender only listens for one reply per packet, so once one has gone out the other frames in that packet miss it
+bool replyWindowOpen(uint32_t requestTime) {
+  if (replySent && requestTime == lastReplyTime) return false;
+  //compared by difference, so it holds across millis() wrapping around
+  return (int32_t) (millis() - requestTime) < RADIO_REPLY_WINDOW_MS;
+}
+
+//true if the ACK at the front of the ack buffer should go out in a packet of its own: as a reply while its peer is still
+//listening for one, or once it has waited ACK_PIGGYBACK_HOLD_MS for a data frame to the peer to ride on
+bool ackDueAlone() {
+  if (ackToSendBuffer.size() == 0) return false;
+  const uint32_t rxTime = ackArrivalTime(0);
+  if (replyWindowOpen(rxTime)) return true;
+  if (ackRidesOnData()) return false;
+  return (int32_t) (millis() - rxTime) >= ACK_PIGGYBACK_HOLD_MS;
+}
+
+//true if the ACK at the front of the ack buffer can go out behind the data frame at the front of the ready to send buffer
+bool ackRidesOnData() {
+  if (ackToSendBuffer.size() == 0 || readyToSendBuffer.size() == 0) return false;
+  if (replyWindowOpen(ackArrivalTime(0))) return false;
+  return readyToSendBuffer[3] == ackToSendBuffer[0];
+}
+
+//Frame aggregation. Every packet pays for a preamble, a header, a CAD and a CRC, and every frame in it for its own IV,
+//tag and framing, which for short chat messages and ACKs costs more airtime than the message itself. So whatever is at
+//the front of the queues for the same destination goes out as one container frame (FRAME_TYPE_CONTAINER), holding the
+//message of each frame under a single IV and tag. Queued frames are kept encrypted, so they are opened again to go in.
+//Only runs of entries at the front are taken, so nothing overtakes a frame queued for another peer
+
+//adds the message of frame to the container message at *size. Returns false if there is no room left for it
+bool containerAdd(uint8_t* container, uint16_t* size, const uint8_t* frame) {
+  if (*size + CONTAINER_ENTRY_HEADER_SIZE + frame[2] - AES_GCM_OVERHEAD > CONTAINER_MESSAGE_MAX) return false;
+  size_t messageLen;
+  if (!openFrame(frame, &(container[*size + CONTAINER_ENTRY_HEADER_SIZE]), CONTAINER_MESSAGE_MAX - *size - CONTAINER_ENTRY_HEADER_SIZE, &messageLen)) {
+    LError("Failed to open queued frame to add it to a container");
+    return false;
+  }
+  container[*size] = frame[1];
+  container[*size + 1] = messageLen;
+  *size += CONTAINER_ENTRY_HEADER_SIZE + messageLen;
+  return true;
+}
+
+//adds the data frames at the front of the ready to send buffer that go to destination to the container, for as long as
+//they fit. Returns how many were taken
+uint8_t aggregateMessages(uint8_t* container, uint16_t* size, uint8_t destination) {
+  uint8_t count = 0;
+  for (uint32_t entry = 0; entry + READY_TO_SEND_ENTRY_SIZE <= readyToSendBuffer.size(); entry += READY_TO_SEND_ENTRY_SIZE) {
+    if (readyToSendBuffer[entry + 3] != destination) break;
+    const uint16_t src = (readyToSendBuffer[entry] << 8) + readyToSendBuffer[entry + 1];
+    if (!containerAdd(container, size, &(txMessageBuffer[src]))) break;
+    count++;
+  }
+  return count;
+}
+
+//same for the ACKs at the front of the ack buffer. One that can still go out as a reply is left for that
+uint8_t aggregateAcks(uint8_t* container, uint16_t* size, uint8_t destination) {
+  uint8_t count = 0;
+  for (uint32_t entry = 0; entry + ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE <= ackToSendBuffer.size(); entry += ACK_QUEUE_HEADER_SIZE + ACK_FRAME_SIZE) {
+    if (ackToSendBuffer[entry] != destination) break;
+    if (replyWindowOpen(ackArrivalTime(entry))) break;
+    uint8_t frame[ACK_FRAME_SIZE];
+    for (int i = 0; i < ACK_FRAME_SIZE; i++) frame[i] = ackToSendBuffer[entry + ACK_QUEUE_HEADER_SIZE + i];
+    if (!containerAdd(container, size, &(frame[0]))) break;
+    count++;
+  }
+  return count;
+}
+
+//millis() at which the ready to send buffer entry starting at entry was queued
+uint32_t readyToSendTime(uint32_t entry) {
+  return ((uint32_t) readyToSendBuffer[entry + 4] << 24) | ((uint32_t) readyToSendBuffer[entry + 5] << 16) | (readyToSendBuffer[entry + 6] << 8) | readyToSendBuffer[entry + 7];
+}
+
+//time left, in ms, before a peer waiting on a frame that came in or was queued at time (millis()) gives up on it and
+//sends again. Negative once that has likely happened
+int32_t txSlack(uint8_t peer, uint32_t time) {
+  return (int32_t) retransmitTimeoutBase(peer) - (int32_t) (millis() - time);
+}
+
+//Picks what goes out next once CAD has found the channel clear. ACKs and data frames are sent earliest deadline first,
+//the deadline being when whoever waits on them sends again: the peer's retransmission timeout after the frame being
+//ACKed came in, or after the data frame was queued. That way a steady stream of one can't starve the other. An ACK that
+//can still make the reply window goes before anything, and device ID frames get a turn every TX_CONTROL_INTERVAL_MS
+//even while the rest of the queue is busy
+uint8_t nextTxClass() {
+  const bool ackWaiting = ackDueAlone();
+  const bool dataWaiting = readyToSendBuffer.size() > 0;
+  const bool controlWaiting = sendDeviceIDRequest || sendDeviceIDResponse || sendDeviceIDTableRequest || sendDeviceIDTableResponse;
+  const uint32_t ackTime = ackWaiting ? ackArrivalTime(0) : 0;
+
+  if (ackWaiting && replyWindowOpen(ackTime)) return TX_CLASS_ACK;
+  if (controlWaiting && (!(ackWaiting || dataWaiting) || millis() - lastControlDispatchTime >= TX_CONTROL_INTERVAL_MS)) return TX_CLASS_CONTROL;
+  if (ackWaiting && dataWaiting) {
+    const int32_t ackSlack = txSlack(ackToSendBuffer[0], ackTime);
+    const int32_t dataSlack = txSlack(readyToSendBuffer[3], readyToSendTime(0));
+    return ackSlack <= dataSlack ? TX_CLASS_ACK : TX_CLASS_DATA;
+  }
+  if (ackWaiting) return TX_CLASS_ACK;
+  if (dataWaiting) return TX_CLASS_DATA;
+  return TX_CLASS_NONE;
+}
+
+//rate of the frame the CAD_FINISHED dispatch will pick next
+uint8_t nextFrameRate() {
+  const uint8_t txClass = nextTxClass();
+  if (txClass == TX_CLASS_ACK) {
+    if (replyWindowOpen(ackArrivalTime(0))) return ackToSendBuffer[1];
+    return dataRateFor(ackToSendBuffer[0]);
+  }
+  if (txClass == TX_CLASS_DATA) return dataRateFor(readyToSendBuffer[3]);
+  return DATA_RATE_DEFAULT;
+}
+
+//channel of the frame the CAD_FINISHED dispatch will pick next
+uint8_t nextFrameChannel() {
+  const uint8_t txClass = nextTxClass();
+  if (txClass == TX_CLASS_ACK) {
+    if (replyWindowOpen(ackArrivalTime(0))) return ackToSendBuffer[2];
+    return channelFor(ackToSendBuffer[0]);
+  }
+  if (txClass == TX_CLASS_DATA) return channelFor(readyToSendBuffer[3]);
+  return CHANNEL_RENDEZVOUS;
+}
+
+//hands a finished frame to the radio task at the data rate and power negotiated with destination, on its home channel.
+//Only valid right after CAD has finished
+//If replyLength is set, the radio task listens for a reply of that size (an ACK) in the reply window once it is sent
+void transmitFrame(const uint8_t* data, uint16_t size, uint8_t destination, uint8_t replyLength) {
+  const uint8_t rate = dataRateFor(destination);
+  if (radioPostCommand(RADIO_COMMAND_TRANSMIT, data, size, rate, channelFor(destination), dataRatePreambleFor(destination, rate), false, replyLength, txPowerFor(destination))) {
+    lastDeviceMode = TX_MODE;
+    replyExpected = replyLength > 0;
+    replyRate = rate;
+  } else {
+    LError("Radio command queue is full, frame was not sent");
+    radioPostCommand(RADIO_COMMAND_RECEIVE);
+    lastDeviceMode = RX_MODE;
+  }
+}
+
+//sends a fixed size reply without a LoRa header, at the rate and on the channel the frame it answers came in on. The other
+//end is sitting in RX waiting for exactly this, so the normal preamble is enough
+void transmitReply(const uint8_t* data, uint16_t size, uint8_t destination, uint8_t rate, uint8_t channel) {
+  if (radioPostCommand(RADIO_COMMAND_TRANSMIT, data, size, rate, channel, DATA_RATE_PREAMBLE_MARGIN, true, 0, txPowerFor(destination))) {
+    lastDeviceMode = TX_MODE;
+    replyExpected = false;
+  } else {
+    LError("Radio command queue is full, frame was not sent");
+    radioPostCommand(RADIO_COMMAND_RECEIVE);
+    lastDeviceMode = RX_MODE;
+  }
+}
+
 bool sendDeviceIDTableRequestFunc(uint8_t targetDeviceID) {
   LDebug("Request to send device id table request");
   static uint32_t lastSendTime = 0;
@@ -1335,23 +1819,13 @@ bool sendDeviceIDTableRequestFunc(uint8_t targetDeviceID) {
   pBuf[3] = (timestamp >> 8) & 0xFF;
   pBuf[4] = timestamp & 0xFF;
 
-  //encrypt the buffer
-  size_t ciphertextLen;
-  if (encryptD2DMessage(&(pBuf[0]), 5, &(deviceIDTableRequestBuffer[2]), 5 + AES_GCM_OVERHEAD, &ciphertextLen)) {
-    LDebug("Successfully encrypted device id table request message content");
+  //encrypt the buffer and frame it
+  if (buildFrame(&(deviceIDTableRequestBuffer[0]), 4, &(pBuf[0]), 5) == DEVICE_ID_FRAME_SIZE) {
+    LDebug("Successfully built device id table request frame");
   } else {
-    LError("Failed to encrypt device id table request message content");
+    LError("Failed to build device id table request frame");
     HALT();
   }
-  if (ciphertextLen != 5 + AES_GCM_OVERHEAD) {
-    LError("Unexpected ciphertext length");
-    return false;
-  }
-
-  //calculate the crc
-  uint32_t newCrc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(deviceIDTableRequestBuffer[1])), 6 + AES_GCM_OVERHEAD))^0xffffffff;
-  deviceIDTableResponseBuffer[7 + AES_GCM_OVERHEAD] = (newCrc & 0x0000FF00) >> 8;
-  deviceIDTableResponseBuffer[8 + AES_GCM_OVERHEAD] = newCrc & 0x000000FF;
 
   //set the send flag to true
   sendDeviceIDTableRequest = true;
@@ -1368,22 +1842,13 @@ bool sendDeviceIDResponseFunc() {
   pBuf[3] = (t >> 8) & 0xFF;
   pBuf[4] = (t) & 0xFF;
   
-  //encrypt message contents
-  size_t ciphertextLen;
-  if (encryptD2DMessage(&(pBuf[0]), 5, &(deviceIDResponseBuffer[2]), 5 + AES_GCM_OVERHEAD, &ciphertextLen)) {
-    LDebug("Successfully encrypted device id response message content");
+  //encrypt the buffer and frame it
+  if (buildFrame(&(deviceIDResponseBuffer[0]), 3, &(pBuf[0]), 5) == DEVICE_ID_FRAME_SIZE) {
+    LDebug("Successfully built device id response frame");
   } else {
-    LError("Failed to encrypt device id response message content");
+    LError("Failed to build device id response frame");
     HALT();
   }
-  if (ciphertextLen != 5 + AES_GCM_OVERHEAD) {
-    LError("Unexpected ciphertext length");
-  }
-
-  //Calculate CRC on everything after the start byte
-  uint32_t newCrc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(deviceIDResponseBuffer[1])), 6 + AES_GCM_OVERHEAD))^0xffffffff;
-  deviceIDResponseBuffer[7 + AES_GCM_OVERHEAD] = (newCrc & 0x0000FF00) >> 8;
-  deviceIDResponseBuffer[8 + AES_GCM_OVERHEAD] = newCrc & 0x000000FF;
 
   //Now that the message is ready to dispatch, set the flag
   sendDeviceIDResponse = true;
@@ -1404,23 +1869,13 @@ bool sendDeviceIDRequestFunc() {
   pBuf[3] = (timestamp >> 8) & 0xFF;
   pBuf[4] = timestamp & 0xFF;
 
-  //encrypt the buffer
-  size_t ciphertextLen;
-  if (encryptD2DMessage(&(pBuf[0]), 5, &(deviceIDRequestBuffer[2]), 5 + AES_GCM_OVERHEAD, &ciphertextLen)) {
-    LDebug("Successfully encrypted device id request message content");
+  //encrypt the buffer and frame it
+  if (buildFrame(&(deviceIDRequestBuffer[0]), 2, &(pBuf[0]), 5) == DEVICE_ID_FRAME_SIZE) {
+    LDebug("Successfully built device id request frame");
   } else {
-    LError("Failed to encrypt device id request message content");
+    LError("Failed to build device id request frame");
     HALT();
   }
-  if (ciphertextLen != 5 + AES_GCM_OVERHEAD) {
-    LError("Unexpected ciphertext length");
-    return false;
-  }
-
-  //calculate the crc
-  uint32_t newCrc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), (const uint8_t*)(&(deviceIDRequestBuffer[1])), 6 + AES_GCM_OVERHEAD))^0xffffffff;
-  deviceIDRequestBuffer[7 + AES_GCM_OVERHEAD] = (newCrc & 0x0000FF00) >> 8;
-  deviceIDRequestBuffer[8 + AES_GCM_OVERHEAD] = newCrc & 0x000000FF;
 
   //set the send flag to true
   sendDeviceIDRequest = true;
@@ -1432,28 +1887,9 @@ void enterReceiveMode() {
   if (lastDeviceMode == IDLE_MODE) {
     lastDeviceMode = RX_MODE;
     LLog("Entering Receive Mode");
-    LoRa.receive();
+    radioPostCommand(RADIO_COMMAND_RECEIVE);
   }
 }
-void onCadDone(bool detectedSignal) {
-  //LDebug("Cad Finished");
-  if (detectedSignal) {
-    nextCADTime = MIN_CAD_WAIT_INTERVAL_MS * ((esp_random() % 10) + 1);
-    lastDeviceMode = CAD_FAILED;
-  } else {
-    lastDeviceMode = CAD_FINISHED;
-  }
-  return;
-}
-void onTxDone() {
-  lastDeviceMode = RX_MODE;
-  LoRa.receive();
-  return;
-}
-
-void onReceive(int size) {
-  receiveReady = true;
-}
 
 void Log(LOG_LEVEL level, const char* text) {
   if (level <= CURRENT_LOG_LEVEL) {
@@ -113,8 +113,8 @@ void runTests() { //TODO write unit tests for the arrays types
 }
 
 //This is a temporary implementation. All this will do is assert the buffer is big enough, copy over the plain text, and then add random data as the cipher overhead
-bool encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen) {
-  return sec_encryptD2DMessage(plaintext, plaintextLen, ciphertextBuffer, bufferSize, ciphertextLen);
+bool encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen, const uint8_t* aad, size_t aadLen) {
+  return sec_encryptD2DMessage(plaintext, plaintextLen, ciphertextBuffer, bufferSize, ciphertextLen, aad, aadLen);
   //the outputsize will just be the plaintext size plus the overhead
   //if (bufferSize < plaintextLen + AES_GCM_OVERHEAD) return false;
   //memcpy(ciphertextBuffer, plaintext, plaintextLen);
@@ -124,11 +124,65 @@ bool encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* c
 }
 
 //This is a temporary implementation. All this will do is assert the buffer is big enough and copy over the plain text excluding the overhead
-bool decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen) {
-  return sec_decryptD2DMessage(ciphertext, ciphertextLen, plaintextBuffer, bufferSize, plaintextLen);
+bool decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen, const uint8_t* aad, size_t aadLen) {
+  return sec_decryptD2DMessage(ciphertext, ciphertextLen, plaintextBuffer, bufferSize, plaintextLen, aad, aadLen);
   //if (ciphertextLen - AES_GCM_OVERHEAD < 1) return false;
   //if (ciphertextLen - AES_GCM_OVERHEAD > bufferSize) return false;
   //memcpy(plaintextBuffer, ciphertext, ciphertextLen - AES_GCM_OVERHEAD);
   //*plaintextLen = ciphertextLen - AES_GCM_OVERHEAD;
   //return true;
 }
+
+//CRC of a frame, over the type, the length and the payload
+uint16_t frameCrc(const uint8_t* frame, uint8_t payloadLen) {
+  uint32_t crc = (~esp_rom_crc32_le((uint32_t)~(0xffffffff), &(frame[1]), FRAME_HEADER_SIZE - 1 + payloadLen))^0xffffffff;
+  return crc & 0xFFFF;
+}
+
+//how much of the front of a message of this type is sent in clear
+uint8_t frameRoutingSize(uint8_t type) {
+  return type <= 1 || type == FRAME_TYPE_CONTAINER ? ROUTING_HEADER_SIZE : 0;
+}
+
+//Builds a frame carrying message. Its routing header (if the type has one) goes in clear and the rest is encrypted, with
+//everything in clear after the start byte as additional data. Returns the frame size, 0 if the message didn't fit or
+//encryption failed
+uint16_t buildFrame(uint8_t* frame, uint8_t type, const uint8_t* message, uint8_t messageLen) {
+  const uint8_t routingSize = frameRoutingSize(type);
+  if (messageLen < routingSize || messageLen + AES_GCM_OVERHEAD > FRAME_MAX_PAYLOAD) return 0;
+  const uint8_t payloadLen = messageLen + AES_GCM_OVERHEAD;
+  frame[0] = START_BYTE;
+  frame[1] = type;
+  frame[2] = payloadLen;
+  memcpy(&(frame[FRAME_HEADER_SIZE]), message, routingSize);
+
+  size_t ciphertextLen;
+  if (!encryptD2DMessage(&(message[routingSize]), messageLen - routingSize, &(frame[FRAME_HEADER_SIZE + routingSize]),
+                         payloadLen - routingSize, &ciphertextLen, &(frame[1]), FRAME_HEADER_SIZE - 1 + routingSize)) {
+    return 0;
+  }
+  if (ciphertextLen != (size_t) (payloadLen - routingSize)) return 0;
+
+  const uint16_t crc = frameCrc(frame, payloadLen);
+  frame[FRAME_HEADER_SIZE + payloadLen] = crc >> 8;
+  frame[FRAME_HEADER_SIZE + payloadLen + 1] = crc & 0xFF;
+  frame[FRAME_HEADER_SIZE + payloadLen + 2] = END_BYTE;
+  return payloadLen + FRAME_OVERHEAD;
+}
+
+//Authenticates a frame that passed its CRC and decrypts it back into the message it was built from. Returns false if
+//anything, cleartext included, doesn't match the tag
+bool openFrame(const uint8_t* frame, uint8_t* messageBuffer, size_t bufferSize, size_t* messageLen) {
+  const uint8_t routingSize = frameRoutingSize(frame[1]);
+  const uint8_t payloadLen = frame[2];
+  if (payloadLen < routingSize + AES_GCM_OVERHEAD || bufferSize < routingSize) return false;
+  memcpy(messageBuffer, &(frame[FRAME_HEADER_SIZE]), routingSize);
+
+  size_t plaintextLen;
+  if (!decryptD2DMessage(&(frame[FRAME_HEADER_SIZE + routingSize]), payloadLen - routingSize, &(messageBuffer[routingSize]),
+                         bufferSize - routingSize, &plaintextLen, &(frame[1]), FRAME_HEADER_SIZE - 1 + routingSize)) {
+    return false;
+  }
+  *messageLen = routingSize + plaintextLen;
+  return true;
+}
@@ -2,15 +2,44 @@
 
 #define CURRENT_LOG_LEVEL LOG_LEVEL_DEBUG
 
-#define LORA_RX_BUFFER_SIZE 1024
+#define LORA_RX_QUEUE_LENGTH 4 //received packets waiting to be parsed
+#define RX_REASSEMBLY_TABLE_SIZE 32 //messages being reassembled at once, power of two. Keep it a few times the rxMessageBuffer allocation limit
 #define LORA_TX_BUFFER_SIZE 1024
-#define MIN_CAD_WAIT_INTERVAL_MS 1
+#define CAD_BACKOFF_SLOT_MS 10 //a busy channel delays the next CAD by a random number of these
+#define CAD_BACKOFF_MAX_EXPONENT 6 //the backoff window doubles with every busy CAD in a row, up to 2^this slots
 #define LORA_READY_TO_SEND_BUFFER_SIZE 1024
+#define READY_TO_SEND_ENTRY_SIZE 8 //allocation in txMessageBuffer, frame size, destination, time it was queued (millis())
+#define TX_CONTROL_INTERVAL_MS 1000 //device ID frames get a turn at most this often while ACKs or data are waiting
+//what the TX scheduler picks to send next
+#define TX_CLASS_NONE 0
+#define TX_CLASS_ACK 1
+#define TX_CLASS_DATA 2
+#define TX_CLASS_CONTROL 3
 #define LORA_ACK_BUFFER_SIZE 256
 #define LORA_SEND_COUNT_MAX 8
 #define SERIAL_READY_TO_SEND_BUFFER_SIZE 128
+//debug logging for one frame coming in takes longer to drain at 115200 baud than a reply has to start in (see
+//RADIO_REPLY_WINDOW_MS), so the log UART buffers that much rather than blocking loop() until the bytes are out
+#define LOG_TX_BUFFER_SIZE 8192
 #define SEQUENCE_MAX_SIZE 128
+#define SEQUENCE_MAX_COUNT 32 //fragments a message can be split into. At most 32, ACKs carry one bit for each
+#define MESSAGE_MAX_SIZE (SEQUENCE_MAX_SIZE * SEQUENCE_MAX_COUNT)
+#define RX_MESSAGE_BUFFER_SIZE 16384 //room for a few full size messages being reassembled
+#define TX_MESSAGE_BUFFER_SIZE 16384
+#define TX_MESSAGE_BUFFER_ALLOCATIONS 128 //every fragment frame is its own allocation
+//fragments of one message sent ahead of their ACK. ACKs come back in the reply window right after the frame, which
+//only works if the sender listens for it instead of going on to the next fragment
+#define TX_FRAGMENT_WINDOW 1
+#define TX_FRAGMENT_SLOTS TX_MESSAGE_BUFFER_ALLOCATIONS //fragments waiting to be sent or ACKed, each holds an allocation
+#define RX_REASSEMBLY_TIMEOUT_MS 10000 //a message is dropped once this long has gone by without a new fragment
+#define TIMER_WHEEL_SLOTS 256 //power of two
+#define TIMER_WHEEL_TICK_SHIFT 4 //ticks of 16 ms, so one turn of the wheel is about 4 seconds
 #define API_CODE_STACK_SIZE 1024 * 8
+#define API_SERIAL_POLL_MS 1000 //how often the API task looks for packets from the host
+#define RADIO_TASK_STACK_SIZE 1024 * 4
+#define RADIO_TASK_PRIORITY (configMAX_PRIORITIES - 1)
+#define RADIO_EVENT_QUEUE_LENGTH 8
+#define RADIO_COMMAND_QUEUE_LENGTH 4
 
 #define IDLE_MODE 1
 #define RX_MODE 2
@@ -36,6 +65,31 @@
 #define END_BYTE 0x8c
 
 #define AES_GCM_OVERHEAD 20
+#define FRAME_HEADER_SIZE 3 //start byte, type, payload length
+#define FRAME_OVERHEAD (FRAME_HEADER_SIZE + 3) //header, crc16 and end byte
+#define FRAME_MAX_PAYLOAD (255 - FRAME_OVERHEAD) //a frame has to fit in one LoRa packet
+//data and ACK messages start with sender, receiver, message number and sequence number. That goes in clear so frames
+//for other nodes, and duplicates, can be dropped without decrypting them, but the GCM tag still covers it
+#define ROUTING_HEADER_SIZE 5
+//frames going to the same destination can go out together in one container frame (see containerAdd()). Its message is
+//a routing header with just the sender and receiver set, then for each frame its type, its message length and message
+#define FRAME_TYPE_CONTAINER 6
+#define CONTAINER_ENTRY_HEADER_SIZE 2
+#define CONTAINER_MESSAGE_MAX (FRAME_MAX_PAYLOAD - AES_GCM_OVERHEAD)
+#define ACK_PLAINTEXT_SIZE 17 //routing header, timestamp, requested data rate, listen mask, SNR, RSSI, received fragments
+#define ACK_ALL_FRAGMENTS 0xFFFFFFFF //received fragments of a message that has already been delivered. None means it was dropped
+#define ACK_FRAME_SIZE (ACK_PLAINTEXT_SIZE + AES_GCM_OVERHEAD + FRAME_OVERHEAD)
+#define DEVICE_ID_FRAME_SIZE (5 + AES_GCM_OVERHEAD + FRAME_OVERHEAD) //device ID request, response and table request
+#define DEVICE_ID_TABLE_FRAME_SIZE (36 + AES_GCM_OVERHEAD + FRAME_OVERHEAD)
+#define ACK_QUEUE_HEADER_SIZE 7 //destination, then the rate, channel and arrival time (millis()) of the frame being ACKed
+//broadcasts are ACKed by everyone that heard them. Each receiver waits for the fragments to stop coming, then for its
+//own slot (device ID % GROUP_ACK_SLOTS), so the sender doesn't get every ACK at once
+#define GROUP_ACK_QUEUE_LENGTH 8 //broadcast messages waiting for us to ACK them
+#define GROUP_ACK_DELAY_MS 300
+#define GROUP_ACK_SLOTS 16
+#define GROUP_ACK_SLOT_MS 100 //about one ACK frame on air at the default rate
+#define GROUP_ACK_UNICAST_MAX 3 //peers still missing a broadcast fragment get a copy each instead once there are this few
+#define ACK_PIGGYBACK_HOLD_MS 250 //an ACK that missed the reply window waits this long for a data frame to the peer to ride on
 
 #define RUN_UNIT_TESTS false
 
@@ -62,5 +116,9 @@ enum LOG_LEVEL {LOG_LEVEL_NONE, LOG_LEVEL_ERROR, LOG_LEVEL_WARNING, LOG_LEVEL_LO
 void Log(LOG_LEVEL level, const char* text);
 const char* logLevelEnumToChar(LOG_LEVEL level);
 void runTests();
-bool encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen);
-bool decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen);
\ No newline at end of file
+bool encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen, const uint8_t* aad = NULL, size_t aadLen = 0);
+bool decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen, const uint8_t* aad = NULL, size_t aadLen = 0);
+uint16_t frameCrc(const uint8_t* frame, uint8_t payloadLen);
+uint8_t frameRoutingSize(uint8_t type);
+uint16_t buildFrame(uint8_t* frame, uint8_t type, const uint8_t* message, uint8_t messageLen);
+bool openFrame(const uint8_t* frame, uint8_t* messageBuffer, size_t bufferSize, size_t* messageLen);
\ No newline at end of file
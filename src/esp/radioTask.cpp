@@ -0,0 +1,364 @@
+#include "radioTask.h"
+
+StackType_t radioStack[RADIO_TASK_STACK_SIZE];
+StaticTask_t radioStackBuffer;
+TaskHandle_t radioTaskHandle = NULL;
+
+//radio task -> loop()
+uint8_t radioEventQueueStorage[RADIO_EVENT_QUEUE_LENGTH * sizeof(RadioEvent)];
+StaticQueue_t radioEventQueueBuffer;
+QueueHandle_t radioEventQueue = NULL;
+
+//loop() -> radio task
+uint8_t radioCommandQueueStorage[RADIO_COMMAND_QUEUE_LENGTH * sizeof(RadioCommand)];
+StaticQueue_t radioCommandQueueBuffer;
+QueueHandle_t radioCommandQueue = NULL;
+
+uint32_t radioDroppedEvents = 0;
+
+//event being filled in by the radio task. Only ever touched from the radio task, so it can live outside its stack
+static RadioEvent pendingEvent;
+
+static void radioPostEvent(RadioEvent* event) {
+  if (xQueueSend(radioEventQueue, event, 0) != pdTRUE) {
+    radioDroppedEvents++;
+  }
+}
+
+void radioTaskInit() {
+  radioEventQueue = xQueueCreateStatic(RADIO_EVENT_QUEUE_LENGTH, sizeof(RadioEvent), radioEventQueueStorage, &radioEventQueueBuffer);
+  radioCommandQueue = xQueueCreateStatic(RADIO_COMMAND_QUEUE_LENGTH, sizeof(RadioCommand), radioCommandQueueStorage, &radioCommandQueueBuffer);
+
+  radioTaskHandle = xTaskCreateStaticPinnedToCore(
+    radioTask,
+    "RADIO",
+    RADIO_TASK_STACK_SIZE,
+    (void*) 1,
+    RADIO_TASK_PRIORITY,
+    radioStack,
+    &radioStackBuffer,
+    1
+  );
+
+  //From here on the DIO0 ISR only wakes the radio task, the callbacks below run in its context
+  LoRa.setInterruptTask(radioTaskHandle, RADIO_NOTIFY_DIO0);
+  LoRa.onTxDone(onTxDone);
+  LoRa.onCadDone(onCadDone);
+  LoRa.onReceive(onReceive);
+}
+
+bool radioPostCommand(uint8_t type, const uint8_t* data, uint16_t size, uint8_t dataRate, uint8_t channel, uint16_t preambleLength, bool implicitHeader, uint8_t replyLength, int8_t txPower) {
+  RadioCommand command;
+  if (size > sizeof(command.data)) return false;
+  command.type = type;
+  command.dataRate = dataRate;
+  command.channel = channel;
+  command.preambleLength = preambleLength;
+  command.implicitHeader = implicitHeader;
+  command.replyLength = replyLength;
+  command.txPower = txPower;
+  command.size = size;
+  if (size > 0) memcpy(&(command.data[0]), data, size);
+
+  if (xQueueSend(radioCommandQueue, &command, 0) != pdTRUE) {
+    return false;
+  }
+  xTaskNotify(radioTaskHandle, RADIO_NOTIFY_COMMAND, eSetBits);
+  return true;
+}
+
+bool radioGetEvent(RadioEvent* event) {
+  return xQueueReceive(radioEventQueue, event, 0) == pdTRUE;
+}
+
+uint32_t radioReplyWindowMs(uint8_t rate) {
+  //the reply has to start within the window, and its preamble has to be on the air long enough for the modem to find it
+  return RADIO_REPLY_WINDOW_MS + (dataRateSymbolTimeUs(rate) * DATA_RATE_PREAMBLE_MARGIN) / 1000 + 1;
+}
+
+//Receive state, only touched from the radio task
+static uint8_t currentRate = DATA_RATE_DEFAULT; //rate the modem is configured for
+static uint8_t currentChannel = CHANNEL_RENDEZVOUS; //channel the modem is tuned to
+static int8_t currentTxPower = TX_POWER_MAX; //dBm the PA is set to
+static bool scanning = false; //listening by hopping CAD across rates and channels
+static bool cadForTransmit = false; //the running CAD was asked for by loop() before a transmit, not part of the scan
+static uint8_t scanHop = DATA_RATE_DEFAULT; //a rate on our home channel, or RADIO_HOP_RENDEZVOUS
+static bool dwelling = false; //a scan or reply window is waiting for a packet
+static uint32_t dwellUntil = 0; //millis() at which it gives up
+static uint8_t pendingReplyLength = 0; //reply the frame being transmitted asks for
+static bool awaitingReply = false; //dwelling in implicit header mode for a reply instead of for a scan hit
+static bool inRx = false; //the modem was last put in RX, as opposed to CAD, TX, standby or sleep
+static bool visiting = false; //away from our home channel for a look at the rendezvous one
+static uint32_t visitDue = 0; //millis() at which the next look at the rendezvous channel is due
+
+static void radioSetRate(uint8_t rate) {
+  if (rate == currentRate) return;
+  //the modem has to be in standby to be reconfigured. Both setters only touch the SPI bus for registers that actually change
+  LoRa.idle();
+  LoRa.setSpreadingFactor(dataRates[rate].spreadingFactor);
+  LoRa.setSignalBandwidth(dataRates[rate].bandwidth);
+  currentRate = rate;
+}
+
+static void radioSetChannel(uint8_t channel) {
+  if (channel == currentChannel) return;
+  LoRa.idle();
+  LoRa.setFrequency(channelFrequency(channel));
+  currentChannel = channel;
+}
+
+//bit n is rate n on our home channel. The rendezvous channel is not one of them, it gets a visit every
+//CHANNEL_RENDEZVOUS_VISIT_MS instead (see radioVisit())
+static uint8_t radioListenHops() {
+  return dataRateListenMask;
+}
+
+//true if we live on a channel of the plan and it is time to look in on the rendezvous channel
+static bool radioVisitDue() {
+  if (channelHome == CHANNEL_RENDEZVOUS) return false;
+  return (int32_t) (millis() - visitDue) >= 0;
+}
+
+static void radioTuneHop(uint8_t hop) {
+  if (hop == RADIO_HOP_RENDEZVOUS) {
+    radioSetChannel(CHANNEL_RENDEZVOUS);
+    radioSetRate(DATA_RATE_DEFAULT);
+  } else {
+    radioSetChannel(channelHome);
+    radioSetRate(hop);
+  }
+}
+
+//one CAD on the rendezvous channel. Frames sent there have a preamble long enough to still be on the air by then
+static void radioVisit() {
+  visiting = true;
+  visitDue = millis() + CHANNEL_RENDEZVOUS_VISIT_MS;
+  radioTuneHop(RADIO_HOP_RENDEZVOUS);
+  inRx = false;
+  LoRa.channelActivityDetection();
+}
+
+static void radioScanNext() {
+  if (radioVisitDue()) {
+    radioVisit();
+    return;
+  }
+  const uint8_t hops = radioListenHops();
+  do {
+    scanHop = (scanHop + 1) % DATA_RATE_COUNT;
+  } while (!(hops & (1 << scanHop)));
+  radioTuneHop(scanHop);
+  inRx = false;
+  LoRa.channelActivityDetection();
+}
+
+static void radioDwell() {
+  const uint32_t symbol = dataRateSymbolTimeUs(currentRate);
+  dwellUntil = millis() + (symbol * DATA_RATE_PREAMBLE_MARGIN) / 1000 + 1;
+  dwelling = true;
+}
+
+//go back to listening: plain RX if there is only one rate to listen on, otherwise start hopping
+static void radioListen() {
+  const uint8_t hops = radioListenHops();
+  dwelling = false;
+  awaitingReply = false;
+  cadForTransmit = false;
+  visiting = false;
+  if ((hops & (hops - 1)) == 0) {
+    scanning = false;
+    for (uint8_t hop = 0; hop < DATA_RATE_COUNT; hop++) {
+      if (hops & (1 << hop)) radioTuneHop(hop);
+    }
+    LoRa.receive();
+    inRx = true;
+    return;
+  }
+  scanning = true;
+  radioScanNext();
+}
+
+//a scan hop found something and we have been sitting in RX on its rate for a while
+static void radioDwellExpired() {
+  //as long as the modem still detects a signal, is synchronized to one or has a valid header, keep checking back
+  if (LoRa.modemStatus() & 0x0B) {
+    radioDwell();
+    return;
+  }
+  if (awaitingReply || visiting) {
+    radioListen();
+    return;
+  }
+  dwelling = false;
+  radioScanNext();
+}
+
+//true if the modem is in RX and has found a preamble or is partway through a packet
+static bool radioReceiving() {
+  if (!inRx) return false;
+  //signal detected, signal synchronized, header info valid
+  return LoRa.modemStatus() & 0x0B;
+}
+
+//sitting in plain RX on our home channel and the visit to the rendezvous channel came due. A packet being received
+//right now is worth more than the look, so that waits for it
+static void radioVisitFromRx() {
+  if (radioReceiving()) {
+    visitDue = millis() + (dataRateSymbolTimeUs(currentRate) * DATA_RATE_PREAMBLE_MARGIN) / 1000 + 1;
+    return;
+  }
+  radioVisit();
+}
+
+static void radioExecuteCommand(const RadioCommand* command) {
+  if (command->type == RADIO_COMMAND_CAD && radioReceiving()) {
+    //leaving RX now would throw away the packet, and the channel is busy anyway
+    pendingEvent.type = RADIO_EVENT_CAD_DONE;
+    pendingEvent.cadDetected = true;
+    pendingEvent.size = 0;
+    pendingEvent.timestamp = millis();
+    radioPostEvent(&pendingEvent);
+    return;
+  }
+
+  scanning = false;
+  dwelling = false;
+  awaitingReply = false;
+  cadForTransmit = false;
+  visiting = false;
+  inRx = false;
+  pendingReplyLength = 0;
+  switch (command->type) {
+    case RADIO_COMMAND_RECEIVE:
+      radioListen();
+      break;
+    case RADIO_COMMAND_CAD:
+      LoRa.idle();
+      radioSetChannel(command->channel);
+      radioSetRate(command->dataRate);
+      cadForTransmit = true;
+      LoRa.channelActivityDetection();
+      break;
+    case RADIO_COMMAND_TRANSMIT:
+      radioSetChannel(command->channel);
+      radioSetRate(command->dataRate);
+      LoRa.setPreambleLength(command->preambleLength);
+      if (command->txPower != currentTxPower) {
+        LoRa.setTxPower(command->txPower);
+        currentTxPower = command->txPower;
+      }
+      pendingReplyLength = command->replyLength;
+      LoRa.beginPacket(command->implicitHeader);
+      LoRa.write(&(command->data[0]), command->size);
+      LoRa.endPacket(true);
+      break;
+    case RADIO_COMMAND_IDLE:
+      LoRa.idle();
+      break;
+    case RADIO_COMMAND_SLEEP:
+      LoRa.sleep();
+      break;
+  }
+}
+
+void radioTask( void* params ) {
+  (void) params; //FreeRTOS task signature, nothing is passed in
+  static RadioCommand command;
+  uint32_t notification;
+  while (1) {
+    TickType_t wait = portMAX_DELAY;
+    //plain RX on our home channel only wakes up for the next visit to the rendezvous channel
+    const bool visitFromRx = !dwelling && !scanning && inRx && channelHome != CHANNEL_RENDEZVOUS;
+    if (dwelling || visitFromRx) {
+      //compared by difference, so it holds across millis() wrapping around
+      const int32_t left = (int32_t) ((dwelling ? dwellUntil : visitDue) - millis());
+      wait = left > 0 ? pdMS_TO_TICKS(left) : 0;
+    }
+    if (xTaskNotifyWait(0, 0xFFFFFFFF, &notification, wait) != pdTRUE) {
+      if (dwelling) {
+        radioDwellExpired();
+      } else if (visitFromRx) {
+        radioVisitFromRx();
+      }
+      continue;
+    }
+
+    //service the modem first so a finished RX or CAD is never held behind a queued command
+    if (notification & RADIO_NOTIFY_DIO0) {
+      LoRa.handleDio0Rise();
+    }
+
+    while (xQueueReceive(radioCommandQueue, &command, 0) == pdTRUE) {
+      radioExecuteCommand(&command);
+    }
+  }
+}
+
+//The LoRa callbacks below are called by handleDio0Rise(), which now only ever runs in the radio task
+
+void onCadDone(bool detectedSignal) {
+  if (!cadForTransmit) {
+    //one hop of the receive scan or a visit. On a hit, stay there for as long as the modem keeps seeing the signal
+    if (!scanning && !visiting) return;
+    if (detectedSignal) {
+      LoRa.receive();
+      inRx = true;
+      radioDwell();
+    } else if (visiting) {
+      radioListen();
+    } else {
+      radioScanNext();
+    }
+    return;
+  }
+  cadForTransmit = false;
+
+  //if something is on the air, go straight back to listening instead of waiting for loop() to notice
+  if (detectedSignal) {
+    radioListen();
+  }
+  pendingEvent.type = RADIO_EVENT_CAD_DONE;
+  pendingEvent.cadDetected = detectedSignal;
+  pendingEvent.size = 0;
+  pendingEvent.timestamp = millis();
+  radioPostEvent(&pendingEvent);
+}
+
+void onTxDone() {
+  if (pendingReplyLength > 0) {
+    //the reply comes back on the rate we just sent on, without a header, so listen for exactly that
+    LoRa.receive(pendingReplyLength);
+    inRx = true;
+    scanning = false;
+    awaitingReply = true;
+    dwellUntil = millis() + radioReplyWindowMs(currentRate);
+    dwelling = true;
+    pendingReplyLength = 0;
+  } else {
+    radioListen();
+  }
+  pendingEvent.type = RADIO_EVENT_TX_DONE;
+  pendingEvent.size = 0;
+  pendingEvent.timestamp = millis();
+  radioPostEvent(&pendingEvent);
+}
+
+void onReceive(int size) {
+  //pull the packet out of the FIFO right away along with its link quality
+  pendingEvent.type = RADIO_EVENT_RX;
+  pendingEvent.size = LoRa.readBytes(&(pendingEvent.data[0]), min(size, (int) sizeof(pendingEvent.data)));
+  pendingEvent.rssi = LoRa.packetRssi();
+  pendingEvent.snr = LoRa.packetSnr();
+  pendingEvent.dataRate = currentRate;
+  pendingEvent.channel = currentChannel;
+  pendingEvent.timestamp = millis();
+  radioPostEvent(&pendingEvent);
+
+  //a scan, visit or reply window only dropped into RX for this one packet
+  if (awaitingReply || visiting) {
+    radioListen();
+  } else if (scanning) {
+    dwelling = false;
+    radioScanNext();
+  }
+}
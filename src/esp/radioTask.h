@@ -0,0 +1,69 @@
+#ifndef RADIOTASK_H
+#define RADIOTASK_H
+
+#include "functions.h"
+#include "dataRate.h"
+#include "channelPlan.h"
+#include "txPower.h"
+
+//The radio task owns every SPI access to the LoRa module once it has been started.
+//loop() talks to it through radioPostCommand(), and it reports back through radioGetEvent()
+//Listening covers every rate in dataRateListenMask on our home channel: with more than one of those, the task hops CAD
+//across them and only drops into RX where it found a preamble, otherwise it sits in RX. While hopping is active (see
+//channelPlan.h) it also leaves the home channel every CHANNEL_RENDEZVOUS_VISIT_MS for one CAD on the rendezvous channel
+//A transmit can ask for a reply window: the task then waits in implicit header mode for a frame of a known length,
+//on the same rate, for RADIO_REPLY_WINDOW_MS (see radioReplyWindowMs()). ACKs sent inside that window skip the
+//LoRa header, anything later goes out with a header as usual
+
+#define RADIO_NOTIFY_DIO0 0x01
+#define RADIO_NOTIFY_COMMAND 0x02
+
+#define RADIO_EVENT_RX 0
+#define RADIO_EVENT_TX_DONE 1
+#define RADIO_EVENT_CAD_DONE 2
+
+#define RADIO_COMMAND_RECEIVE 0
+#define RADIO_COMMAND_CAD 1
+#define RADIO_COMMAND_TRANSMIT 2
+#define RADIO_COMMAND_IDLE 3
+#define RADIO_COMMAND_SLEEP 4
+
+//longest a reply can take to start after the frame it answers, CAD included. Only holds with the log UART buffered (see
+//LOG_TX_BUFFER_SIZE), writing out debug logging alone takes longer than this
+#define RADIO_REPLY_WINDOW_MS 25
+#define RADIO_HOP_RENDEZVOUS DATA_RATE_COUNT //hop for the default rate on the rendezvous channel, after the rate hops
+
+struct RadioEvent {
+  uint8_t type;
+  bool cadDetected; //only valid for RADIO_EVENT_CAD_DONE
+  uint16_t size;
+  int16_t rssi;
+  float snr;
+  uint8_t dataRate; //rate the packet was received on
+  uint8_t channel; //channel the packet was received on
+  uint32_t timestamp; //millis() when the radio task handled the interrupt
+  uint8_t data[256];
+};
+
+struct RadioCommand {
+  uint8_t type;
+  uint8_t dataRate; //rate to run CAD or transmit on
+  uint8_t channel; //channel to run CAD or transmit on
+  uint16_t preambleLength; //only used to transmit
+  bool implicitHeader; //only used to transmit
+  uint8_t replyLength; //only used to transmit. If non-zero, wait for a reply of this many bytes once sent
+  int8_t txPower; //only used to transmit, dBm
+  uint16_t size;
+  uint8_t data[256];
+};
+
+extern uint32_t radioDroppedEvents;
+
+void radioTaskInit();
+bool radioPostCommand(uint8_t type, const uint8_t* data = NULL, uint16_t size = 0, uint8_t dataRate = DATA_RATE_DEFAULT, uint8_t channel = CHANNEL_RENDEZVOUS, uint16_t preambleLength = DATA_RATE_PREAMBLE_MARGIN, bool implicitHeader = false, uint8_t replyLength = 0, int8_t txPower = TX_POWER_MAX);
+//how long after TX done the task listens for a reply sent at rate
+uint32_t radioReplyWindowMs(uint8_t rate);
+bool radioGetEvent(RadioEvent* event);
+void radioTask( void* params );
+
+#endif
@@ -0,0 +1,111 @@
+#include "replayWindow.h"
+#include "globals.h"
+
+struct ReplayWindow {
+  bool valid;
+  uint16_t top; //highest message number taken from the sender
+  uint32_t seen[REPLAY_WINDOW_SIZE / 32]; //bit i is message number top - i
+  uint32_t delivered[REPLAY_WINDOW_SIZE / 32]; //same, for the ones that were put back together and handed on
+  uint32_t lastActivity; //millis() of the last message taken
+};
+
+static ReplayWindow windows[256];
+static uint16_t nextMessageNumber;
+static uint16_t reservedMessageNumber; //first number not covered by what is saved in storage
+
+void replayWindowInit() {
+  memset(windows, 0, sizeof(windows));
+}
+
+static ReplayWindow* windowFor(uint8_t sender) {
+  ReplayWindow* window = &(windows[sender]);
+  if (window->valid && millis() - window->lastActivity > REPLAY_WINDOW_TIMEOUT_MS) window->valid = false;
+  return window;
+}
+
+static bool windowBit(const uint32_t* bitmap, uint16_t offset) {
+  return (bitmap[offset >> 5] >> (offset & 31)) & 1;
+}
+
+//moves a bitmap up by count numbers, older ones fall off the end
+static void shiftBitmap(uint32_t* bitmap, uint16_t count) {
+  if (count >= REPLAY_WINDOW_SIZE) {
+    memset(bitmap, 0, REPLAY_WINDOW_SIZE / 8);
+    return;
+  }
+  const int words = count >> 5;
+  const int bits = count & 31;
+  for (int i = REPLAY_WINDOW_SIZE / 32 - 1; i >= 0; i--) {
+    uint32_t value = i >= words ? bitmap[i - words] << bits : 0;
+    if (bits != 0 && i > words) value |= bitmap[i - words - 1] >> (32 - bits);
+    bitmap[i] = value;
+  }
+}
+
+uint8_t replayWindowCheck(uint8_t sender, uint16_t messageNumber) {
+  const ReplayWindow* window = windowFor(sender);
+  if (!window->valid) return REPLAY_NEW;
+  const int16_t ahead = (int16_t) (messageNumber - window->top);
+  if (ahead > 0) return REPLAY_NEW;
+  if (-ahead >= REPLAY_WINDOW_SIZE) return REPLAY_TOO_OLD;
+  return windowBit(window->seen, -ahead) ? REPLAY_SEEN : REPLAY_NEW;
+}
+
+void replayWindowMark(uint8_t sender, uint16_t messageNumber) {
+  ReplayWindow* window = windowFor(sender);
+  window->lastActivity = millis();
+  if (!window->valid) {
+    window->valid = true;
+    window->top = messageNumber;
+    memset(window->seen, 0, sizeof(window->seen));
+    memset(window->delivered, 0, sizeof(window->delivered));
+  }
+  const int16_t ahead = (int16_t) (messageNumber - window->top);
+  if (ahead > 0) {
+    shiftBitmap(window->seen, ahead);
+    shiftBitmap(window->delivered, ahead);
+    window->top = messageNumber;
+  } else if (-ahead >= REPLAY_WINDOW_SIZE) {
+    return;
+  }
+  const uint16_t offset = ahead > 0 ? 0 : -ahead;
+  window->seen[offset >> 5] |= 1UL << (offset & 31);
+}
+
+void replayWindowMarkDelivered(uint8_t sender, uint16_t messageNumber) {
+  ReplayWindow* window = windowFor(sender);
+  if (!window->valid) return;
+  const int16_t ahead = (int16_t) (messageNumber - window->top);
+  if (ahead > 0 || -ahead >= REPLAY_WINDOW_SIZE) return;
+  window->delivered[(-ahead) >> 5] |= 1UL << ((-ahead) & 31);
+}
+
+bool replayWindowDelivered(uint8_t sender, uint16_t messageNumber) {
+  const ReplayWindow* window = windowFor(sender);
+  if (!window->valid) return false;
+  const int16_t ahead = (int16_t) (messageNumber - window->top);
+  if (ahead > 0 || -ahead >= REPLAY_WINDOW_SIZE) return false; //too old to tell, so don't claim it
+  return windowBit(window->delivered, -ahead);
+}
+
+static void reserveMessageNumbers() {
+  reservedMessageNumber = nextMessageNumber + MESSAGE_NUMBER_RESERVE;
+  uint8_t buf[2] = {(uint8_t) (reservedMessageNumber >> 8), (uint8_t) (reservedMessageNumber & 0xFF)};
+  storage.putBytes(MESSAGE_NUMBER_KEY, &(buf[0]), 2);
+}
+
+void messageNumberInit() {
+  uint8_t buf[2];
+  if (storage.getBytesLength(MESSAGE_NUMBER_KEY) == 2 && storage.getBytes(MESSAGE_NUMBER_KEY, &(buf[0]), 2) == 2) {
+    //carry on past everything the last boot could have used
+    nextMessageNumber = (buf[0] << 8) + buf[1];
+  } else {
+    nextMessageNumber = esp_random();
+  }
+  reserveMessageNumbers();
+}
+
+uint16_t messageNumberNext() {
+  if (nextMessageNumber == reservedMessageNumber) reserveMessageNumbers();
+  return nextMessageNumber++;
+}
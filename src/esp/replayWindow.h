@@ -0,0 +1,48 @@
+#ifndef REPLAYWINDOW_H
+#define REPLAYWINDOW_H
+
+#include "functions.h"
+
+//Message numbers and duplicate detection.
+//Every node numbers the messages it sends with a counter that only goes up, so a receiver only has to remember, per
+//sender, the highest number it has taken and which of the REPLAY_WINDOW_SIZE numbers below it it has seen, like the
+//IPsec/DTLS anti-replay window. Numbers are 16 bits and compared with serial number arithmetic, so they can wrap.
+//The timestamp check already rejects anything older than a minute, so a window that has been idle longer than
+//REPLAY_WINDOW_TIMEOUT_MS is forgotten. That also covers a sender that rebooted or whose device ID was taken over.
+//The counter is saved to storage in blocks of MESSAGE_NUMBER_RESERVE, so it keeps going up across reboots without
+//writing to flash for every message.
+//A message number is taken as soon as its first fragment comes in, so the window also remembers which ones made it all
+//the way to the host. Only those are ACKed as complete once their reassembly is gone.
+//A sender numbers everything it sends from the one counter, whoever it is for, so the numbers we see from it have gaps
+//and a message of ours can come in after plenty of later ones to other nodes. The window has to span every number the
+//sender can use up while one message of ours is still being sent, and a number below it is only too old to tell, not
+//seen: it is dropped without an ACK, which would make the sender give the message up.
+
+//about half a minute of a sender at its fastest, a short message and its ACK every 60 ms at the fastest rate. That is
+//three times as long as a message keeps being resent (RETRANSMIT_GIVE_UP_MS), and 32 kB for all 256 windows.
+//Multiple of 32
+#define REPLAY_WINDOW_SIZE 512
+#define REPLAY_WINDOW_TIMEOUT_MS 90000
+#define MESSAGE_NUMBER_RESERVE 256
+#define MESSAGE_NUMBER_KEY "MsgNumber"
+
+//forgets every sender's window
+void replayWindowInit();
+//what replayWindowCheck() knows about a message number
+#define REPLAY_NEW 0 //not taken from the sender yet
+#define REPLAY_SEEN 1 //taken from the sender already
+#define REPLAY_TOO_OLD 2 //below the sender's window, there is no telling whether it was taken
+
+uint8_t replayWindowCheck(uint8_t sender, uint16_t messageNumber);
+//records that the message has been taken from sender
+void replayWindowMark(uint8_t sender, uint16_t messageNumber);
+//records that the message from sender was put back together and handed to the host. It has to have been marked already
+void replayWindowMarkDelivered(uint8_t sender, uint16_t messageNumber);
+//true if the message from sender was handed to the host. One that was only taken may still have been dropped half done
+bool replayWindowDelivered(uint8_t sender, uint16_t messageNumber);
+
+//picks up the message counter from storage. Call once storage has been started
+void messageNumberInit();
+uint16_t messageNumberNext();
+
+#endif
@@ -0,0 +1,49 @@
+#include "retransmit.h"
+
+struct PeerRtt {
+  bool valid;
+  uint32_t srtt; //ms
+  uint32_t rttvar; //ms
+  uint32_t lastSample;
+};
+
+static PeerRtt peers[256];
+
+void retransmitInit() {
+  memset(peers, 0, sizeof(peers));
+}
+
+void retransmitRecordSample(uint8_t peer, uint32_t rtt) {
+  PeerRtt* link = &(peers[peer]);
+  if (link->valid && millis() - link->lastSample > RETRANSMIT_PEER_TIMEOUT_MS) link->valid = false;
+  if (!link->valid) {
+    link->valid = true;
+    link->srtt = rtt;
+    link->rttvar = rtt / 2;
+  } else {
+    const uint32_t error = rtt > link->srtt ? rtt - link->srtt : link->srtt - rtt;
+    link->rttvar = (3 * link->rttvar + error) / 4;
+    link->srtt = (7 * link->srtt + rtt) / 8;
+  }
+  link->lastSample = millis();
+}
+
+uint32_t retransmitTimeoutBase(uint8_t peer) {
+  const PeerRtt* link = &(peers[peer]);
+  uint32_t timeout = RETRANSMIT_INITIAL_TIMEOUT_MS;
+  if (link->valid && millis() - link->lastSample <= RETRANSMIT_PEER_TIMEOUT_MS) {
+    //the variance term never drops below the timer wheel's tick, a timer can't be any finer than that
+    timeout = link->srtt + max(4 * link->rttvar, (uint32_t) (1 << TIMER_WHEEL_TICK_SHIFT));
+  }
+  return max(timeout, (uint32_t) RETRANSMIT_MIN_TIMEOUT_MS);
+}
+
+uint32_t retransmitTimeoutFor(uint8_t peer, uint8_t sendCount) {
+  uint32_t timeout = retransmitTimeoutBase(peer);
+
+  //exponential backoff, one doubling for every resend
+  for (uint8_t i = 1; i < sendCount && timeout < RETRANSMIT_MAX_TIMEOUT_MS; i++) timeout *= 2;
+  timeout = min(timeout, (uint32_t) RETRANSMIT_MAX_TIMEOUT_MS);
+
+  return timeout + esp_random() % (timeout / RETRANSMIT_JITTER_DIVISOR + 1);
+}
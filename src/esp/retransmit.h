@@ -0,0 +1,37 @@
+#ifndef RETRANSMIT_H
+#define RETRANSMIT_H
+
+#include "functions.h"
+
+//Retransmission timeout, per peer.
+//The time from a fragment being queued to its ACK coming back is fed into a smoothed RTT and RTT variance, the same
+//estimator TCP uses (RFC 6298), and the timeout is SRTT + 4 * RTTVAR. The sample starts when the fragment is queued,
+//not when it goes on air, so time spent waiting for CAD and for other frames is part of it too. Only fragments that
+//were sent once are sampled, an ACK for a resent one can't say which copy it is for (Karn's algorithm).
+//Every resend doubles the timeout, and a random extra of up to 1/RETRANSMIT_JITTER_DIVISOR of it keeps senders that
+//lost to the same collision from resending into each other again.
+
+#define RETRANSMIT_INITIAL_TIMEOUT_MS 4000 //until the peer has ACKed something
+#define RETRANSMIT_MIN_TIMEOUT_MS 500 //the ACK comes back in the reply window after the frame, never sooner
+#define RETRANSMIT_JITTER_DIVISOR 4
+//the receiver drops a half reassembled message RX_REASSEMBLY_TIMEOUT_MS after its last fragment, so the longest wait
+//before a resend, jitter included, has to stay well short of that or the resend finds nothing left to add to
+#define RETRANSMIT_MAX_TIMEOUT_MS (RX_REASSEMBLY_TIMEOUT_MS * 3 / 5)
+#if RETRANSMIT_MAX_TIMEOUT_MS + RETRANSMIT_MAX_TIMEOUT_MS / RETRANSMIT_JITTER_DIVISOR >= RX_REASSEMBLY_TIMEOUT_MS
+#error "a resend could come after the receiver has given up on the message"
+#endif
+//that only bounds one wait. A fragment whose frames keep getting lost backs off several times in a row, and if nothing
+//else of its message gets through meanwhile the receiver drops it. So a fragment is only resent for this long after it
+//first went out or an ACK last showed the receiver still has its message
+#define RETRANSMIT_GIVE_UP_MS RX_REASSEMBLY_TIMEOUT_MS
+#define RETRANSMIT_PEER_TIMEOUT_MS 180000 //start over from the initial timeout once a peer has ACKed nothing for this long
+
+void retransmitInit();
+//peer ACKed a fragment of ours rtt ms after it was queued, the first time it was sent
+void retransmitRecordSample(uint8_t peer, uint32_t rtt);
+//the timeout for peer before backoff and jitter, what the peer can be expected to wait for our ACKs too
+uint32_t retransmitTimeoutBase(uint8_t peer);
+//time to wait for peer's ACK before sending again. sendCount is how many times the fragment has been sent
+uint32_t retransmitTimeoutFor(uint8_t peer, uint8_t sendCount);
+
+#endif
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "mbedtls/sha256.h"
 #include "mbedtls/pkcs5.h"
+#include "mbedtls/md.h"
 #include "mbedtls/gcm.h"
 #include "mbedtls/aes.h"
 #include "mbedtls/ctr_drbg.h"
@@ -342,7 +343,7 @@ void sec_resetPairing() {
 
 // --- Encryption/Decryption ---
 
-bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen) {
+bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen, const uint8_t* aad, size_t aadLen) {
     if (!g_is_logged_in || !g_is_paired) return false;
     // CHANGED: Overhead reduced from 28 to 20 (12 IV + 8 Tag)
     if (bufferSize < plaintextLen + 20) return false;
@@ -356,7 +357,7 @@ bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_
 
     // Output: [IV (12)] [Ciphertext (N)] [Tag (8)]
     int ret = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, plaintextLen,
-                                        iv, 12, NULL, 0,
+                                        iv, 12, aad, aadLen,
                                         plaintext, 
                                         ciphertextBuffer + 12, // Ciphertext starts after IV
                                         8, //Tag length is 8 bytes
@@ -370,7 +371,7 @@ bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_
     return (ret == 0);
 }
 
-bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen) {
+bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen, const uint8_t* aad, size_t aadLen) {
     if (!g_is_logged_in || !g_is_paired) return false; 
     
     if (ciphertextLen < 20) return false; 
@@ -385,7 +386,7 @@ bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint
 
     int ret = mbedtls_gcm_auth_decrypt(&gcm, dataLen,
                                        ciphertext, 12, // IV at start
-                                       NULL, 0,
+                                       aad, aadLen,
                                        ciphertext + 12 + dataLen, 8, // Expect 8 byte Tag
                                        ciphertext + 12, // Ciphertext data
                                        plaintextBuffer);
@@ -394,3 +395,15 @@ bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint
     mbedtls_gcm_free(&gcm);
     return (ret == 0);
 }
+
+bool sec_deriveD2DSubkey(const char* label, uint8_t* output) {
+    if (!g_is_logged_in || !g_is_paired) return false;
+
+    const mbedtls_md_info_t *info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    if (info == NULL) return false;
+
+    int ret = mbedtls_md_hmac(info, g_decrypted_d2d_key, 16,
+                              (const unsigned char*)label, strlen(label),
+                              output);
+    return (ret == 0);
+}
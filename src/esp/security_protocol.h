@@ -146,9 +146,11 @@ void sec_resetPairing();
  * @param ciphertextBuffer Dest buffer allocated by caller.
  * @param bufferSize Size of dest buffer. MUST be >= (plaintextLen + 20).
  * @param ciphertextLen Output pointer. Function writes the final size here (plaintextLen + 20).
+ * @param aad Additional data the tag covers but that is not encrypted, NULL for none.
+ * @param aadLen Length of the additional data.
  * @return true on success, false if buffer too small or not logged in.
  */
-bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen);
+bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen, const uint8_t* aad, size_t aadLen);
 
 /**
  * @brief Decrypts and Authenticates a message using AES-GCM.
@@ -159,10 +161,22 @@ bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_
  * @param plaintextBuffer Dest buffer allocated by caller.
  * @param bufferSize Size of dest buffer. MUST be >= (ciphertextLen - 20).
  * @param plaintextLen Output pointer. Function writes final decrypted size here.
+ * @param aad Additional data the message was encrypted with, NULL for none. Must match exactly.
+ * @param aadLen Length of the additional data.
  * @return true if integrity check passed and decryption succeeded.
  * @return false if authentication failed (tampering) or buffer too small.
  */
-bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen);
+bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen, const uint8_t* aad, size_t aadLen);
+
+/**
+ * @brief Derives key material for something other than encryption from the D2D key.
+ * Computes HMAC-SHA256(D2D key, label), so every paired device gets the same
+ * output for the same label and the D2D key itself never leaves this module.
+ * @param label Names what the output is used for, e.g. "LoComm hop sequence".
+ * @param output Dest buffer, MUST be at least 32 bytes.
+ * @return true on success, false if not logged in or unpaired.
+ */
+bool sec_deriveD2DSubkey(const char* label, uint8_t* output);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,65 @@
+#include "txPower.h"
+
+struct PeerPower {
+  int8_t power; //dBm frames to the peer go out at
+  uint32_t lastReport; //millis() of the last report, 0 if we have none
+};
+
+static PeerPower peers[256];
+
+void txPowerInit() {
+  for (int i = 0; i < 256; i++) {
+    peers[i].power = TX_POWER_MAX;
+    peers[i].lastReport = 0;
+  }
+}
+
+//the SNR the frame would have had, if the SX127x estimate didn't saturate on strong links
+static float linkSnr(uint8_t rate, float snr, int16_t rssi) {
+  if (snr < TX_POWER_SNR_SATURATION_DB) return snr;
+  const float noiseFloor = -174.0 + 10.0 * log10(dataRates[rate].bandwidth) + TX_POWER_NOISE_FIGURE_DB;
+  return max(snr, rssi - noiseFloor);
+}
+
+void txPowerRecordReport(uint8_t peer, uint8_t rate, float snr, int16_t rssi) {
+  if (peer == 0 || peer == 255 || rate >= DATA_RATE_COUNT) return;
+  PeerPower* link = &(peers[peer]);
+  link->lastReport = millis();
+
+  //until the peer is on the fastest rate, spare link budget goes to the rate instead
+  if (rate != DATA_RATE_COUNT - 1) {
+    link->power = TX_POWER_MAX;
+    return;
+  }
+
+  const float headroom = linkSnr(rate, snr, rssi) - (dataRates[rate].requiredSnr + TX_POWER_TARGET_MARGIN_DB);
+  int power = link->power;
+  if (headroom < 0) {
+    power += (int) ceil(-headroom);
+  } else {
+    //like LoRaWAN ADR, drop all of the headroom at once in whole steps. Links don't see many frames each, so creeping
+    //down would rarely get anywhere
+    power -= TX_POWER_STEP_DB * ((int) headroom / TX_POWER_STEP_DB);
+  }
+  power = min(max(power, TX_POWER_MIN), TX_POWER_MAX);
+  if (power != link->power) {
+    Debug(Serial1.printf("TX power for peer %d: SNR %.1f RSSI %d, %d dBm instead of %d\n", peer, snr, rssi, power, link->power));
+    link->power = power;
+  }
+}
+
+void txPowerRecordFailure(uint8_t peer) {
+  if (peer == 0 || peer == 255) return;
+  //a lost frame could be down to anything, so don't try to be clever about it
+  peers[peer].power = TX_POWER_MAX;
+}
+
+int8_t txPowerFor(uint8_t peer) {
+  if (peer == 0 || peer == 255) return TX_POWER_MAX;
+  PeerPower* link = &(peers[peer]);
+  if (link->lastReport != 0 && millis() - link->lastReport > DATA_RATE_PEER_TIMEOUT_MS) {
+    link->lastReport = 0;
+    link->power = TX_POWER_MAX;
+  }
+  return link->power;
+}
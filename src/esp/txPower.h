@@ -0,0 +1,29 @@
+#ifndef TXPOWER_H
+#define TXPOWER_H
+
+#include "functions.h"
+#include "dataRate.h"
+
+//Closed loop transmit power control, per peer.
+//Every ACK reports the SNR and RSSI its sender measured on the frame being ACKed. The transmitter compares that with
+//what the data rate in use needs, plus TX_POWER_TARGET_MARGIN_DB, and walks its power toward the lowest level that
+//still leaves the margin. Data rate comes first: power is only trimmed once the peer asks for the fastest rate, so the
+//two loops don't fight over the same dBs. Broadcasts, control frames and peers we have no report from get full power.
+
+#define TX_POWER_MAX 17 //dBm, what LoRa.begin() sets
+#define TX_POWER_MIN 2 //dBm, lowest PA_BOOST setting
+//a little above DATA_RATE_MARGIN_DB, so the receiver never has a reason to step its rate down because of us
+#define TX_POWER_TARGET_MARGIN_DB (DATA_RATE_MARGIN_DB + 2.0)
+#define TX_POWER_STEP_DB 3 //granularity power is lowered in. Raising it isn't rounded
+//the SX127x SNR estimate saturates around +10dB. Above this, the link is judged from RSSI against the noise floor
+#define TX_POWER_SNR_SATURATION_DB 8.0
+#define TX_POWER_NOISE_FIGURE_DB 6.0
+
+void txPowerInit();
+//peer ACKed a frame we sent at rate and reported the link quality it got
+void txPowerRecordReport(uint8_t peer, uint8_t rate, float snr, int16_t rssi);
+//a frame to peer had to be sent again
+void txPowerRecordFailure(uint8_t peer);
+int8_t txPowerFor(uint8_t peer);
+
+#endif
@@ -0,0 +1,439 @@
+#include "SX127xSim.h"
+#include "SimNode.h"
+#include "SimScheduler.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#define REG_FIFO                 0x00
+#define REG_OP_MODE              0x01
+#define REG_FRF_MSB              0x06
+#define REG_FRF_MID              0x07
+#define REG_FRF_LSB              0x08
+#define REG_PA_CONFIG            0x09
+#define REG_FIFO_ADDR_PTR        0x0d
+#define REG_FIFO_TX_BASE_ADDR    0x0e
+#define REG_FIFO_RX_BASE_ADDR    0x0f
+#define REG_FIFO_RX_CURRENT_ADDR 0x10
+#define REG_IRQ_FLAGS_MASK       0x11
+#define REG_IRQ_FLAGS            0x12
+#define REG_RX_NB_BYTES          0x13
+#define REG_MODEM_STAT           0x18
+#define REG_PKT_SNR_VALUE        0x19
+#define REG_PKT_RSSI_VALUE       0x1a
+#define REG_RSSI_VALUE           0x1b
+#define REG_MODEM_CONFIG_1       0x1d
+#define REG_MODEM_CONFIG_2       0x1e
+#define REG_PREAMBLE_MSB         0x20
+#define REG_PREAMBLE_LSB         0x21
+#define REG_PAYLOAD_LENGTH       0x22
+#define REG_FIFO_RX_BYTE_ADDR    0x25
+#define REG_MODEM_CONFIG_3       0x26
+#define REG_RSSI_WIDEBAND        0x2c
+#define REG_INVERTIQ             0x33
+#define REG_SYNC_WORD            0x39
+#define REG_DIO_MAPPING_1        0x40
+#define REG_VERSION              0x42
+#define REG_PA_DAC               0x4d
+
+#define MODE_SLEEP               0x00
+#define MODE_STDBY               0x01
+#define MODE_TX                  0x03
+#define MODE_RX_CONTINUOUS       0x05
+#define MODE_RX_SINGLE           0x06
+#define MODE_CAD                 0x07
+
+#define IRQ_RX_DONE              0x40
+#define IRQ_PAYLOAD_CRC_ERROR    0x20
+#define IRQ_VALID_HEADER         0x10
+#define IRQ_TX_DONE              0x08
+#define IRQ_CAD_DONE             0x04
+#define IRQ_CAD_DETECTED         0x01
+
+#define RSSI_OFFSET_HF_PORT      157
+
+static const uint32_t bandwidthTable[10] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+
+double SimRadioConfig::symbolTimeUs() const {
+  return (double) (1UL << spreadingFactor) * 1e6 / (double) bandwidth;
+}
+
+uint64_t SimRadioConfig::timeOnAirUs(uint8_t payloadSize) const {
+  const double symbol = symbolTimeUs();
+  const double preamble = (preambleLength + 4.25) * symbol;
+  const int de = lowDataRateOptimize ? 1 : 0;
+  const double numerator = 8.0 * payloadSize - 4.0 * spreadingFactor + 28 + 16 * (crc ? 1 : 0) - 20 * (implicitHeader ? 1 : 0);
+  const double denominator = 4.0 * (spreadingFactor - 2 * de);
+  const double payloadSymbols = 8 + std::max(ceil(numerator / denominator) * (codingRate + 4), 0.0);
+  return (uint64_t) (preamble + payloadSymbols * symbol);
+}
+
+uint64_t SimRadioConfig::cadTimeUs() const {
+  return (uint64_t) (1.75 * symbolTimeUs());
+}
+
+bool SimRadioConfig::hears(const SimRadioConfig& transmitter) const {
+  //the demodulator tolerates roughly a quarter of the bandwidth of carrier offset
+  const int64_t offset = (int64_t) frequency - (int64_t) transmitter.frequency;
+  if ((uint64_t) llabs(offset) > bandwidth / 4) return false;
+  return spreadingFactor == transmitter.spreadingFactor &&
+         bandwidth == transmitter.bandwidth &&
+         syncWord == transmitter.syncWord &&
+         invertIqRx == transmitter.invertIqTx;
+}
+
+SX127xSim::SX127xSim(SimNode* node, SimMedium* medium) :
+  _node(node),
+  _medium(medium),
+  _selected(false),
+  _haveAddress(false),
+  _writing(false),
+  _address(0),
+  _inReset(false),
+  _dio0Level(false),
+  _operationGeneration(0),
+  _rxRssi(0)
+{
+  memset(&stats, 0, sizeof(stats));
+  reset();
+  _medium->attach(this);
+}
+
+void SX127xSim::reset() {
+  _operationGeneration++;
+  if (_txFrame) {
+    _txFrame->aborted = true;
+    _medium->abortTransmission(_txFrame);
+    _txFrame.reset();
+  }
+  _rxFrame.reset();
+
+  //LoRa relevant power-on defaults from the register table in the datasheet
+  memset(_regs, 0, sizeof(_regs));
+  memset(_fifo, 0, sizeof(_fifo));
+  _regs[REG_OP_MODE] = 0x09;
+  _regs[REG_FRF_MSB] = 0x6c;
+  _regs[REG_FRF_MID] = 0x80;
+  _regs[REG_FRF_LSB] = 0x00;
+  _regs[REG_PA_CONFIG] = 0x4f;
+  _regs[0x0b] = 0x2b;
+  _regs[0x0c] = 0x20;
+  _regs[REG_FIFO_TX_BASE_ADDR] = 0x80;
+  _regs[REG_MODEM_CONFIG_1] = 0x72;
+  _regs[REG_MODEM_CONFIG_2] = 0x70;
+  _regs[0x1f] = 0x64;
+  _regs[REG_PREAMBLE_LSB] = 0x08;
+  _regs[REG_PAYLOAD_LENGTH] = 0x01;
+  _regs[0x23] = 0xff;
+  _regs[0x31] = 0xc3;
+  _regs[REG_INVERTIQ] = 0x27;
+  _regs[0x37] = 0x0a;
+  _regs[REG_SYNC_WORD] = 0x12;
+  _regs[0x3b] = 0x1d;
+  _regs[REG_VERSION] = 0x12;
+  _regs[REG_PA_DAC] = 0x84;
+  _rxWritePointer = 0;
+  updateDio0();
+}
+
+SimRadioConfig SX127xSim::config() const {
+  SimRadioConfig c;
+  const uint32_t frf = ((uint32_t) _regs[REG_FRF_MSB] << 16) | ((uint32_t) _regs[REG_FRF_MID] << 8) | _regs[REG_FRF_LSB];
+  c.frequency = (uint32_t) (((uint64_t) frf * 32000000ULL) >> 19);
+  c.spreadingFactor = std::min(std::max(_regs[REG_MODEM_CONFIG_2] >> 4, 6), 12);
+  c.bandwidth = bandwidthTable[std::min(_regs[REG_MODEM_CONFIG_1] >> 4, 9)];
+  c.codingRate = std::min(std::max((_regs[REG_MODEM_CONFIG_1] >> 1) & 0x07, 1), 4);
+  c.implicitHeader = _regs[REG_MODEM_CONFIG_1] & 0x01;
+  c.crc = (_regs[REG_MODEM_CONFIG_2] >> 2) & 0x01;
+  c.lowDataRateOptimize = (_regs[REG_MODEM_CONFIG_3] >> 3) & 0x01;
+  c.syncWord = _regs[REG_SYNC_WORD];
+  //the TX bit is active low: 0x27 is the normal setting, 0x66 inverts both directions
+  c.invertIqRx = _regs[REG_INVERTIQ] & 0x40;
+  c.invertIqTx = !(_regs[REG_INVERTIQ] & 0x01);
+  c.preambleLength = ((uint16_t) _regs[REG_PREAMBLE_MSB] << 8) | _regs[REG_PREAMBLE_LSB];
+  c.payloadLength = _regs[REG_PAYLOAD_LENGTH];
+  if (_regs[REG_PA_CONFIG] & 0x80) {
+    c.txPower = 2 + (_regs[REG_PA_CONFIG] & 0x0f) + ((_regs[REG_PA_DAC] & 0x07) == 0x07 ? 3 : 0);
+  } else {
+    c.txPower = (_regs[REG_PA_CONFIG] & 0x0f) - 1;
+  }
+  return c;
+}
+
+bool SX127xSim::listening() const {
+  return !_inReset && (mode() == MODE_RX_CONTINUOUS || mode() == MODE_RX_SINGLE);
+}
+
+void SX127xSim::select() {
+  _selected = true;
+  _haveAddress = false;
+}
+
+void SX127xSim::deselect() {
+  _selected = false;
+  _haveAddress = false;
+}
+
+uint8_t SX127xSim::transfer(uint8_t value) {
+  if (!_selected || _inReset) return 0x00;
+
+  if (!_haveAddress) {
+    _haveAddress = true;
+    _writing = value & 0x80;
+    _address = value & 0x7f;
+    return 0x00;
+  }
+
+  uint8_t response = 0x00;
+  if (_writing) {
+    writeRegister(_address, value);
+  } else {
+    response = readRegister(_address);
+  }
+  //burst accesses walk the register map, except the FIFO which walks RegFifoAddrPtr instead
+  if (_address != REG_FIFO) _address = (_address + 1) & 0x7f;
+  return response;
+}
+
+void SX127xSim::holdReset() {
+  _inReset = true;
+}
+
+void SX127xSim::releaseReset() {
+  if (!_inReset) return;
+  _inReset = false;
+  reset();
+}
+
+uint8_t SX127xSim::readRegister(uint8_t address) {
+  switch (address) {
+    case REG_FIFO:
+      return _fifo[_regs[REG_FIFO_ADDR_PTR]++];
+    case REG_MODEM_STAT:
+      return modemStatus();
+    case REG_RSSI_VALUE: {
+      const int value = (int) lroundf(_medium->channelRssi(this)) + RSSI_OFFSET_HF_PORT;
+      return (uint8_t) std::min(std::max(value, 0), 255);
+    }
+    case REG_RSSI_WIDEBAND:
+      return (uint8_t) _node->random();
+    case REG_FIFO_RX_BYTE_ADDR:
+      return _rxWritePointer;
+  }
+  return _regs[address];
+}
+
+void SX127xSim::writeRegister(uint8_t address, uint8_t value) {
+  switch (address) {
+    case REG_FIFO:
+      _fifo[_regs[REG_FIFO_ADDR_PTR]++] = value;
+      return;
+    case REG_OP_MODE:
+      setOpMode(value);
+      return;
+    case REG_IRQ_FLAGS:
+      _regs[REG_IRQ_FLAGS] &= ~value;
+      updateDio0();
+      return;
+    case REG_DIO_MAPPING_1:
+      _regs[REG_DIO_MAPPING_1] = value;
+      updateDio0();
+      return;
+    //read only
+    case REG_FIFO_RX_CURRENT_ADDR:
+    case REG_RX_NB_BYTES:
+    case REG_MODEM_STAT:
+    case REG_PKT_SNR_VALUE:
+    case REG_PKT_RSSI_VALUE:
+    case REG_RSSI_VALUE:
+    case REG_VERSION:
+      return;
+  }
+  _regs[address] = value;
+}
+
+void SX127xSim::setOpMode(uint8_t value) {
+  const uint8_t oldMode = mode();
+  const uint8_t newMode = value & 0x07;
+  _regs[REG_OP_MODE] = value;
+
+  if (newMode == oldMode) return;
+  _operationGeneration++;
+
+  //leaving a mode abandons whatever it was doing
+  if (oldMode == MODE_TX && _txFrame) {
+    _txFrame->aborted = true;
+    _txFrame->end = _node->now();
+    _medium->abortTransmission(_txFrame);
+    _txFrame.reset();
+    stats.framesAborted++;
+  }
+  if (_rxFrame) {
+    _rxFrame.reset();
+    stats.rxAborted++;
+  }
+
+  const uint32_t generation = _operationGeneration;
+  const uint64_t now = _node->now();
+  const SimRadioConfig c = config();
+
+  switch (newMode) {
+    case MODE_SLEEP:
+      memset(_fifo, 0, sizeof(_fifo));
+      break;
+    case MODE_TX: {
+      std::shared_ptr<SimFrame> frame = std::make_shared<SimFrame>();
+      frame->sender = this;
+      frame->config = c;
+      frame->payload.resize(c.payloadLength);
+      for (int i = 0; i < c.payloadLength; i++) {
+        frame->payload[i] = _fifo[(uint8_t) (_regs[REG_FIFO_TX_BASE_ADDR] + i)];
+      }
+      const double symbol = c.symbolTimeUs();
+      frame->start = now;
+      frame->preambleEnd = now + (uint64_t) ((c.preambleLength + 4.25) * symbol);
+      frame->headerEnd = frame->preambleEnd + (c.implicitHeader ? 0 : (uint64_t) (8 * symbol));
+      frame->end = now + c.timeOnAirUs(c.payloadLength);
+      frame->aborted = false;
+      frame->id = 0;
+      _txFrame = frame;
+
+      stats.framesSent++;
+      stats.bytesSent += c.payloadLength;
+      stats.txAirtimeUs += frame->end - frame->start;
+      _medium->startTransmission(frame);
+      Scheduler.at(frame->end, _node, [this, generation]() { finishTransmit(generation); });
+      break;
+    }
+    case MODE_CAD: {
+      const uint64_t end = now + c.cadTimeUs();
+      stats.cadRuns++;
+      stats.cadAirtimeUs += end - now;
+      Scheduler.at(end, _node, [this, generation, now]() { finishCad(generation, now); });
+      break;
+    }
+    case MODE_RX_CONTINUOUS:
+    case MODE_RX_SINGLE:
+      _rxWritePointer = _regs[REG_FIFO_RX_BASE_ADDR];
+      _medium->radioListening(this);
+      break;
+  }
+}
+
+void SX127xSim::finishTransmit(uint32_t generation) {
+  if (generation != _operationGeneration) return;
+  _txFrame.reset();
+  _regs[REG_OP_MODE] = (_regs[REG_OP_MODE] & 0xf8) | MODE_STDBY;
+  _operationGeneration++;
+  setIrq(IRQ_TX_DONE);
+}
+
+void SX127xSim::finishCad(uint32_t generation, uint64_t start) {
+  if (generation != _operationGeneration) return;
+  const bool detected = _medium->channelActivity(this, start, _node->now());
+  if (detected) stats.cadDetections++;
+  _regs[REG_OP_MODE] = (_regs[REG_OP_MODE] & 0xf8) | MODE_STDBY;
+  _operationGeneration++;
+  setIrq(IRQ_CAD_DONE | (detected ? IRQ_CAD_DETECTED : 0));
+}
+
+void SX127xSim::signalStarted(std::shared_ptr<SimFrame> frame, float rssi) {
+  if (!listening() || _rxFrame) return;
+  if (!config().hears(frame->config)) return;
+  //the modem locks onto the first preamble it detects and ignores everything else until that frame ends
+  _rxFrame = frame;
+  _rxRssi = rssi;
+}
+
+void SX127xSim::signalEnded(std::shared_ptr<SimFrame> frame, float rssi, float snr, bool corrupted) {
+  if (frame != _rxFrame) return;
+  _rxFrame.reset();
+  if (!listening()) return;
+
+  const SimRadioConfig c = config();
+  if (!c.implicitHeader && frame->config.implicitHeader) {
+    //there is no header to find, so the modem gives up and goes back to hunting for a preamble
+    stats.headerErrors++;
+    return;
+  }
+  if (frame->aborted) {
+    if (frame->end < frame->headerEnd) {
+      stats.headerErrors++;
+      return;
+    }
+    corrupted = true;
+  }
+  deliver(*frame, rssi, snr, corrupted);
+}
+
+void SX127xSim::deliver(const SimFrame& frame, float rssi, float snr, bool corrupted) {
+  const SimRadioConfig c = config();
+  std::vector<uint8_t> payload = frame.payload;
+  bool crcPresent = frame.config.crc;
+
+  if (c.implicitHeader) {
+    //without a header the receiver has to assume its own length, coding rate and CRC setting
+    crcPresent = c.crc;
+    if (frame.config.implicitHeader != c.implicitHeader || frame.config.payloadLength != c.payloadLength || frame.config.codingRate != c.codingRate || frame.config.crc != c.crc) {
+      corrupted = true;
+    }
+    payload.resize(c.payloadLength, 0x00);
+  }
+  if (corrupted) {
+    for (size_t i = 0; i < payload.size(); i++) payload[i] ^= (uint8_t) _node->random();
+  }
+
+  const uint8_t start = _rxWritePointer;
+  for (size_t i = 0; i < payload.size(); i++) {
+    _fifo[_rxWritePointer++] = payload[i];
+  }
+  _regs[REG_FIFO_RX_CURRENT_ADDR] = start;
+  _regs[REG_RX_NB_BYTES] = (uint8_t) payload.size();
+  _regs[REG_PKT_RSSI_VALUE] = (uint8_t) std::min(std::max((int) lroundf(rssi) + RSSI_OFFSET_HF_PORT, 0), 255);
+  _regs[REG_PKT_SNR_VALUE] = (uint8_t) (int8_t) std::min(std::max((int) lroundf(snr * 4), -128), 127);
+
+  uint8_t flags = IRQ_RX_DONE | IRQ_VALID_HEADER;
+  if (corrupted) {
+    if (crcPresent) {
+      flags |= IRQ_PAYLOAD_CRC_ERROR;
+      stats.crcErrors++;
+    }
+  } else {
+    stats.framesReceived++;
+  }
+
+  if (mode() == MODE_RX_SINGLE) {
+    _regs[REG_OP_MODE] = (_regs[REG_OP_MODE] & 0xf8) | MODE_STDBY;
+    _operationGeneration++;
+  }
+  setIrq(flags);
+}
+
+void SX127xSim::setIrq(uint8_t flags) {
+  _regs[REG_IRQ_FLAGS] |= flags & ~_regs[REG_IRQ_FLAGS_MASK];
+  updateDio0();
+}
+
+void SX127xSim::updateDio0() {
+  uint8_t mask = 0;
+  switch (_regs[REG_DIO_MAPPING_1] >> 6) {
+    case 0: mask = IRQ_RX_DONE; break;
+    case 1: mask = IRQ_TX_DONE; break;
+    case 2: mask = IRQ_CAD_DONE; break;
+  }
+  const bool level = (_regs[REG_IRQ_FLAGS] & mask) != 0;
+  if (level != _dio0Level) {
+    _dio0Level = level;
+    _node->driveInput(SIM_DIO0_PIN, level ? 1 : 0);
+  }
+}
+
+uint8_t SX127xSim::modemStatus() {
+  if (!_rxFrame || !listening()) return 0x10; //modem clear
+  const uint64_t now = _node->now();
+  uint8_t status = 0x01; //signal detected
+  if (now >= _rxFrame->preambleEnd) status |= 0x02 | 0x04; //signal synchronized, rx ongoing
+  if (now >= _rxFrame->headerEnd && !_rxFrame->config.implicitHeader) status |= 0x08; //header info valid
+  return status;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+//Register-level model of a Semtech SX1276/77/78/79 running in LoRa mode.
+//It sits behind the SPI shim, so the firmware's LoRaClass talks to it exactly like it talks to the real chip:
+//address byte first (bit 7 set for writes), then data bytes with the address auto-incrementing, except for the FIFO
+//which advances RegFifoAddrPtr instead. OP_MODE changes start timed operations on the node's virtual clock.
+
+struct SimNode;
+class SX127xSim;
+
+//the modem settings that decide whether two radios can hear each other, snapshotted at the start of a transmission
+struct SimRadioConfig {
+  uint32_t frequency;
+  uint8_t spreadingFactor;
+  uint32_t bandwidth;
+  uint8_t codingRate; //1..4 for 4/5..4/8
+  bool implicitHeader;
+  bool crc;
+  bool lowDataRateOptimize;
+  uint8_t syncWord;
+  bool invertIqRx;
+  bool invertIqTx;
+  uint16_t preambleLength;
+  uint8_t payloadLength; //RegPayloadLength, only meaningful for implicit header receivers
+  int8_t txPower;
+
+  double symbolTimeUs() const;
+  //time on air of a payload, from the SX127x datasheet (section 4.1.1.7)
+  uint64_t timeOnAirUs(uint8_t payloadSize) const;
+  //CAD listens for one symbol and then spends roughly another 0.75 symbols correlating (AN1200.48)
+  uint64_t cadTimeUs() const;
+  //true if a receiver with this config demodulates chirps sent with the transmitter's config
+  bool hears(const SimRadioConfig& transmitter) const;
+};
+
+struct SimFrame {
+  SX127xSim* sender;
+  SimRadioConfig config;
+  std::vector<uint8_t> payload;
+  uint64_t start;
+  uint64_t preambleEnd;
+  uint64_t headerEnd;
+  uint64_t end;
+  bool aborted; //sender left TX early, the tail of the frame never made it onto the air
+  uint64_t id;
+};
+
+//Everything between the antennas. The base class is an empty room: nothing is ever heard and the channel is always clear
+class SimMedium {
+  public:
+    virtual ~SimMedium() {}
+    virtual void attach(SX127xSim* radio) {}
+    virtual void startTransmission(std::shared_ptr<SimFrame> frame) {}
+    virtual void abortTransmission(std::shared_ptr<SimFrame> frame) {}
+    //called when a radio enters RX, so frames whose preamble is still on the air can be picked up
+    virtual void radioListening(SX127xSim* radio) {}
+    //true if a CAD run by radio over [start, end] would see LoRa chirps
+    virtual bool channelActivity(SX127xSim* radio, uint64_t start, uint64_t end) { return false; }
+    //wideband RSSI currently seen by radio, in dBm
+    virtual float channelRssi(SX127xSim* radio) { return -120.0f; }
+};
+
+struct SX127xStats {
+  uint64_t framesSent;
+  uint64_t framesAborted;
+  uint64_t bytesSent;
+  uint64_t txAirtimeUs;
+  uint64_t framesReceived;
+  uint64_t crcErrors;
+  uint64_t headerErrors;
+  uint64_t cadRuns;
+  uint64_t cadDetections;
+  uint64_t cadAirtimeUs;
+  uint64_t rxAborted; //reception cut short because the firmware changed mode mid-frame
+};
+
+class SX127xSim {
+  public:
+    SX127xSim(SimNode* node, SimMedium* medium);
+
+    //SPI side, driven by the node's pins and the SPI shim
+    void select();
+    void deselect();
+    uint8_t transfer(uint8_t value);
+
+    //reset pin
+    void holdReset();
+    void releaseReset();
+
+    //medium side
+    void signalStarted(std::shared_ptr<SimFrame> frame, float rssi);
+    void signalEnded(std::shared_ptr<SimFrame> frame, float rssi, float snr, bool corrupted);
+
+    SimRadioConfig config() const;
+    uint8_t mode() const { return _regs[0x01] & 0x07; }
+    bool listening() const;
+    //the frame the modem is currently locked onto, if any
+    const SimFrame* receiving() const { return _rxFrame.get(); }
+    SimNode* node() const { return _node; }
+    SimMedium* medium() const { return _medium; }
+
+    SX127xStats stats;
+
+  private:
+    uint8_t readRegister(uint8_t address);
+    void writeRegister(uint8_t address, uint8_t value);
+    void setOpMode(uint8_t value);
+    void finishTransmit(uint32_t generation);
+    void finishCad(uint32_t generation, uint64_t start);
+    void deliver(const SimFrame& frame, float rssi, float snr, bool corrupted);
+    void setIrq(uint8_t flags);
+    void updateDio0();
+    uint8_t modemStatus();
+    void reset();
+
+    SimNode* _node;
+    SimMedium* _medium;
+
+    uint8_t _regs[128];
+    uint8_t _fifo[256];
+    uint8_t _rxWritePointer;
+
+    bool _selected;
+    bool _haveAddress;
+    bool _writing;
+    uint8_t _address;
+
+    bool _inReset;
+    bool _dio0Level;
+
+    //bumped on every mode change so timers belonging to an abandoned operation do nothing
+    uint32_t _operationGeneration;
+    std::shared_ptr<SimFrame> _txFrame;
+    std::shared_ptr<SimFrame> _rxFrame;
+    float _rxRssi;
+};
@@ -0,0 +1,272 @@
+#include "SimAirMedium.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "SimNode.h"
+#include "SimScheduler.h"
+
+//how long finished frames are kept around for collision checks, comfortably longer than any LoRa frame
+#define SIM_AIR_HISTORY_US 30000000
+//preamble symbols a receiver needs to see before it can lock onto a frame that was already on the air
+#define SIM_AIR_PREAMBLE_DETECT_SYMBOLS 4
+//a co-SF frame survives interference if it is this much stronger than the sum of the interferers
+#define SIM_AIR_CAPTURE_DB 6.0
+//spreading factors are quasi-orthogonal: a cross-SF interferer has to be this much stronger to do damage
+#define SIM_AIR_CROSS_SF_REJECTION_DB 16.0
+//the SX127x SNR estimate saturates a little above +10dB
+#define SIM_AIR_MAX_SNR_DB 12.0
+
+//demodulation floor per spreading factor (SX1276 datasheet table 13)
+static double demodulationFloor(uint8_t spreadingFactor) {
+  switch (spreadingFactor) {
+    case 6: return -5.0;
+    case 7: return -7.5;
+    case 8: return -10.0;
+    case 9: return -12.5;
+    case 10: return -15.0;
+    case 11: return -17.5;
+    default: return -20.0;
+  }
+}
+
+//true if the two configs put chirps of the same slope into the same channel
+static bool sameChannel(const SimRadioConfig& a, const SimRadioConfig& b) {
+  const int64_t offset = (int64_t) a.frequency - (int64_t) b.frequency;
+  return (uint64_t) llabs(offset) <= a.bandwidth / 4 && a.bandwidth == b.bandwidth;
+}
+
+static bool overlapsBand(const SimRadioConfig& a, const SimRadioConfig& b) {
+  const int64_t offset = (int64_t) a.frequency - (int64_t) b.frequency;
+  return (uint64_t) llabs(offset) < (a.bandwidth + b.bandwidth) / 2;
+}
+
+static double toMilliwatts(double dbm) {
+  return pow(10.0, dbm / 10.0);
+}
+
+static double toDbm(double milliwatts) {
+  return 10.0 * log10(milliwatts);
+}
+
+SimAirMedium::SimAirMedium(const SimAirConfig& config, uint64_t seed) :
+  _config(config),
+  _rngState(seed * 0x9e3779b97f4a7c15ULL + 0x5a17a1c0ffeeULL),
+  _nextFrameId(1),
+  _busyUs(0),
+  _busyUntil(0) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+double SimAirMedium::random() {
+  _rngState ^= _rngState >> 12;
+  _rngState ^= _rngState << 25;
+  _rngState ^= _rngState >> 27;
+  return ((_rngState * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void SimAirMedium::attach(SX127xSim* radio) {
+  Radio r;
+  r.radio = radio;
+  r.x = random() * _config.areaMeters;
+  r.y = random() * _config.areaMeters;
+  _radios.push_back(r);
+
+  //shadowing is drawn once per link and is the same in both directions
+  const int index = (int) _radios.size() - 1;
+  _pathLoss.push_back(std::vector<double>(_radios.size(), 0.0));
+  for (int i = 0; i < index; i++) {
+    const double distance = std::max(1.0, hypot(_radios[i].x - r.x, _radios[i].y - r.y));
+    const double u1 = std::max(random(), 1e-12);
+    const double u2 = random();
+    const double shadowing = _config.shadowingDb * sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+    const double loss = _config.referenceLossDb + 10.0 * _config.pathLossExponent * log10(distance) + shadowing;
+    _pathLoss[i].push_back(loss);
+    _pathLoss[index][i] = loss;
+  }
+}
+
+int SimAirMedium::radioIndex(SX127xSim* radio) const {
+  for (size_t i = 0; i < _radios.size(); i++) {
+    if (_radios[i].radio == radio) return (int) i;
+  }
+  return -1;
+}
+
+double SimAirMedium::pathLoss(int a, int b) const {
+  return _pathLoss[a][b];
+}
+
+void SimAirMedium::setPathLoss(int a, int b, double lossDb) {
+  _pathLoss[a][b] = lossDb;
+  _pathLoss[b][a] = lossDb;
+}
+
+float SimAirMedium::linkRssi(SX127xSim* from, SX127xSim* to, int8_t txPower) {
+  return (float) (txPower - pathLoss(radioIndex(from), radioIndex(to)));
+}
+
+double SimAirMedium::noiseFloor(uint32_t bandwidth) const {
+  return -174.0 + 10.0 * log10((double) bandwidth) + _config.noiseFigureDb;
+}
+
+void SimAirMedium::startTransmission(std::shared_ptr<SimFrame> frame) {
+  prune();
+  frame->id = _nextFrameId++;
+  _frames.push_back(frame);
+  if (onTransmit) onTransmit(*frame);
+
+  for (size_t i = 0; i < _radios.size(); i++) {
+    if (_radios[i].radio == frame->sender) continue;
+    const int receiver = (int) i;
+    Scheduler.at(frame->start, _radios[i].radio->node(), [this, frame, receiver]() { offer(frame, receiver); });
+  }
+}
+
+void SimAirMedium::abortTransmission(std::shared_ptr<SimFrame> frame) {
+  //the frame now ends early, so whoever locked onto it finds out at the new end
+  scheduleEnd(frame);
+}
+
+void SimAirMedium::scheduleEnd(std::shared_ptr<SimFrame> frame) {
+  const uint64_t end = frame->end;
+  for (size_t i = 0; i < _radios.size(); i++) {
+    if (_radios[i].radio == frame->sender) continue;
+    const int receiver = (int) i;
+    Scheduler.at(end, _radios[i].radio->node(), [this, frame, receiver, end]() { finish(frame, receiver, end); });
+  }
+}
+
+void SimAirMedium::offer(std::shared_ptr<SimFrame> frame, int receiver) {
+  SX127xSim* radio = _radios[receiver].radio;
+  if (radio->receiving() || frame->end <= radio->node()->now()) return;
+  const SimRadioConfig config = radio->config();
+  if (!sameChannel(config, frame->config) || config.spreadingFactor != frame->config.spreadingFactor) return;
+
+  const float rssi = linkRssi(frame->sender, radio, frame->config.txPower);
+  if (rssi - noiseFloor(config.bandwidth) < demodulationFloor(config.spreadingFactor)) {
+    stats.belowSensitivity++;
+    return;
+  }
+  if (!radio->listening()) {
+    stats.missedWhileBusy++;
+    return;
+  }
+  if (random() < _config.packetLoss) {
+    stats.randomLosses++;
+    return;
+  }
+
+  radio->signalStarted(frame, rssi);
+  if (radio->receiving() != frame.get()) return;
+  const uint64_t end = frame->end;
+  Scheduler.at(end, radio->node(), [this, frame, receiver, end]() { finish(frame, receiver, end); });
+}
+
+void SimAirMedium::finish(std::shared_ptr<SimFrame> frame, int receiver, uint64_t scheduledEnd) {
+  //the sender cut the frame short after this was scheduled, a later event handles it
+  if (frame->end != scheduledEnd) return;
+  SX127xSim* radio = _radios[receiver].radio;
+  if (radio->receiving() != frame.get()) return;
+
+  const float rssi = linkRssi(frame->sender, radio, frame->config.txPower);
+  const float snr = (float) std::min(rssi - noiseFloor(radio->config().bandwidth), SIM_AIR_MAX_SNR_DB);
+  const bool collided = corrupted(*frame, receiver, rssi);
+  if (collided) stats.collisions++;
+  else if (!frame->aborted) stats.receptions++;
+  radio->signalEnded(frame, rssi, snr, collided);
+}
+
+bool SimAirMedium::corrupted(const SimFrame& frame, int receiver, float rssi) {
+  SX127xSim* radio = _radios[receiver].radio;
+  double coChannel = 0;
+  for (size_t i = 0; i < _frames.size(); i++) {
+    const SimFrame& other = *_frames[i];
+    if (other.id == frame.id || other.sender == radio) continue;
+    if (other.start >= frame.end || other.end <= frame.start) continue;
+    if (!overlapsBand(frame.config, other.config)) continue;
+
+    const float interference = linkRssi(other.sender, radio, other.config.txPower);
+    if (other.config.spreadingFactor == frame.config.spreadingFactor) {
+      coChannel += toMilliwatts(interference);
+    } else if (interference - rssi > SIM_AIR_CROSS_SF_REJECTION_DB) {
+      return true;
+    }
+  }
+  return coChannel > 0 && rssi - toDbm(coChannel) < SIM_AIR_CAPTURE_DB;
+}
+
+void SimAirMedium::radioListening(SX127xSim* radio) {
+  const int receiver = radioIndex(radio);
+  const uint64_t now = radio->node()->now();
+  const SimRadioConfig config = radio->config();
+  for (size_t i = 0; i < _frames.size(); i++) {
+    std::shared_ptr<SimFrame> frame = _frames[i];
+    if (frame->sender == radio || frame->start > now || frame->end <= now) continue;
+    const uint64_t detectTime = (uint64_t) (SIM_AIR_PREAMBLE_DETECT_SYMBOLS * config.symbolTimeUs());
+    if (now + detectTime > frame->preambleEnd) continue;
+    offer(frame, receiver);
+    if (radio->receiving()) return;
+  }
+}
+
+bool SimAirMedium::channelActivity(SX127xSim* radio, uint64_t start, uint64_t end) {
+  const SimRadioConfig config = radio->config();
+  const double floor = noiseFloor(config.bandwidth) + demodulationFloor(config.spreadingFactor);
+  const uint64_t minimumOverlap = (uint64_t) (config.symbolTimeUs() / 2);
+  bool detected = false;
+  for (size_t i = 0; i < _frames.size(); i++) {
+    const SimFrame& frame = *_frames[i];
+    if (frame.sender == radio) continue;
+    if (!sameChannel(config, frame.config) || config.spreadingFactor != frame.config.spreadingFactor) continue;
+    const uint64_t from = std::max(start, frame.start);
+    const uint64_t to = std::min(end, frame.end);
+    if (to < from + minimumOverlap) continue;
+    if (linkRssi(frame.sender, radio, frame.config.txPower) < floor) continue;
+
+    //the preamble is a run of identical upchirps and is always caught, data symbols only some of the time
+    if (from < frame.preambleEnd || random() < _config.cadPayloadDetection) detected = true;
+  }
+  return detected;
+}
+
+float SimAirMedium::channelRssi(SX127xSim* radio) {
+  const SimRadioConfig config = radio->config();
+  const uint64_t now = radio->node()->now();
+  double power = toMilliwatts(noiseFloor(config.bandwidth));
+  for (size_t i = 0; i < _frames.size(); i++) {
+    const SimFrame& frame = *_frames[i];
+    if (frame.sender == radio || frame.start > now || frame.end <= now) continue;
+    if (!overlapsBand(config, frame.config)) continue;
+    power += toMilliwatts(linkRssi(frame.sender, radio, frame.config.txPower));
+  }
+  return (float) toDbm(power);
+}
+
+//frames have to be fed in start order
+static void accumulateBusy(const SimFrame& frame, uint64_t until, uint64_t* busy, uint64_t* busyUntil) {
+  const uint64_t end = std::min(frame.end, until);
+  if (end <= *busyUntil) return;
+  *busy += end - std::max(frame.start, *busyUntil);
+  *busyUntil = end;
+}
+
+void SimAirMedium::prune() {
+  //frames go out in start order, so the busy time can be tallied as they leave the history
+  const uint64_t now = Scheduler.now();
+  while (!_frames.empty() && _frames.front()->end + SIM_AIR_HISTORY_US < now) {
+    accumulateBusy(*_frames.front(), UINT64_MAX, &_busyUs, &_busyUntil);
+    _frames.pop_front();
+  }
+}
+
+uint64_t SimAirMedium::channelBusyUs(uint64_t until) const {
+  uint64_t busy = _busyUs;
+  uint64_t busyUntil = _busyUntil;
+  for (size_t i = 0; i < _frames.size(); i++) {
+    if (_frames[i]->start < until) accumulateBusy(*_frames[i], until, &busy, &busyUntil);
+  }
+  return busy;
+}
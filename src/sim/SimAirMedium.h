@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "SX127xSim.h"
+
+//A shared channel for any number of radios. Link budgets come from a log-distance path loss model with a fixed per-link
+//shadowing term, so a given seed always produces the same topology.
+//  - a frame is only detected if its SNR clears the demodulation floor for its spreading factor
+//  - overlapping frames collide: the wanted frame survives only if it beats every co-SF interferer by the capture
+//    threshold (6dB), cross-SF interferers need to be 16dB stronger than it to do damage
+//  - a radio that is transmitting hears nothing (the SX127x is half duplex)
+//  - independent random loss can be added on top
+//  - CAD reports activity if a compatible frame overlaps the CAD window and is above the noise, always during the
+//    preamble and with cadPayloadDetection probability during the payload
+
+struct SimAirConfig {
+  double areaMeters = 300;
+  double pathLossExponent = 2.7;
+  double referenceLossDb = 31.7; //free space loss at 1m, 915MHz
+  double shadowingDb = 4.0;
+  double noiseFigureDb = 6.0;
+  double packetLoss = 0.0;
+  double cadPayloadDetection = 0.9;
+};
+
+struct SimAirStats {
+  uint64_t receptions; //frames delivered intact to a listening radio
+  uint64_t collisions; //frames lost to overlapping transmissions at a radio that had locked on to them
+  uint64_t randomLosses;
+  uint64_t belowSensitivity;
+  uint64_t missedWhileBusy; //radio was not listening (TX, CAD, standby) when the frame started
+};
+
+class SimAirMedium : public SimMedium {
+  public:
+    SimAirMedium(const SimAirConfig& config, uint64_t seed);
+
+    virtual void attach(SX127xSim* radio);
+    virtual void startTransmission(std::shared_ptr<SimFrame> frame);
+    virtual void abortTransmission(std::shared_ptr<SimFrame> frame);
+    virtual void radioListening(SX127xSim* radio);
+    virtual bool channelActivity(SX127xSim* radio, uint64_t start, uint64_t end);
+    virtual float channelRssi(SX127xSim* radio);
+
+    //received signal strength of a transmission from one radio at another, in dBm, before fading
+    float linkRssi(SX127xSim* from, SX127xSim* to, int8_t txPower);
+    //override the computed path loss of a link (both directions)
+    void setPathLoss(int a, int b, double lossDb);
+    double noiseFloor(uint32_t bandwidth) const;
+    //time up to until during which at least one frame was on the air
+    uint64_t channelBusyUs(uint64_t until) const;
+
+    std::function<void(const SimFrame&)> onTransmit;
+    SimAirStats stats;
+
+  private:
+    struct Radio {
+      SX127xSim* radio;
+      double x;
+      double y;
+    };
+
+    int radioIndex(SX127xSim* radio) const;
+    double pathLoss(int a, int b) const;
+    double random();
+    void scheduleEnd(std::shared_ptr<SimFrame> frame);
+    void offer(std::shared_ptr<SimFrame> frame, int receiver);
+    void finish(std::shared_ptr<SimFrame> frame, int receiver, uint64_t scheduledEnd);
+    bool corrupted(const SimFrame& frame, int receiver, float rssi);
+    void prune();
+
+    SimAirConfig _config;
+    uint64_t _rngState;
+    std::vector<Radio> _radios;
+    std::vector<std::vector<double>> _pathLoss;
+    std::deque<std::shared_ptr<SimFrame>> _frames; //on the air now or recently, newest last
+    uint64_t _nextFrameId;
+    uint64_t _busyUs; //channel busy time of frames already pruned from the history
+    uint64_t _busyUntil;
+};
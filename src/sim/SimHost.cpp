@@ -0,0 +1,191 @@
+#include "SimHost.h"
+#include "SimNode.h"
+#include "SimScheduler.h"
+
+#include <string.h>
+
+uint16_t simCrcHqx(const uint8_t* data, size_t size) {
+  uint16_t crc = 0x0000;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= (uint16_t) data[i] << 8;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+SimHostComputer::SimHostComputer(SimNode* node, uint32_t epoch) :
+  _node(node),
+  _epoch(epoch),
+  _connected(false),
+  _tag(0x10000 * (node->index + 1)),
+  _connectGeneration(0),
+  _awaitingSack(false),
+  _sendAttempts(0),
+  _sendGeneration(0)
+{
+  memset(&stats, 0, sizeof(stats));
+  node->host = this;
+}
+
+void SimHostComputer::sendPacket(const char* type, const std::vector<uint8_t>& payload) {
+  const uint16_t size = payload.size() + 16;
+  std::vector<uint8_t> packet;
+  packet.reserve(size);
+  packet.push_back(0x12);
+  packet.push_back(0x34);
+  packet.push_back(size >> 8);
+  packet.push_back(size & 0xFF);
+  packet.insert(packet.end(), type, type + 4);
+  packet.push_back(_tag >> 24);
+  packet.push_back((_tag >> 16) & 0xFF);
+  packet.push_back((_tag >> 8) & 0xFF);
+  packet.push_back(_tag & 0xFF);
+  packet.insert(packet.end(), payload.begin(), payload.end());
+  const uint16_t crc = simCrcHqx(&(packet[2]), packet.size() - 2);
+  packet.push_back(crc >> 8);
+  packet.push_back(crc & 0xFF);
+  packet.push_back(0x56);
+  packet.push_back(0x78);
+
+  //the bytes trickle in at the UART's baud rate, the firmware only looks once they are all there
+  SimNode* node = _node;
+  const uint64_t arrival = Scheduler.now() + packet.size() * SIM_UART_NS_PER_BYTE / 1000;
+  Scheduler.at(arrival, NULL, [node, packet]() {
+    node->serialIn.insert(node->serialIn.end(), packet.begin(), packet.end());
+  });
+}
+
+void SimHostComputer::connect(uint64_t time) {
+  const uint32_t generation = ++_connectGeneration;
+  Scheduler.at(time, NULL, [this, generation]() {
+    if (generation != _connectGeneration) return;
+    sendConnect();
+  });
+}
+
+void SimHostComputer::sendConnect() {
+  if (_connected || _node->halted) return;
+  const uint32_t epoch = _epoch + Scheduler.now() / 1000000;
+  std::vector<uint8_t> payload = {(uint8_t) (epoch >> 24), (uint8_t) (epoch >> 16), (uint8_t) (epoch >> 8), (uint8_t) epoch};
+  _tag++;
+  sendPacket("CONN", payload);
+  //no CACK yet (the API task only polls the port every couple of seconds), so try again later
+  const uint32_t generation = ++_connectGeneration;
+  Scheduler.at(Scheduler.now() + SIM_HOST_CONNECT_RETRY_US, NULL, [this, generation]() {
+    if (generation != _connectGeneration) return;
+    sendConnect();
+  });
+}
+
+void SimHostComputer::queueMessage(uint8_t destination, const std::vector<uint8_t>& text) {
+  _outbox.push_back(SimHostMessage{destination, text, Scheduler.now()});
+  stats.messagesQueued++;
+  if (_connected && !_awaitingSack) sendNext();
+}
+
+void SimHostComputer::sendNext() {
+  if (_outbox.empty() || !_connected || _node->halted) return;
+  const SimHostMessage& message = _outbox.front();
+
+  //id, total packets, current packet, name length, text length, name, text
+  std::vector<uint8_t> payload;
+  payload.push_back(message.destination);
+  payload.push_back(0);
+  payload.push_back(1);
+  payload.push_back(0);
+  payload.push_back(1);
+  payload.push_back(0);
+  payload.push_back(message.text.size() >> 8);
+  payload.push_back(message.text.size() & 0xFF);
+  payload.insert(payload.end(), message.text.begin(), message.text.end());
+
+  if (_sendAttempts == 0) _tag++;
+  _sendAttempts++;
+  _awaitingSack = true;
+  sendPacket("SEND", payload);
+
+  const uint32_t generation = ++_sendGeneration;
+  Scheduler.at(Scheduler.now() + SIM_HOST_SEND_TIMEOUT_US, NULL, [this, generation]() {
+    if (generation != _sendGeneration || !_awaitingSack) return;
+    if (_sendAttempts >= SIM_HOST_SEND_ATTEMPTS) {
+      stats.messagesRejected++;
+      _outbox.pop_front();
+      _sendAttempts = 0;
+    } else {
+      stats.sendRetries++;
+    }
+    _awaitingSack = false;
+    sendNext();
+  });
+}
+
+void SimHostComputer::receive(const uint8_t* data, size_t size) {
+  _rx.insert(_rx.end(), data, data + size);
+  while (_rx.size() >= 4) {
+    if (_rx[0] != 0x12 || _rx[1] != 0x34) {
+      _rx.erase(_rx.begin());
+      continue;
+    }
+    const uint16_t packetSize = (_rx[2] << 8) | _rx[3];
+    if (packetSize < 16) {
+      stats.badPackets++;
+      _rx.erase(_rx.begin());
+      continue;
+    }
+    if (_rx.size() < packetSize) return;
+    std::vector<uint8_t> packet(_rx.begin(), _rx.begin() + packetSize);
+    _rx.erase(_rx.begin(), _rx.begin() + packetSize);
+
+    const uint16_t crc = simCrcHqx(&(packet[2]), packetSize - 6);
+    if (packet[packetSize - 4] != (crc >> 8) || packet[packetSize - 3] != (crc & 0xFF) ||
+        packet[packetSize - 2] != 0x56 || packet[packetSize - 1] != 0x78) {
+      stats.badPackets++;
+      continue;
+    }
+    handlePacket(packet);
+  }
+}
+
+void SimHostComputer::handlePacket(const std::vector<uint8_t>& packet) {
+  const uint32_t tag = ((uint32_t) packet[8] << 24) | ((uint32_t) packet[9] << 16) | ((uint32_t) packet[10] << 8) | packet[11];
+
+  if (memcmp(&(packet[4]), "CACK", 4) == 0) {
+    if (!_connected) {
+      _connected = true;
+      _connectGeneration++;
+      sendNext();
+    }
+  } else if (memcmp(&(packet[4]), "SACK", 4) == 0) {
+    //a stale reply (the firmware answers with whatever is in its out buffer) carries an older tag
+    if (_awaitingSack && tag == _tag) {
+      _awaitingSack = false;
+      _sendAttempts = 0;
+      _sendGeneration++;
+      stats.messagesAccepted++;
+      if (onAccepted) onAccepted(_outbox.front());
+      _outbox.pop_front();
+      sendNext();
+    }
+  } else if (memcmp(&(packet[4]), "SEND", 4) == 0) {
+    //forwarded from the air, the sending node put its device ID in front of the receiver ID
+    if (packet.size() < 25) {
+      stats.badPackets++;
+      return;
+    }
+    stats.packetsReceived++;
+    const uint16_t nameLength = packet[18];
+    const uint16_t textLength = (packet[19] << 8) | packet[20];
+    if (21 + nameLength + textLength + 4 > (int) packet.size()) {
+      stats.badPackets++;
+      return;
+    }
+    SimHostDelivery delivery;
+    delivery.sender = packet[12];
+    delivery.receiver = packet[13];
+    delivery.text.assign(packet.begin() + 21 + nameLength, packet.begin() + 21 + nameLength + textLength);
+    delivery.receivedAt = Scheduler.now();
+    if (onDelivery) onDelivery(delivery);
+  }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+//The computer on the other end of a node's USB serial port. It speaks the same framing as src/api
+//(0x1234, size, type, tag, payload, crc_hqx, 0x5678): connects with CONN, then pushes SEND packets one at a time,
+//waiting for the SACK before moving on, and collects every SEND packet the node forwards from the air.
+
+struct SimNode;
+
+struct SimHostMessage {
+  uint8_t destination;
+  std::vector<uint8_t> text;
+  uint64_t queuedAt;
+};
+
+struct SimHostDelivery {
+  uint8_t sender;
+  uint8_t receiver;
+  std::vector<uint8_t> text;
+  uint64_t receivedAt;
+};
+
+struct SimHostStats {
+  uint64_t messagesQueued;
+  uint64_t messagesAccepted; //SACKed by the node
+  uint64_t messagesRejected; //gave up after SIM_HOST_SEND_ATTEMPTS tries without a SACK
+  uint64_t sendRetries;
+  uint64_t packetsReceived;
+  uint64_t badPackets;
+};
+
+#define SIM_HOST_SEND_TIMEOUT_US 6000000
+#define SIM_HOST_SEND_ATTEMPTS 5
+#define SIM_HOST_CONNECT_RETRY_US 5000000
+
+class SimHostComputer {
+  public:
+    SimHostComputer(SimNode* node, uint32_t epoch);
+
+    void connect(uint64_t time);
+    bool connected() const { return _connected; }
+    void queueMessage(uint8_t destination, const std::vector<uint8_t>& text);
+    size_t pendingMessages() const { return _outbox.size(); }
+
+    //bytes written by the node, arriving now
+    void receive(const uint8_t* data, size_t size);
+
+    std::function<void(const SimHostDelivery&)> onDelivery;
+    std::function<void(const SimHostMessage&)> onAccepted;
+    SimHostStats stats;
+
+  private:
+    void sendPacket(const char* type, const std::vector<uint8_t>& payload);
+    void sendConnect();
+    void sendNext();
+    void handlePacket(const std::vector<uint8_t>& packet);
+
+    SimNode* _node;
+    uint32_t _epoch; //wall clock at virtual time zero
+    bool _connected;
+    uint32_t _tag;
+    uint32_t _connectGeneration;
+
+    std::deque<SimHostMessage> _outbox;
+    bool _awaitingSack;
+    uint32_t _sendAttempts;
+    uint32_t _sendGeneration;
+
+    std::vector<uint8_t> _rx;
+};
+
+uint16_t simCrcHqx(const uint8_t* data, size_t size);
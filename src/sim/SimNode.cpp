@@ -0,0 +1,224 @@
+#include "Arduino.h"
+#include "SimNode.h"
+#include "SimHost.h"
+#include "SX127xSim.h"
+
+#include <dlfcn.h>
+#include <string.h>
+#include <unistd.h>
+
+static SimNode* currentNode = NULL;
+
+SimNode* simCurrentNode() {
+  return currentNode;
+}
+
+uint64_t SimUart::write(uint64_t now, size_t size) {
+  const uint64_t nowNs = now * 1000;
+  drainedAtNs = std::max(drainedAtNs, nowNs) + (uint64_t) size * SIM_UART_NS_PER_BYTE;
+  const uint64_t fifoNs = (uint64_t) (SIM_UART_FIFO_SIZE + bufferSize) * SIM_UART_NS_PER_BYTE;
+  return drainedAtNs > nowNs + fifoNs ? (drainedAtNs - nowNs - fifoNs) / 1000 : 0;
+}
+
+//Arduino's loopTask: setup() once, then loop() forever
+static void loopTask(void* params) {
+  SimNode* node = (SimNode*) params;
+  node->firmware.setup();
+  while (1) {
+    node->firmware.loop();
+    node->stats.loopIterations++;
+    //the real loop spins flat out, here every pass costs loopPeriodUs so idle nodes don't swamp the scheduler
+    Scheduler.block(node->now() + node->loopPeriodUs);
+  }
+}
+
+SimNode::SimNode(int index, SimFirmware firmware, SimMedium* medium, uint64_t seed) :
+  index(index),
+  firmware(firmware),
+  host(NULL),
+  halted(false),
+  activationBusyNs(0),
+  loopPeriodUs(1000),
+  logFile(NULL)
+{
+  busyUntil[0] = 0;
+  busyUntil[1] = 0;
+  memset(pinLevel, 0, sizeof(pinLevel));
+  memset(pinIsr, 0, sizeof(pinIsr));
+  memset(pinIsrMode, 0, sizeof(pinIsrMode));
+  memset(&stats, 0, sizeof(stats));
+  rngState = seed * 0x9e3779b97f4a7c15ULL + (uint64_t) index * 0xbf58476d1ce4e5b9ULL + 1;
+  radio = new SX127xSim(this, medium);
+}
+
+SimNode::~SimNode() {
+  delete radio;
+  if (logFile) fclose(logFile);
+}
+
+void SimNode::start(uint64_t time) {
+  Scheduler.at(time, this, [this]() {
+    Scheduler.createTask(this, "loopTask", loopTask, this, 1);
+  });
+}
+
+void SimNode::halt(const char* reason) {
+  if (halted) return;
+  halted = true;
+  fprintf(stderr, "[%10.6f] node %d halted: %s. Last debug output:\n", now() / 1e6, index, reason);
+  dumpLog(stderr);
+  for (SimTask* task : tasks) task->halted = true;
+  //the firmware spins forever after HALT(), so never hand the CPU back to the calling task
+  if (Scheduler.currentTask() && Scheduler.currentTask()->node == this) {
+    Scheduler.block(UINT64_MAX);
+  }
+}
+
+uint64_t SimNode::now() const {
+  return Scheduler.now() + (currentNode == this ? activationBusyNs / 1000 : 0);
+}
+
+void SimNode::beginActivation() {
+  currentNode = this;
+  activationBusyNs = 0;
+}
+
+void SimNode::endActivation(int core) {
+  const uint64_t busyUs = activationBusyNs / 1000;
+  if (core >= 0) {
+    busyUntil[core] = std::max(busyUntil[core], Scheduler.now() + busyUs);
+    stats.cpuBusyUs += busyUs;
+  }
+  activationBusyNs = 0;
+  currentNode = NULL;
+}
+
+void SimNode::consumeCpu(uint64_t us) {
+  activationBusyNs += us * 1000;
+}
+
+void SimNode::consumeCpuNs(uint64_t ns) {
+  activationBusyNs += ns;
+}
+
+void SimNode::writePin(uint8_t pin, uint8_t level) {
+  if (pin >= SIM_PIN_COUNT) return;
+  const uint8_t old = pinLevel[pin];
+  pinLevel[pin] = level;
+  if (old == level) return;
+
+  if (pin == SIM_SS_PIN) {
+    if (level == 0) {
+      radio->select();
+    } else {
+      radio->deselect();
+    }
+  } else if (pin == SIM_RESET_PIN) {
+    if (level == 0) {
+      radio->holdReset();
+    } else {
+      radio->releaseReset();
+    }
+  }
+}
+
+void SimNode::driveInput(uint8_t pin, uint8_t level) {
+  if (pin >= SIM_PIN_COUNT || halted) return;
+  const uint8_t old = pinLevel[pin];
+  pinLevel[pin] = level;
+  if (old == level || !pinIsr[pin]) return;
+
+  const bool rising = level && !old;
+  const int mode = pinIsrMode[pin];
+  if (mode == CHANGE || (mode == RISING && rising) || (mode == FALLING && !rising)) {
+    pinIsr[pin]();
+  }
+}
+
+void SimNode::serialWrite(const uint8_t* data, size_t size) {
+  const uint64_t stall = serialOut.write(now(), size);
+  const uint64_t arrival = serialOut.drainedAtNs / 1000;
+  if (host) {
+    std::vector<uint8_t> bytes(data, data + size);
+    Scheduler.at(arrival, NULL, [this, bytes]() { host->receive(&(bytes[0]), bytes.size()); });
+  }
+  if (stall > 0 && Scheduler.currentTask() && Scheduler.currentTask()->node == this) {
+    Scheduler.block(now() + stall);
+  }
+}
+
+void SimNode::logWrite(const uint8_t* data, size_t size) {
+  stats.logBytes += size;
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] == '\n') {
+      if (logFile) fprintf(logFile, "[%10.6f] %s\n", now() / 1e6, logLine.c_str());
+      logHistory.push_back(logLine);
+      if (logHistory.size() > SIM_LOG_HISTORY) logHistory.pop_front();
+      logLine.clear();
+    } else {
+      logLine.push_back((char) data[i]);
+    }
+  }
+
+  //blocking on the UART lets other tasks run, exactly like the ESP32 UART driver waiting for FIFO space
+  const uint64_t stall = logOut.write(now(), size);
+  if (stall > 0) {
+    stats.logStallUs += stall;
+    if (Scheduler.currentTask() && Scheduler.currentTask()->node == this) {
+      Scheduler.block(now() + stall);
+    }
+  }
+}
+
+void SimNode::dumpLog(FILE* out) {
+  for (const std::string& line : logHistory) {
+    fprintf(out, "    %s\n", line.c_str());
+  }
+  if (!logLine.empty()) fprintf(out, "    %s\n", logLine.c_str());
+}
+
+uint32_t SimNode::random() {
+  //xorshift64*, seeded per node so runs are reproducible
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return (uint32_t) ((rngState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+bool simLoadFirmware(const char* path, int index, SimFirmware* firmware) {
+  //dlopen hands back the already loaded image for a path it has seen, so each node loads from its own copy
+  char copyPath[256];
+  snprintf(copyPath, sizeof(copyPath), "/tmp/locomm-sim-%d-%d.so", (int) getpid(), index);
+  FILE* in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "could not open firmware image %s\n", path);
+    return false;
+  }
+  FILE* out = fopen(copyPath, "wb");
+  if (!out) {
+    fclose(in);
+    fprintf(stderr, "could not create %s\n", copyPath);
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) fwrite(buffer, 1, n, out);
+  fclose(in);
+  fclose(out);
+
+  void* handle = dlopen(copyPath, RTLD_NOW | RTLD_LOCAL);
+  unlink(copyPath);
+  if (!handle) {
+    fprintf(stderr, "could not load firmware: %s\n", dlerror());
+    return false;
+  }
+  firmware->handle = handle;
+  firmware->setup = (void (*)()) dlsym(handle, "simFirmwareSetup");
+  firmware->loop = (void (*)()) dlsym(handle, "simFirmwareLoop");
+  firmware->deviceID = (uint8_t (*)()) dlsym(handle, "simFirmwareDeviceID");
+  if (!firmware->setup || !firmware->loop || !firmware->deviceID) {
+    fprintf(stderr, "firmware image is missing its simulator entry points\n");
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "SimScheduler.h"
+#include "esp.h"
+
+//pins the simulated board wires to the SX127x, taken from the firmware's own pin map
+#define SIM_SS_PIN SS_LORA
+#define SIM_RESET_PIN RST_LORA
+#define SIM_DIO0_PIN DIO0_LORA
+
+#define SIM_PIN_COUNT 40
+#define SIM_LOG_HISTORY 40
+
+//CPU cost model. SPI runs at the LoRa library's 8MHz default, the UARTs at the 115200 baud the firmware configures
+#define SIM_SPI_TRANSACTION_OVERHEAD_US 3
+#define SIM_SPI_NS_PER_BYTE 1000
+#define SIM_UART_NS_PER_BYTE 86806
+#define SIM_UART_FIFO_SIZE 128
+
+class SX127xSim;
+class SimMedium;
+class SimHostComputer;
+
+//entry points exported by one loaded copy of the firmware (see firmwareEntry.cpp)
+struct SimFirmware {
+  void (*setup)();
+  void (*loop)();
+  uint8_t (*deviceID)();
+  void* handle;
+};
+
+struct SimNodeStats {
+  uint64_t spiTransactions;
+  uint64_t spiBytes;
+  uint64_t cpuBusyUs;
+  uint64_t loopIterations;
+  uint64_t logBytes;
+  uint64_t logStallUs; //time spent blocked on a full debug UART FIFO
+  uint64_t cryptoOperations;
+};
+
+//A simulated UART that drains at the configured baud rate. Writes stall the caller once the FIFO, and the driver's TX
+//buffer if the firmware asked for one, is full
+struct SimUart {
+  uint64_t drainedAtNs = 0; //virtual time at which everything written so far has left the FIFO
+  size_t bufferSize = 0; //set by HardwareSerial::setTxBufferSize()
+  //returns how long the writer has to wait before the bytes fit in the FIFO
+  uint64_t write(uint64_t now, size_t size);
+};
+
+struct SimNode {
+  SimNode(int index, SimFirmware firmware, SimMedium* medium, uint64_t seed);
+  ~SimNode();
+
+  void start(uint64_t time);
+  void halt(const char* reason);
+
+  //virtual time as seen by code running on this node, including CPU time it has used since it was scheduled
+  uint64_t now() const;
+  void beginActivation();
+  //core is the CPU the activation ran on, or -1 for timer and interrupt events which are not charged to a core
+  void endActivation(int core);
+  void consumeCpu(uint64_t us);
+  void consumeCpuNs(uint64_t ns);
+
+  //pins driven by the firmware
+  void writePin(uint8_t pin, uint8_t level);
+  //pins driven by peripherals, which may fire an attached ISR
+  void driveInput(uint8_t pin, uint8_t level);
+
+  //Serial (USB to the host computer)
+  void serialWrite(const uint8_t* data, size_t size);
+  //Serial1 (debug log)
+  void logWrite(const uint8_t* data, size_t size);
+  void dumpLog(FILE* out);
+
+  uint32_t random();
+
+  int index;
+  SimFirmware firmware;
+  SX127xSim* radio;
+  SimHostComputer* host;
+  std::vector<SimTask*> tasks;
+  bool halted;
+
+  uint64_t activationBusyNs;
+  uint64_t busyUntil[2];
+  uint64_t loopPeriodUs;
+
+  uint8_t pinLevel[SIM_PIN_COUNT];
+  void (*pinIsr[SIM_PIN_COUNT])();
+  int pinIsrMode[SIM_PIN_COUNT];
+
+  std::deque<uint8_t> serialIn;
+  SimUart serialOut;
+  SimUart logOut;
+  FILE* logFile;
+  std::string logLine;
+  std::deque<std::string> logHistory;
+
+  uint64_t rngState;
+  SimNodeStats stats;
+};
+
+//node whose code is running right now, NULL between activations
+SimNode* simCurrentNode();
+
+//load a private copy of the firmware shared object, so every node gets its own globals
+bool simLoadFirmware(const char* path, int index, SimFirmware* firmware);
@@ -0,0 +1,108 @@
+#include "SimScheduler.h"
+#include "SimNode.h"
+
+#include <stdlib.h>
+
+#define SIM_TASK_STACK_SIZE (256 * 1024)
+
+SimScheduler Scheduler;
+
+static SimTask* startingTask = NULL;
+
+void SimScheduler::at(uint64_t time, SimNode* node, std::function<void()> fn) {
+  if (time < _now) time = _now;
+  _events.push(Event{time, _sequence++, node, NULL, 0, fn});
+}
+
+SimTask* SimScheduler::createTask(SimNode* node, const char* name, TaskFunction_t fn, void* params, int core) {
+  SimTask* task = new SimTask();
+  task->node = node;
+  task->name = name;
+  task->fn = fn;
+  task->params = params;
+  task->core = core & 1;
+  task->stack = (uint8_t*) malloc(SIM_TASK_STACK_SIZE);
+  task->waitGeneration = 0;
+  task->waitingForNotify = false;
+  task->notifyPending = false;
+  task->notifyValue = 0;
+  task->waitingQueue = NULL;
+  task->halted = false;
+  task->started = false;
+
+  getcontext(&(task->context));
+  task->context.uc_stack.ss_sp = task->stack;
+  task->context.uc_stack.ss_size = SIM_TASK_STACK_SIZE;
+  task->context.uc_link = &_schedulerContext;
+  makecontext(&(task->context), (void (*)()) taskEntry, 0);
+
+  node->tasks.push_back(task);
+  wake(task, node->now());
+  return task;
+}
+
+void SimScheduler::taskEntry() {
+  SimTask* task = startingTask;
+  task->fn(task->params);
+  //FreeRTOS tasks never return, treat it like a halt so the task is never scheduled again
+  task->halted = true;
+  Scheduler.block(UINT64_MAX);
+}
+
+void SimScheduler::wake(SimTask* task, uint64_t time) {
+  if (task->halted) return;
+  task->waitGeneration++;
+  if (time < _now) time = _now;
+  _events.push(Event{time, _sequence++, task->node, task, task->waitGeneration, nullptr});
+}
+
+void SimScheduler::block(uint64_t wakeTime) {
+  SimTask* task = _current;
+  task->node->endActivation(task->core);
+  uint32_t generation = ++task->waitGeneration;
+  if (wakeTime != UINT64_MAX && !task->halted) {
+    _events.push(Event{wakeTime, _sequence++, task->node, task, generation, nullptr});
+  }
+  swapcontext(&(task->context), &_schedulerContext);
+}
+
+void SimScheduler::resume(SimTask* task) {
+  _current = task;
+  task->node->beginActivation();
+  if (!task->started) {
+    //first activation goes through taskEntry, which picks the task up from startingTask
+    task->started = true;
+    startingTask = task;
+  }
+  swapcontext(&_schedulerContext, &(task->context));
+  _current = NULL;
+}
+
+bool SimScheduler::runUntil(uint64_t endTime) {
+  while (!_events.empty()) {
+    if (_events.top().time > endTime) {
+      _now = endTime;
+      return true;
+    }
+    Event event = _events.top();
+    _events.pop();
+    _now = event.time;
+    _eventsProcessed++;
+
+    if (event.task) {
+      SimTask* task = event.task;
+      if (task->halted || event.generation != task->waitGeneration) continue; //stale wakeup
+      //the core may still be busy with work charged to another task's activation
+      if (task->node->busyUntil[task->core] > _now) {
+        wake(task, task->node->busyUntil[task->core]);
+        continue;
+      }
+      resume(task);
+    } else {
+      if (event.node) event.node->beginActivation();
+      event.fn();
+      if (event.node) event.node->endActivation(-1);
+    }
+  }
+  return false;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+
+//Discrete event scheduler behind the simulator's virtual clock. Time is in microseconds.
+//Firmware tasks run as coroutines and only give the CPU back when they block, everything else
+//(radio timers, ISRs, the simulated host computer) runs as a timed event between task activations.
+
+struct SimNode;
+
+struct SimTask {
+  SimNode* node;
+  const char* name;
+  TaskFunction_t fn;
+  void* params;
+  int core;
+  ucontext_t context;
+  uint8_t* stack;
+  uint32_t waitGeneration; //bumped every time the task is woken, so stale timeouts can be ignored
+  bool waitingForNotify;
+  bool notifyPending;
+  uint32_t notifyValue;
+  struct SimQueue* waitingQueue;
+  bool halted;
+  bool started;
+};
+
+struct SimQueue {
+  size_t itemSize;
+  size_t length;
+  std::deque<std::vector<uint8_t>> items;
+  std::vector<SimTask*> waiters;
+};
+
+class SimScheduler {
+  public:
+    uint64_t now() const { return _now; }
+
+    //run fn at the given time on behalf of node (which may be NULL for simulator-level events)
+    void at(uint64_t time, SimNode* node, std::function<void()> fn);
+
+    SimTask* createTask(SimNode* node, const char* name, TaskFunction_t fn, void* params, int core);
+    SimTask* currentTask() { return _current; }
+
+    //wake a blocked task at the given time
+    void wake(SimTask* task, uint64_t time);
+
+    //only valid from inside a task: give up the CPU until woken or until wakeTime. UINT64_MAX waits forever
+    void block(uint64_t wakeTime);
+
+    //run events until the clock would pass endTime. Returns false if there was nothing left to run
+    bool runUntil(uint64_t endTime);
+
+    uint64_t eventsProcessed() const { return _eventsProcessed; }
+
+  private:
+    struct Event {
+      uint64_t time;
+      uint64_t sequence;
+      SimNode* node;
+      SimTask* task;
+      uint32_t generation;
+      std::function<void()> fn;
+    };
+    struct EventOrder {
+      bool operator()(const Event& a, const Event& b) const {
+        return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+      }
+    };
+
+    void resume(SimTask* task);
+    static void taskEntry();
+
+    std::priority_queue<Event, std::vector<Event>, EventOrder> _events;
+    uint64_t _now = 0;
+    uint64_t _sequence = 0;
+    uint64_t _eventsProcessed = 0;
+    SimTask* _current = NULL;
+    ucontext_t _schedulerContext;
+};
+
+extern SimScheduler Scheduler;
@@ -0,0 +1,30 @@
+//Builds esp.ino as a plain C++ translation unit. The Arduino IDE would generate prototypes for the sketch's functions,
+//the Makefile does the same into espPrototypes.h. The whole firmware ends up in one shared object that the simulator
+//loads once per node.
+
+#include "functions.h"
+#include "globals.h"
+#include "apiCode.h"
+#include "security_protocol.h"
+#include "radioTask.h"
+#include "ReassemblyTable.h"
+#include "RxPacketRing.h"
+#include "espPrototypes.h"
+
+#include "esp.ino"
+
+extern "C" {
+
+void simFirmwareSetup() {
+  setup();
+}
+
+void simFirmwareLoop() {
+  loop();
+}
+
+uint8_t simFirmwareDeviceID() {
+  return deviceID;
+}
+
+}
@@ -0,0 +1,426 @@
+//Implementations behind the headers in include/. Everything resolves the node it acts on through simCurrentNode(),
+//so one set of shims serves every copy of the firmware loaded into the process
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "Wire.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/sha256.h"
+
+#include "SimNode.h"
+#include "SimScheduler.h"
+#include "SX127xSim.h"
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+SPIClass SPI;
+TwoWire Wire;
+
+static SimNode* node() {
+  SimNode* n = simCurrentNode();
+  if (!n) {
+    fprintf(stderr, "firmware code ran outside of a node activation\n");
+    abort();
+  }
+  return n;
+}
+
+static bool inTask() {
+  return Scheduler.currentTask() != NULL;
+}
+
+// ------------------------------------------------------------- time --------------------------------------------------------------
+
+unsigned long millis() {
+  return (unsigned long) (node()->now() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long) node()->now();
+}
+
+void delay(uint32_t ms) {
+  if (inTask()) {
+    Scheduler.block(node()->now() + (uint64_t) ms * 1000);
+  } else {
+    node()->consumeCpu((uint64_t) ms * 1000);
+  }
+}
+
+void delayMicroseconds(uint32_t us) {
+  node()->consumeCpu(us);
+}
+
+void yield() {
+  //let anything else on the node run, and let time move so busy-wait loops make progress
+  if (inTask()) Scheduler.block(node()->now() + 10);
+}
+
+// ------------------------------------------------------------- pins --------------------------------------------------------------
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  node()->writePin(pin, val);
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? node()->pinLevel[pin] : 0;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode) {
+  if (pin >= SIM_PIN_COUNT) return;
+  node()->pinIsr[pin] = isr;
+  node()->pinIsrMode[pin] = mode;
+}
+
+void detachInterrupt(uint8_t pin) {
+  if (pin >= SIM_PIN_COUNT) return;
+  node()->pinIsr[pin] = NULL;
+}
+
+// ------------------------------------------------------------- random ------------------------------------------------------------
+
+uint32_t esp_random() {
+  return node()->random();
+}
+
+void esp_fill_random(void* buf, size_t len) {
+  uint8_t* out = (uint8_t*) buf;
+  for (size_t i = 0; i < len; i++) out[i] = (uint8_t) node()->random();
+}
+
+// ------------------------------------------------------------- Print / Serial ----------------------------------------------------
+
+size_t Print::printf(const char* format, ...) {
+  char stackBuffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(stackBuffer, sizeof(stackBuffer), format, args);
+  va_end(args);
+  if (length < 0) return 0;
+  if ((size_t) length < sizeof(stackBuffer)) return write((const uint8_t*) stackBuffer, length);
+
+  char* heapBuffer = (char*) malloc(length + 1);
+  va_start(args, format);
+  vsnprintf(heapBuffer, length + 1, format, args);
+  va_end(args);
+  const size_t written = write((const uint8_t*) heapBuffer, length);
+  free(heapBuffer);
+  return written;
+}
+
+size_t Print::print(long n, int base) {
+  char buffer[72];
+  if (base == HEX) {
+    snprintf(buffer, sizeof(buffer), "%lX", (unsigned long) n);
+  } else {
+    snprintf(buffer, sizeof(buffer), "%ld", n);
+  }
+  return write(buffer);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buffer[72];
+  snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%lu", n);
+  return write(buffer);
+}
+
+size_t Print::print(double n, int digits) {
+  char buffer[72];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+  return write(buffer);
+}
+
+size_t HardwareSerial::write(uint8_t byte) {
+  return write(&byte, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (_port == 0) {
+    node()->serialWrite(buffer, size);
+  } else {
+    node()->logWrite(buffer, size);
+  }
+  return size;
+}
+
+size_t HardwareSerial::setTxBufferSize(size_t size) {
+  (_port == 0 ? node()->serialOut : node()->logOut).bufferSize = size;
+  return size;
+}
+
+int HardwareSerial::available() {
+  return _port == 0 ? (int) node()->serialIn.size() : 0;
+}
+
+int HardwareSerial::read() {
+  if (_port != 0 || node()->serialIn.empty()) return -1;
+  const uint8_t value = node()->serialIn.front();
+  node()->serialIn.pop_front();
+  return value;
+}
+
+int HardwareSerial::peek() {
+  if (_port != 0 || node()->serialIn.empty()) return -1;
+  return node()->serialIn.front();
+}
+
+size_t HardwareSerial::println(const char* str) {
+  if (strcmp(str, "Halting") == 0) {
+    node()->halt("HALT()");
+  }
+  size_t n = print(str);
+  return n + println();
+}
+
+// ------------------------------------------------------------- SPI ---------------------------------------------------------------
+
+void SPIClass::beginTransaction(SPISettings settings) {
+  _settings = settings;
+  node()->stats.spiTransactions++;
+  node()->consumeCpu(SIM_SPI_TRANSACTION_OVERHEAD_US);
+}
+
+void SPIClass::endTransaction() {}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  node()->stats.spiBytes++;
+  node()->consumeCpuNs(SIM_SPI_NS_PER_BYTE);
+  return node()->radio->transfer(data);
+}
+
+void SPIClass::transfer(void* data, uint32_t size) {
+  uint8_t* bytes = (uint8_t*) data;
+  for (uint32_t i = 0; i < size; i++) bytes[i] = transfer(bytes[i]);
+}
+
+void SPIClass::writeBytes(const uint8_t* data, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) transfer(data[i]);
+}
+
+void SPIClass::transferBytes(const uint8_t* data, uint8_t* out, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    const uint8_t value = transfer(data ? data[i] : 0xff);
+    if (out) out[i] = value;
+  }
+}
+
+// ------------------------------------------------------------- FreeRTOS ----------------------------------------------------------
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* params,
+                                           UBaseType_t priority, StackType_t* stack, StaticTask_t* tcb, BaseType_t core) {
+  return Scheduler.createTask(node(), name, fn, params, core);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* params,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  TaskHandle_t task = Scheduler.createTask(node(), name, fn, params, core);
+  if (handle) *handle = task;
+  return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return Scheduler.currentTask();
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks * portTICK_PERIOD_MS);
+}
+
+static uint64_t ticksToDeadline(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) return UINT64_MAX;
+  return node()->now() + (uint64_t) ticks * portTICK_PERIOD_MS * 1000;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  switch (action) {
+    case eSetBits: task->notifyValue |= value; break;
+    case eIncrement: task->notifyValue++; break;
+    case eSetValueWithOverwrite: task->notifyValue = value; break;
+    case eSetValueWithoutOverwrite:
+      if (task->notifyPending) return pdFAIL;
+      task->notifyValue = value;
+      break;
+    case eNoAction: break;
+  }
+  task->notifyPending = true;
+  if (task->waitingForNotify) {
+    task->waitingForNotify = false;
+    Scheduler.wake(task, node()->now());
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* higherPriorityTaskWoken) {
+  if (higherPriorityTaskWoken) *higherPriorityTaskWoken = pdTRUE;
+  return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t ticks) {
+  SimTask* task = Scheduler.currentTask();
+  if (!task->notifyPending) {
+    task->notifyValue &= ~clearOnEntry;
+    if (ticks == 0) return pdFALSE;
+    task->waitingForNotify = true;
+    Scheduler.block(ticksToDeadline(ticks));
+    task->waitingForNotify = false;
+    if (!task->notifyPending) return pdFALSE;
+  }
+  if (value) *value = task->notifyValue;
+  task->notifyValue &= ~clearOnExit;
+  task->notifyPending = false;
+  return pdTRUE;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+  xTaskNotifyFromISR(task, 0, eIncrement, higherPriorityTaskWoken);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  return xTaskNotify(task, 0, eIncrement);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  SimTask* task = Scheduler.currentTask();
+  if (task->notifyValue == 0 && ticks != 0) {
+    task->waitingForNotify = true;
+    Scheduler.block(ticksToDeadline(ticks));
+    task->waitingForNotify = false;
+  }
+  const uint32_t value = task->notifyValue;
+  if (value > 0) task->notifyValue = clearOnExit ? 0 : value - 1;
+  task->notifyPending = task->notifyValue > 0;
+  return value;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t* storage, StaticQueue_t* buffer) {
+  return xQueueCreate(length, itemSize);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  SimQueue* queue = new SimQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+static void wakeQueueWaiters(SimQueue* queue) {
+  for (SimTask* task : queue->waiters) {
+    task->waitingQueue = NULL;
+    Scheduler.wake(task, node()->now());
+  }
+  queue->waiters.clear();
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+  //nothing in the firmware blocks on a full queue, so a full queue always fails straight away
+  if (queue->items.size() >= queue->length) return errQUEUE_FULL;
+  const uint8_t* bytes = (const uint8_t*) item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  wakeQueueWaiters(queue);
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken) {
+  if (higherPriorityTaskWoken) *higherPriorityTaskWoken = pdTRUE;
+  return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+  if (queue->items.empty() && ticks != 0) {
+    const uint64_t deadline = ticksToDeadline(ticks);
+    SimTask* task = Scheduler.currentTask();
+    while (queue->items.empty() && node()->now() < deadline) {
+      task->waitingQueue = queue;
+      queue->waiters.push_back(task);
+      Scheduler.block(deadline);
+      if (task->waitingQueue) {
+        //timed out, take ourselves off the wait list
+        queue->waiters.erase(std::remove(queue->waiters.begin(), queue->waiters.end(), task), queue->waiters.end());
+        task->waitingQueue = NULL;
+      }
+    }
+  }
+  if (queue->items.empty()) return pdFALSE;
+  memcpy(item, &(queue->items.front()[0]), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  return queue->items.size();
+}
+
+// ------------------------------------------------------------- ROM / mbedtls -----------------------------------------------------
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  static uint32_t table[256];
+  static bool tableReady = false;
+  if (!tableReady) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int j = 0; j < 8; j++) c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+      table[i] = c;
+    }
+    tableReady = true;
+  }
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static const uint32_t sha256RoundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Block(uint32_t state[8], const uint8_t block[64]) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t) block[i * 4] << 24) | ((uint32_t) block[i * 4 + 1] << 16) | ((uint32_t) block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    const uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    const uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256RoundConstants[i] + w[i];
+    const uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+  }
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+int mbedtls_sha256(const unsigned char* input, size_t ilen, unsigned char output[32], int is224) {
+  uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  size_t i = 0;
+  for (; i + 64 <= ilen; i += 64) sha256Block(state, input + i);
+
+  uint8_t tail[128] = {0};
+  const size_t rest = ilen - i;
+  memcpy(tail, input + i, rest);
+  tail[rest] = 0x80;
+  const size_t tailSize = rest < 56 ? 64 : 128;
+  const uint64_t bits = (uint64_t) ilen * 8;
+  for (int j = 0; j < 8; j++) tail[tailSize - 1 - j] = (uint8_t) (bits >> (8 * j));
+  sha256Block(state, tail);
+  if (tailSize == 128) sha256Block(state, tail + 64);
+
+  for (int j = 0; j < 8; j++) {
+    output[j * 4] = state[j] >> 24;
+    output[j * 4 + 1] = (state[j] >> 16) & 0xff;
+    output[j * 4 + 2] = (state[j] >> 8) & 0xff;
+    output[j * 4 + 3] = state[j] & 0xff;
+  }
+  return 0;
+}
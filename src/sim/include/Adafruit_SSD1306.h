@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "Adafruit_GFX.h"
+
+#define SSD1306_SWITCHCAPVCC 0x02
+#define SSD1306_EXTERNALVCC 0x01
+#define SSD1306_BLACK 0
+#define SSD1306_WHITE 1
+
+//The OLED has no observable effect in the simulator, text sent to it is dropped
+class Adafruit_SSD1306 : public Print {
+  public:
+    Adafruit_SSD1306(int16_t w, int16_t h, TwoWire* twi = &Wire, int8_t rst = -1) {}
+    bool begin(uint8_t vcs = SSD1306_SWITCHCAPVCC, uint8_t addr = 0, bool reset = true, bool periphBegin = true) { return true; }
+    void clearDisplay() {}
+    void display() {}
+    void setTextColor(uint16_t c) {}
+    void setTextSize(uint8_t s) {}
+    void setCursor(int16_t x, int16_t y) {}
+    virtual size_t write(uint8_t byte) { return 1; }
+    virtual size_t write(const uint8_t* buffer, size_t size) { return size; }
+    using Print::write;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+//Host stand-in for the parts of the ESP32 Arduino core the firmware uses.
+//Everything here forwards to the simulator (see SimNode.h), which keeps one virtual clock and one set of pins per node.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+
+#include "freertos/FreeRTOS.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x01
+#define OUTPUT 0x03
+
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+
+#define DEC 10
+#define HEX 16
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+
+#define F(x) (x)
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+#define digitalPinToInterrupt(p) (p)
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+//the ESP32 core pulls these in from the standard library as well
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+uint32_t esp_random();
+void esp_fill_random(void* buf, size_t len);
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char* str) { return str ? write((const uint8_t*) str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*) buffer, size); }
+
+    size_t printf(const char* format, ...);
+    size_t print(const char* str) { return write(str); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(int n, int base = DEC) { return print((long) n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long) n, base); }
+    size_t print(double n, int digits = 2);
+    size_t println() { return write("\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    size_t readBytes(uint8_t* buffer, size_t length) {
+      size_t count = 0;
+      while (count < length) {
+        int c = read();
+        if (c < 0) break;
+        buffer[count++] = (uint8_t) c;
+      }
+      return count;
+    }
+    size_t readBytes(char* buffer, size_t length) { return readBytes((uint8_t*) buffer, length); }
+
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+//Serial is the USB link to the host computer, Serial1 is the debug log. Both belong to whichever node is currently running
+class HardwareSerial : public Stream {
+  public:
+    explicit HardwareSerial(int port) : _port(port) {}
+    void begin(unsigned long baud) {}
+    void end() {}
+    void setPins(int rx, int tx) {}
+    size_t setRxBufferSize(size_t size) { return size; }
+    size_t setTxBufferSize(size_t size);
+    operator bool() const { return true; }
+
+    virtual size_t write(uint8_t byte);
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+    virtual void flush() {}
+
+    //the firmware halts by printing "Halting" and spinning forever, which would hang the simulator
+    size_t println(const char* str);
+    using Print::println;
+
+  private:
+    int _port;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
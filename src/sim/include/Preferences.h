@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Arduino.h"
+#include <map>
+#include <string>
+#include <vector>
+
+//In-memory NVS. Each Preferences object is its own store, and every node has its own object
+class Preferences {
+  public:
+    bool begin(const char* name, bool readOnly = false, const char* partition = NULL) { return true; }
+    void end() {}
+    bool clear() { _store.clear(); return true; }
+    bool remove(const char* key) { return _store.erase(key) > 0; }
+    bool isKey(const char* key) { return _store.count(key) > 0; }
+
+    size_t putBytes(const char* key, const void* value, size_t len) {
+      _store[key].assign((const uint8_t*) value, (const uint8_t*) value + len);
+      return len;
+    }
+    size_t getBytesLength(const char* key) {
+      auto it = _store.find(key);
+      return it == _store.end() ? 0 : it->second.size();
+    }
+    size_t getBytes(const char* key, void* buf, size_t maxLen) {
+      auto it = _store.find(key);
+      if (it == _store.end() || it->second.size() > maxLen) return 0;
+      memcpy(buf, it->second.data(), it->second.size());
+      return it->second.size();
+    }
+
+  private:
+    std::map<std::string, std::vector<uint8_t>> _store;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+
+class SPISettings {
+  public:
+    SPISettings() : clock(1000000), bitOrder(MSBFIRST), dataMode(SPI_MODE0) {}
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+    uint32_t clock;
+    uint8_t bitOrder;
+    uint8_t dataMode;
+};
+
+//Shifts bytes into whichever simulated SX127x currently has its chip select pulled low on the running node
+class SPIClass {
+  public:
+    void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+    void end() {}
+    void beginTransaction(SPISettings settings);
+    void endTransaction();
+    uint8_t transfer(uint8_t data);
+    void transfer(void* data, uint32_t size);
+    void writeBytes(const uint8_t* data, uint32_t size);
+    void transferBytes(const uint8_t* data, uint8_t* out, uint32_t size);
+
+  private:
+    SPISettings _settings;
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+//Same contract as the ESP32 ROM routine: little endian (reflected) CRC-32, caller handles the initial/final inversion
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+int mbedtls_sha256(const unsigned char* input, size_t ilen, unsigned char output[32], int is224);
@@ -0,0 +1,458 @@
+//Network bench: N copies of the firmware, each with its own host computer, sharing one simulated channel.
+//Every host queues messages to random peers, and the run reports what the network delivered and what it cost on air.
+//With --nodes 1 it doubles as a single node profiler for the radio path (SPI traffic per frame, CAD/TX timing, loop() cost).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <math.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include "SimAirMedium.h"
+#include "SimHost.h"
+#include "SimNode.h"
+#include "SimScheduler.h"
+#include "SX127xSim.h"
+#include "simSecurity.h"
+
+#define SIM_EPOCH 1767225600 //2026-01-01, what the simulated host computers report as the time at t=0
+#define SIM_BOOT_SPREAD_US 2000000 //nodes power up at random within this window
+#define SIM_CONNECT_DELAY_US 5000000 //hosts open the serial port this long after their node boots
+
+//LoComm framing as sent by the firmware (START_BYTE, type, payload length, payload, crc16, END_BYTE), see ../esp/functions.h.
+//Data and ACK payloads start with a cleartext routing header: sender, receiver, message number, sequence number
+#define SIM_FRAME_START 0xc1
+#define SIM_FRAME_END 0x8c
+#define SIM_FRAME_HEADER 3
+#define SIM_FRAME_OVERHEAD 6
+#define SIM_FRAME_ROUTING 5
+#define SIM_FRAME_DATA 0
+#define SIM_FRAME_ACK 1
+#define SIM_FRAME_CONTAINER 6
+
+struct Options {
+  double seconds = 300;
+  double warmupSeconds = 30;
+  int nodes = 10;
+  double messagesPerMinute = 2;
+  int messageSize = 64;
+  int destination = -1;
+  uint64_t seed = 1;
+  uint64_t loopPeriodUs = 1000;
+  const char* logPrefix = NULL;
+  const char* firmwarePath = NULL;
+  SimAirConfig air;
+};
+
+//one node, its host computer and what was measured about them
+struct Station {
+  int index;
+  SimFirmware firmware;
+  SimNode* node;
+  SimHostComputer* host;
+  uint32_t nextSequence;
+
+  uint64_t dataFrames;
+  uint64_t retransmissions; //data fragments this radio had already put on the air once
+  uint64_t ackFrames;
+  uint64_t controlFrames;
+  std::set<uint64_t> fragmentsSent;
+
+  uint64_t messagesDelivered; //messages from this station that reached their destination host
+  std::vector<uint64_t> latencies;
+};
+
+struct TrackedMessage {
+  int destination;
+  uint64_t queuedAt;
+  bool delivered;
+  bool broadcast; //sent to device ID 255, every other station should get a copy
+  std::set<int> receivedBy;
+};
+
+//frames put on the air at one spreading factor and bandwidth
+struct RateUsage {
+  uint64_t frames;
+  uint64_t implicitHeaderFrames;
+  uint64_t airtimeUs;
+  uint64_t preambleSymbols;
+};
+
+//frames put on the air on one frequency
+struct ChannelUsage {
+  uint64_t frames;
+  uint64_t airtimeUs;
+};
+
+struct Network {
+  std::vector<Station*> stations;
+  std::map<std::pair<int, uint32_t>, RateUsage> rates; //keyed by (spreading factor, bandwidth)
+  std::map<uint32_t, ChannelUsage> channels; //keyed by frequency
+  std::map<std::pair<int, uint32_t>, TrackedMessage> messages;
+  uint64_t noDestination; //arrivals dropped because no peer had a device ID yet
+  uint64_t duplicates;
+  uint64_t misdelivered;
+  uint64_t unparsedFrames;
+  uint64_t containerFrames; //packets that carried several frames in one container frame
+  uint64_t broadcastCopies; //copies of broadcasts that reached a host
+  uint64_t broadcastCopiesExpected;
+};
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  --seconds N          virtual time to simulate (default 300)\n"
+    "  --warmup N           seconds before the hosts start sending, lets the nodes pick device IDs (default 30)\n"
+    "  --nodes N            number of nodes sharing the channel (default 10)\n"
+    "  --rate N             messages per minute queued by each host (default 2)\n"
+    "  --size N             message text size in bytes (default 64)\n"
+    "  --dest N             send every message to device ID N instead of a random peer, 255 broadcasts\n"
+    "  --seed N             random seed (default 1)\n"
+    "  --loop-period-us N   virtual time charged per loop() pass (default 1000)\n"
+    "  --area N             side of the square the nodes are scattered over, in meters (default 300)\n"
+    "  --path-loss-exp N    log-distance path loss exponent (default 2.7)\n"
+    "  --shadowing N        standard deviation of the per-link shadowing, in dB (default 4)\n"
+    "  --loss N             probability that a receiver misses a frame it could otherwise hear (default 0)\n"
+    "  --cad-payload N      probability that CAD notices a frame past its preamble (default 0.9)\n"
+    "  --log PREFIX         write each node's debug output (Serial1) to PREFIX<node>.log\n"
+    "  --firmware FILE      firmware image (default: locomm-firmware.so next to this binary)\n",
+    argv0);
+}
+
+static bool parseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) return false;
+    if (!value) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return false;
+    }
+    i++;
+    if (strcmp(arg, "--seconds") == 0) options->seconds = atof(value);
+    else if (strcmp(arg, "--warmup") == 0) options->warmupSeconds = atof(value);
+    else if (strcmp(arg, "--nodes") == 0) options->nodes = atoi(value);
+    else if (strcmp(arg, "--rate") == 0) options->messagesPerMinute = atof(value);
+    else if (strcmp(arg, "--size") == 0) options->messageSize = atoi(value);
+    else if (strcmp(arg, "--dest") == 0) options->destination = atoi(value);
+    else if (strcmp(arg, "--seed") == 0) options->seed = strtoull(value, NULL, 10);
+    else if (strcmp(arg, "--loop-period-us") == 0) options->loopPeriodUs = strtoull(value, NULL, 10);
+    else if (strcmp(arg, "--area") == 0) options->air.areaMeters = atof(value);
+    else if (strcmp(arg, "--path-loss-exp") == 0) options->air.pathLossExponent = atof(value);
+    else if (strcmp(arg, "--shadowing") == 0) options->air.shadowingDb = atof(value);
+    else if (strcmp(arg, "--loss") == 0) options->air.packetLoss = atof(value);
+    else if (strcmp(arg, "--cad-payload") == 0) options->air.cadPayloadDetection = atof(value);
+    else if (strcmp(arg, "--log") == 0) options->logPrefix = value;
+    else if (strcmp(arg, "--firmware") == 0) options->firmwarePath = value;
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+  }
+  if (options->nodes < 1 || options->messageSize < 16) {
+    fprintf(stderr, "need at least one node and 16 byte messages\n");
+    return false;
+  }
+  return true;
+}
+
+static std::string defaultFirmwarePath() {
+  char self[1024];
+  const ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (n <= 0) return "locomm-firmware.so";
+  self[n] = 0;
+  return std::string(dirname(self)) + "/locomm-firmware.so";
+}
+
+static bool validDeviceID(uint8_t id) {
+  return id != 0 && id != 255;
+}
+
+static int pickDestination(Network* network, Station* station, const Options& options) {
+  if (options.destination >= 0) return options.destination;
+  std::vector<uint8_t> peers;
+  for (size_t i = 0; i < network->stations.size(); i++) {
+    const uint8_t id = network->stations[i]->firmware.deviceID();
+    if (network->stations[i] != station && validDeviceID(id)) peers.push_back(id);
+  }
+  if (peers.empty()) return -1;
+  return peers[station->node->random() % peers.size()];
+}
+
+static int stationByDeviceID(Network* network, int deviceID) {
+  for (size_t i = 0; i < network->stations.size(); i++) {
+    if (network->stations[i]->firmware.deviceID() == deviceID) return (int) i;
+  }
+  return -1;
+}
+
+//poisson arrivals on one host computer. The text carries the origin and sequence so the receiving host can be matched up
+static void scheduleTraffic(Network* network, Station* station, const Options& options, uint64_t time) {
+  Scheduler.at(time, NULL, [network, station, &options, time]() {
+    const int destination = pickDestination(network, station, options);
+    if (destination < 0) {
+      network->noDestination++;
+    } else {
+      const uint32_t sequence = station->nextSequence++;
+      std::vector<uint8_t> text(options.messageSize, '.');
+      char header[64];
+      const int length = snprintf(header, sizeof(header), "sim %d %u %llu ", station->index, sequence, (unsigned long long) time);
+      memcpy(&(text[0]), header, std::min(length, options.messageSize));
+      station->host->queueMessage((uint8_t) destination, text);
+
+      TrackedMessage message;
+      message.destination = stationByDeviceID(network, destination);
+      message.queuedAt = time;
+      message.delivered = false;
+      message.broadcast = destination == 255;
+      if (message.broadcast) network->broadcastCopiesExpected += network->stations.size() - 1;
+      network->messages[std::make_pair(station->index, sequence)] = message;
+    }
+
+    const double meanUs = 60e6 / options.messagesPerMinute;
+    const double u = (station->node->random() + 1.0) / 4294967297.0;
+    scheduleTraffic(network, station, options, time + (uint64_t) (-log(u) * meanUs));
+  });
+}
+
+static void recordDelivery(Network* network, Station* receiver, const SimHostDelivery& delivery) {
+  const std::string text(delivery.text.begin(), delivery.text.end());
+  int origin;
+  unsigned sequence;
+  if (sscanf(text.c_str(), "sim %d %u ", &origin, &sequence) != 2) return;
+  std::map<std::pair<int, uint32_t>, TrackedMessage>::iterator it = network->messages.find(std::make_pair(origin, (uint32_t) sequence));
+  if (it == network->messages.end()) return;
+  TrackedMessage& message = it->second;
+  Station* sender = network->stations[origin];
+  if (message.broadcast && receiver != sender) {
+    //every copy counts towards latency, the message is delivered once all of them are in
+    if (!message.receivedBy.insert(receiver->index).second) {
+      network->duplicates++;
+      return;
+    }
+    network->broadcastCopies++;
+    sender->latencies.push_back(delivery.receivedAt - message.queuedAt);
+    if (message.receivedBy.size() + 1 == network->stations.size()) {
+      message.delivered = true;
+      sender->messagesDelivered++;
+    }
+    return;
+  }
+  if (message.destination != receiver->index) {
+    network->misdelivered++;
+    return;
+  }
+  if (message.delivered) {
+    network->duplicates++;
+    return;
+  }
+  message.delivered = true;
+  sender->messagesDelivered++;
+  sender->latencies.push_back(delivery.receivedAt - message.queuedAt);
+}
+
+//counts one data, ACK or control frame. routing is the routing header of data and ACK frames
+static void recordFrame(Station* station, uint8_t type, const uint8_t* routing) {
+  if (type == SIM_FRAME_DATA) {
+    const uint64_t fragment = ((uint64_t) routing[0] << 24) | (routing[2] << 16) | (routing[3] << 8) | routing[4];
+    station->dataFrames++;
+    if (!station->fragmentsSent.insert(fragment).second) station->retransmissions++;
+  } else if (type == SIM_FRAME_ACK) {
+    station->ackFrames++;
+  } else {
+    station->controlFrames++;
+  }
+}
+
+//tally what a radio put on the air, reading the LoComm frames the same way a receiver would
+static void recordTransmission(Network* network, const SimFrame& frame) {
+  Station* station = NULL;
+  for (size_t i = 0; i < network->stations.size(); i++) {
+    if (network->stations[i]->node->radio == frame.sender) station = network->stations[i];
+  }
+  if (!station) return;
+
+  RateUsage& usage = network->rates[std::make_pair((int) frame.config.spreadingFactor, frame.config.bandwidth)];
+  usage.frames++;
+  if (frame.config.implicitHeader) usage.implicitHeaderFrames++;
+  usage.airtimeUs += frame.end - frame.start;
+  usage.preambleSymbols += frame.config.preambleLength;
+  ChannelUsage& channel = network->channels[frame.config.frequency];
+  channel.frames++;
+  channel.airtimeUs += frame.end - frame.start;
+
+  const std::vector<uint8_t>& p = frame.payload;
+  bool parsed = false;
+  for (size_t start = 0; start + SIM_FRAME_OVERHEAD < p.size(); start++) {
+    if (p[start] != SIM_FRAME_START) continue;
+    const size_t end = start + p[start + 2] + SIM_FRAME_OVERHEAD - 1;
+    if (end >= p.size() || p[end] != SIM_FRAME_END) continue;
+    const uint8_t type = p[start + 1];
+    const size_t routingSize = type == SIM_FRAME_DATA || type == SIM_FRAME_ACK || type == SIM_FRAME_CONTAINER ? SIM_FRAME_ROUTING : 0;
+    if (p[start + 2] < routingSize) continue;
+    const uint8_t* routing = &(p[start + SIM_FRAME_HEADER]);
+    uint8_t plaintext[256];
+    size_t plaintextLen;
+    if (!simOpenCiphertext(routing + routingSize, p[start + 2] - routingSize, &(p[start + 1]), SIM_FRAME_HEADER - 1 + routingSize,
+                           plaintext, sizeof(plaintext), &plaintextLen)) continue;
+
+    parsed = true;
+    if (type == SIM_FRAME_CONTAINER) {
+      //the frames inside are counted as if they had gone out on their own: type, length, message (routing header first)
+      network->containerFrames++;
+      for (size_t offset = 0; offset + 2 <= plaintextLen && offset + 2 + plaintext[offset + 1] <= plaintextLen; offset += 2 + plaintext[offset + 1]) {
+        recordFrame(station, plaintext[offset], &(plaintext[offset + 2]));
+      }
+    } else {
+      recordFrame(station, type, routing);
+    }
+    start = end;
+  }
+  if (!parsed) network->unparsedFrames++;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double fraction) {
+  if (sorted.empty()) return 0;
+  const size_t index = std::min(sorted.size() - 1, (size_t) (fraction * sorted.size()));
+  return sorted[index];
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage(argv[0]);
+    return 2;
+  }
+  const std::string firmwarePath = options.firmwarePath ? options.firmwarePath : defaultFirmwarePath();
+
+  SimAirMedium medium(options.air, options.seed);
+  Network network;
+  network.noDestination = 0;
+  network.duplicates = 0;
+  network.misdelivered = 0;
+  network.unparsedFrames = 0;
+  network.containerFrames = 0;
+  network.broadcastCopies = 0;
+  network.broadcastCopiesExpected = 0;
+  medium.onTransmit = [&network](const SimFrame& frame) { recordTransmission(&network, frame); };
+
+  for (int i = 0; i < options.nodes; i++) {
+    Station* station = new Station();
+    station->index = i;
+    if (!simLoadFirmware(firmwarePath.c_str(), i, &(station->firmware))) return 1;
+    station->node = new SimNode(i, station->firmware, &medium, options.seed);
+    station->node->loopPeriodUs = options.loopPeriodUs;
+    if (options.logPrefix) {
+      const std::string path = std::string(options.logPrefix) + std::to_string(i) + ".log";
+      station->node->logFile = fopen(path.c_str(), "w");
+      if (!station->node->logFile) {
+        fprintf(stderr, "could not open %s\n", path.c_str());
+        return 1;
+      }
+    }
+    station->host = new SimHostComputer(station->node, SIM_EPOCH);
+    station->host->onDelivery = [&network, station](const SimHostDelivery& delivery) { recordDelivery(&network, station, delivery); };
+    network.stations.push_back(station);
+  }
+
+  const uint64_t warmup = (uint64_t) (options.warmupSeconds * 1e6);
+  for (size_t i = 0; i < network.stations.size(); i++) {
+    Station* station = network.stations[i];
+    const uint64_t boot = station->node->random() % SIM_BOOT_SPREAD_US;
+    station->node->start(boot);
+    station->host->connect(boot + SIM_CONNECT_DELAY_US);
+    if (options.messagesPerMinute > 0) {
+      scheduleTraffic(&network, station, options, warmup + station->node->random() % (uint64_t) (60e6 / options.messagesPerMinute));
+    }
+  }
+
+  const uint64_t end = (uint64_t) (options.seconds * 1e6);
+  const clock_t wallStart = clock();
+  Scheduler.runUntil(end);
+  const double wallSeconds = (double) (clock() - wallStart) / CLOCKS_PER_SEC;
+
+  const SimRadioConfig config = network.stations[0]->node->radio->config();
+  printf("simulated %.1f s of %d nodes in %.2f s of CPU (%.0fx real time), %llu events\n",
+         options.seconds, options.nodes, wallSeconds, options.seconds / std::max(wallSeconds, 1e-9), (unsigned long long) Scheduler.eventsProcessed());
+  printf("radio config: %.3f MHz SF%d BW%.1fkHz CR4/%d preamble %d, %s header, CRC %s\n",
+         config.frequency / 1e6, config.spreadingFactor, config.bandwidth / 1e3, config.codingRate + 4, config.preambleLength,
+         config.implicitHeader ? "implicit" : "explicit", config.crc ? "on" : "off");
+
+  //network wide
+  uint64_t queued = 0, accepted = 0, rejected = 0, delivered = 0, halted = 0;
+  std::vector<uint64_t> latencies;
+  for (size_t i = 0; i < network.stations.size(); i++) {
+    Station* station = network.stations[i];
+    queued += station->host->stats.messagesQueued;
+    accepted += station->host->stats.messagesAccepted;
+    rejected += station->host->stats.messagesRejected;
+    delivered += station->messagesDelivered;
+    latencies.insert(latencies.end(), station->latencies.begin(), station->latencies.end());
+    if (station->node->halted) halted++;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const double measured = std::max(options.seconds - options.warmupSeconds, 1e-9);
+
+  printf("messages: %llu queued, %llu accepted by their node, %llu rejected, %llu delivered (%.1f%%), %llu duplicates, %llu misdelivered, %llu arrivals with no peer to send to\n",
+         (unsigned long long) queued, (unsigned long long) accepted, (unsigned long long) rejected, (unsigned long long) delivered,
+         queued ? 100.0 * delivered / queued : 0.0, (unsigned long long) network.duplicates, (unsigned long long) network.misdelivered,
+         (unsigned long long) network.noDestination);
+  if (network.broadcastCopiesExpected) {
+    printf("broadcast: %llu of %llu copies delivered (%.1f%%)\n", (unsigned long long) network.broadcastCopies,
+           (unsigned long long) network.broadcastCopiesExpected, 100.0 * network.broadcastCopies / network.broadcastCopiesExpected);
+  }
+  printf("goodput: %.1f bit/s of message text delivered after warmup\n", 8.0 * delivered * options.messageSize / measured);
+  printf("latency, host to host: p50 %.3f s, p90 %.3f s, p99 %.3f s, max %.3f s\n",
+         percentile(latencies, 0.5) / 1e6, percentile(latencies, 0.9) / 1e6, percentile(latencies, 0.99) / 1e6,
+         latencies.empty() ? 0.0 : latencies.back() / 1e6);
+  printf("channel: busy %.2f%%, %llu receptions, %llu collisions, %llu random losses, %llu missed while not listening, %llu below sensitivity\n",
+         100.0 * medium.channelBusyUs(end) / end, (unsigned long long) medium.stats.receptions, (unsigned long long) medium.stats.collisions,
+         (unsigned long long) medium.stats.randomLosses, (unsigned long long) medium.stats.missedWhileBusy,
+         (unsigned long long) medium.stats.belowSensitivity);
+  printf("data rates:");
+  for (std::map<std::pair<int, uint32_t>, RateUsage>::iterator it = network.rates.begin(); it != network.rates.end(); ++it) {
+    const RateUsage& usage = it->second;
+    printf(" SF%d/%.0fkHz %llu frames (%llu implicit header) %.1f s avg preamble %.1f;", it->first.first, it->first.second / 1e3,
+           (unsigned long long) usage.frames, (unsigned long long) usage.implicitHeaderFrames, usage.airtimeUs / 1e6,
+           (double) usage.preambleSymbols / usage.frames);
+  }
+  printf("\n");
+  printf("channels:");
+  for (std::map<uint32_t, ChannelUsage>::iterator it = network.channels.begin(); it != network.channels.end(); ++it) {
+    printf(" %.3f MHz %llu frames %.1f s;", it->first / 1e6, (unsigned long long) it->second.frames, it->second.airtimeUs / 1e6);
+  }
+  printf("\n");
+  if (network.containerFrames) printf("containers: %llu packets carried several frames in one container frame\n", (unsigned long long) network.containerFrames);
+  if (network.unparsedFrames) printf("warning: %llu frames on the air did not contain a LoComm frame\n", (unsigned long long) network.unparsedFrames);
+
+  std::set<uint8_t> ids;
+  for (size_t i = 0; i < network.stations.size(); i++) {
+    const uint8_t id = network.stations[i]->firmware.deviceID();
+    if (validDeviceID(id) && !ids.insert(id).second) printf("warning: device ID %d is used by more than one node\n", id);
+  }
+
+  //per node
+  printf("\nnode   ID  halted  frames  data  retx  acks  ctrl  airtime   CAD det/runs  rx ok  crc err  crypto  SPI/frame  CPU%%  log stall  sent  deliv  p50 lat\n");
+  for (size_t i = 0; i < network.stations.size(); i++) {
+    Station* station = network.stations[i];
+    const SX127xStats& radio = station->node->radio->stats;
+    std::sort(station->latencies.begin(), station->latencies.end());
+    printf("%4d  %3d  %6s  %6llu  %4llu  %4llu  %4llu  %4llu  %6.2f%%  %5llu/%-6llu  %5llu  %7llu  %6llu  %9.1f  %4.2f  %8.3fs  %4llu  %5llu  %6.3fs\n",
+           station->index, station->firmware.deviceID(), station->node->halted ? "yes" : "no",
+           (unsigned long long) radio.framesSent, (unsigned long long) station->dataFrames, (unsigned long long) station->retransmissions,
+           (unsigned long long) station->ackFrames, (unsigned long long) station->controlFrames,
+           100.0 * radio.txAirtimeUs / end, (unsigned long long) radio.cadDetections, (unsigned long long) radio.cadRuns,
+           (unsigned long long) radio.framesReceived, (unsigned long long) radio.crcErrors, (unsigned long long) station->node->stats.cryptoOperations,
+           radio.framesSent ? (double) station->node->stats.spiTransactions / radio.framesSent : 0.0,
+           100.0 * station->node->stats.cpuBusyUs / end, station->node->stats.logStallUs / 1e6,
+           (unsigned long long) station->host->stats.messagesQueued, (unsigned long long) station->messagesDelivered,
+           percentile(station->latencies, 0.5) / 1e6);
+  }
+  return halted ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+//Stand-in for src/esp/security_protocol.cpp. Every simulated node boots logged in and paired with the same network key.
+//The cipher is a keyed stream with a truncated FNV tag: not secure, but it keeps the real frame layout
+//(12 byte IV, ciphertext, 8 byte tag, AES_GCM_OVERHEAD in total) and still rejects anything that was tampered with.
+
+#include "Arduino.h"
+#include "SimNode.h"
+#include "simSecurity.h"
+#include "mbedtls/sha256.h"
+
+#define SIM_IV_SIZE 12
+#define SIM_TAG_SIZE 8
+#define SIM_CIPHER_OVERHEAD (SIM_IV_SIZE + SIM_TAG_SIZE)
+
+//rough cost of an mbedtls AES-GCM call on the ESP32 with the AES peripheral enabled
+#define SIM_CRYPTO_SETUP_NS 25000
+#define SIM_CRYPTO_NS_PER_BYTE 100
+
+static const uint64_t networkKey = 0x4c6f436f6d6d5369ULL;
+
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t ivSeed(const uint8_t* iv) {
+  uint64_t seed = networkKey;
+  for (int i = 0; i < SIM_IV_SIZE; i++) seed = mix(seed ^ iv[i]);
+  return seed;
+}
+
+static void applyKeystream(const uint8_t* iv, const uint8_t* in, uint8_t* out, size_t size) {
+  const uint64_t seed = ivSeed(iv);
+  uint64_t block = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (i % 8 == 0) block = mix(seed + i / 8);
+    out[i] = in[i] ^ (uint8_t) (block >> (8 * (i % 8)));
+  }
+}
+
+static void computeTag(const uint8_t* iv, const uint8_t* ciphertext, size_t size, const uint8_t* aad, size_t aadLen, uint8_t* tag) {
+  uint64_t hash = 0xcbf29ce484222325ULL ^ networkKey;
+  for (int i = 0; i < SIM_IV_SIZE; i++) hash = (hash ^ iv[i]) * 0x100000001b3ULL;
+  for (size_t i = 0; i < aadLen; i++) hash = (hash ^ aad[i]) * 0x100000001b3ULL;
+  hash = (hash ^ aadLen) * 0x100000001b3ULL;
+  for (size_t i = 0; i < size; i++) hash = (hash ^ ciphertext[i]) * 0x100000001b3ULL;
+  hash = mix(hash);
+  for (int i = 0; i < SIM_TAG_SIZE; i++) tag[i] = (uint8_t) (hash >> (8 * i));
+}
+
+static void chargeCrypto(size_t size) {
+  SimNode* node = simCurrentNode();
+  if (!node) return;
+  node->stats.cryptoOperations++;
+  node->consumeCpuNs(SIM_CRYPTO_SETUP_NS + size * SIM_CRYPTO_NS_PER_BYTE);
+}
+
+bool simOpenCiphertext(const uint8_t* ciphertext, size_t ciphertextLen, const uint8_t* aad, size_t aadLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen) {
+  if (ciphertextLen < SIM_CIPHER_OVERHEAD) return false;
+  const size_t size = ciphertextLen - SIM_CIPHER_OVERHEAD;
+  if (bufferSize < size) return false;
+  uint8_t tag[SIM_TAG_SIZE];
+  computeTag(ciphertext, ciphertext + SIM_IV_SIZE, size, aad, aadLen, tag);
+  if (memcmp(tag, ciphertext + SIM_IV_SIZE + size, SIM_TAG_SIZE) != 0) return false;
+  applyKeystream(ciphertext, ciphertext + SIM_IV_SIZE, plaintextBuffer, size);
+  *plaintextLen = size;
+  return true;
+}
+
+extern "C" {
+
+bool sec_init() { return true; }
+void sec_deinit() {}
+bool sec_setInitialPassword(const char* password) { return true; }
+bool sec_changePassword(const char* oldPassword, const char* newPassword) { return true; }
+bool sec_login(const char* password) { return true; }
+void sec_logout() {}
+bool sec_isLoggedIn() { return true; }
+bool sec_generate_key(char* outputBase85Buffer, size_t bufferSize) { return false; }
+bool sec_log_key(const char* inputBase85String) { return true; }
+bool sec_display_key(char* outputBase85Buffer, size_t bufferSize) { return false; }
+bool sec_isPaired() { return true; }
+bool sec_is_key_changed() { return false; }
+void sec_resetPairing() {}
+
+bool sec_encryptD2DMessage(const uint8_t* plaintext, size_t plaintextLen, uint8_t* ciphertextBuffer, size_t bufferSize, size_t* ciphertextLen, const uint8_t* aad, size_t aadLen) {
+  if (bufferSize < plaintextLen + SIM_CIPHER_OVERHEAD) return false;
+  chargeCrypto(plaintextLen);
+  uint8_t* iv = ciphertextBuffer;
+  esp_fill_random(iv, SIM_IV_SIZE);
+  applyKeystream(iv, plaintext, ciphertextBuffer + SIM_IV_SIZE, plaintextLen);
+  computeTag(iv, ciphertextBuffer + SIM_IV_SIZE, plaintextLen, aad, aadLen, ciphertextBuffer + SIM_IV_SIZE + plaintextLen);
+  *ciphertextLen = plaintextLen + SIM_CIPHER_OVERHEAD;
+  return true;
+}
+
+bool sec_decryptD2DMessage(const uint8_t* ciphertext, size_t ciphertextLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen, const uint8_t* aad, size_t aadLen) {
+  if (ciphertextLen < SIM_CIPHER_OVERHEAD) return false;
+  chargeCrypto(ciphertextLen - SIM_CIPHER_OVERHEAD);
+  return simOpenCiphertext(ciphertext, ciphertextLen, aad, aadLen, plaintextBuffer, bufferSize, plaintextLen);
+}
+
+//a plain hash instead of an HMAC, it only has to be the same on every node
+bool sec_deriveD2DSubkey(const char* label, uint8_t* output) {
+  uint8_t input[8 + 64];
+  const size_t labelLen = strlen(label) < 64 ? strlen(label) : 64;
+  for (int i = 0; i < 8; i++) input[i] = (uint8_t) (networkKey >> (8 * i));
+  memcpy(input + 8, label, labelLen);
+  return mbedtls_sha256(input, 8 + labelLen, output, 0) == 0;
+}
+
+}
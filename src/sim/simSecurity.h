@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Lets the harness read frames off the simulated air without charging any node for the crypto.
+//Returns false if the ciphertext and additional data do not authenticate under the network key.
+bool simOpenCiphertext(const uint8_t* ciphertext, size_t ciphertextLen, const uint8_t* aad, size_t aadLen, uint8_t* plaintextBuffer, size_t bufferSize, size_t* plaintextLen);